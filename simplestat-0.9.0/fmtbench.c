@@ -0,0 +1,211 @@
+/*
+ * fmtbench.c: Compare the formatting helpers of the report (out_str(),
+ * out_fixed2(), out_ull()) with snprintf(), for speed and output.
+ *
+ * Usage: fmtbench [ <passes> ]
+ *
+ * 10k device rows laid out as in the extended and basic reports (a
+ * device name, 13 rates and 2 counters) are rendered both ways. Both
+ * renderings must be the same byte for byte. Values include numbers
+ * halfway between two hundredths, negative zeros and values too large
+ * for out_fixed2() (handed over to printf()).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "iostat.h"
+
+#define NR_ROWS		10000
+#define NR_FIXED2_COLS	13
+#define NR_ULL_COLS	2
+#define DEFAULT_PASSES	20
+
+extern __thread struct out_buf st_out;
+
+/* Width of each rate column, as in write_ext_stat() */
+static const int col_width[NR_FIXED2_COLS] = {8, 8, 7, 7, 8, 8, 8, 8, 7, 7, 7, 6, 6};
+
+struct bench_row {
+	char name[16];
+	double v[NR_FIXED2_COLS];
+	unsigned long long u[NR_ULL_COLS];
+};
+
+unsigned long long seed = 0x5353524653535246ULL;
+
+/*
+ * Pseudo-random number generator (xorshift64), so that every run uses
+ * the same values.
+ */
+unsigned long long next_rand(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+/*
+ * Get a value to be displayed with two decimals.
+ */
+double rand_fixed2(void)
+{
+	static const double special[] = {
+		0.0, -0.0, 0.005, 0.015, 0.125, 0.375, 2.675, 1.005, -0.001,
+		-0.005, 99.995, 9999999999999.995, -9999999999999.99, 1e13,
+		999999999999999.9, 1e20,
+		INFINITY, -INFINITY, NAN
+	};
+	unsigned long long r = next_rand();
+
+	switch (r % 8) {
+	case 0:
+		return special[(r >> 8) % (sizeof(special) / sizeof(special[0]))];
+	case 1:
+		/* Exactly halfway between two hundredths */
+		return (double) ((r >> 8) % 800000) / 8.0;
+	case 2:
+		/* Three decimals, often halfway in decimal only */
+		return (double) ((r >> 8) % 10000000) / 1000.0;
+	case 3:
+		return -(double) ((r >> 8) % 1000000) / 100.0;
+	case 4:
+		/* Large rates */
+		return (double) (r >> 12) / 1000.0;
+	default:
+		/* Usual rates and percentages */
+		return (double) (r >> 11) / (double) (1ULL << 53) * 1000.0;
+	}
+}
+
+/*
+ * Render rows with the formatting helpers of the report into st_out.
+ */
+void render_out(struct bench_row *rows)
+{
+	int i, c;
+
+	st_out.len = 0;
+	for (i = 0; i < NR_ROWS; i++) {
+		out_str(rows[i].name, 13);
+		for (c = 0; c < NR_FIXED2_COLS; c++) {
+			out_char(' ');
+			out_fixed2(rows[i].v[c], col_width[c]);
+		}
+		for (c = 0; c < NR_ULL_COLS; c++) {
+			out_char(' ');
+			out_ull(rows[i].u[c], 10);
+		}
+		out_char('\n');
+	}
+}
+
+/*
+ * Render rows with snprintf() into buf (of size size).
+ * Return the number of bytes rendered.
+ */
+size_t render_printf(struct bench_row *rows, char *buf, size_t size)
+{
+	size_t len = 0;
+	double *v;
+	int i;
+
+	for (i = 0; i < NR_ROWS; i++) {
+		v = rows[i].v;
+		len += snprintf(buf + len, size - len,
+				"%-13s %8.2f %8.2f %7.2f %7.2f %8.2f %8.2f %8.2f %8.2f"
+				" %7.2f %7.2f %7.2f %6.2f %6.2f %10llu %10llu\n",
+				rows[i].name, v[0], v[1], v[2], v[3], v[4], v[5], v[6],
+				v[7], v[8], v[9], v[10], v[11], v[12],
+				rows[i].u[0], rows[i].u[1]);
+	}
+
+	return len;
+}
+
+/*
+ * Get monotonic time in ns.
+ */
+unsigned long long get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Display the first row that differs between both renderings.
+ */
+void show_mismatch(char *a, size_t alen, char *b, size_t blen)
+{
+	size_t i, start = 0;
+	char *ea, *eb;
+
+	for (i = 0; (i < alen) && (i < blen) && (a[i] == b[i]); i++) {
+		if (a[i] == '\n') {
+			start = i + 1;
+		}
+	}
+	ea = memchr(a + start, '\n', alen - start);
+	eb = memchr(b + start, '\n', blen - start);
+	printf("First mismatch at byte %zu:\n", i);
+	printf("  out_*():    %.*s\n", ea ? (int) (ea - a - start) : (int) (alen - start), a + start);
+	printf("  snprintf(): %.*s\n", eb ? (int) (eb - b - start) : (int) (blen - start), b + start);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_row *rows;
+	unsigned long long t0, t_out = 0, t_printf = 0;
+	size_t size, len = 0;
+	char *buf;
+	int passes = DEFAULT_PASSES, i, c;
+
+	if ((argc > 2) || ((argc == 2) && ((passes = atoi(argv[1])) < 1))) {
+		fprintf(stderr, "Usage: %s [ <passes> ]\n", argv[0]);
+		exit(1);
+	}
+
+	size = NR_ROWS * 512;
+	if (((rows = (struct bench_row *) malloc(sizeof(struct bench_row) * NR_ROWS)) == NULL) ||
+	    ((buf = (char *) malloc(size)) == NULL)) {
+		perror("malloc");
+		exit(4);
+	}
+	for (i = 0; i < NR_ROWS; i++) {
+		snprintf(rows[i].name, sizeof(rows[i].name), "dev%d-%d", (int) (next_rand() % 260), i);
+		for (c = 0; c < NR_FIXED2_COLS; c++) {
+			rows[i].v[c] = rand_fixed2();
+		}
+		rows[i].u[0] = next_rand() % 100000000;
+		rows[i].u[1] = next_rand() >> (next_rand() % 64);
+	}
+
+	for (i = 0; i < passes; i++) {
+		t0 = get_time_ns();
+		render_out(rows);
+		t_out += get_time_ns() - t0;
+
+		t0 = get_time_ns();
+		len = render_printf(rows, buf, size);
+		t_printf += get_time_ns() - t0;
+	}
+
+	printf("%d rows x %d passes: out_*() %.2f ms, snprintf() %.2f ms per %d rows\n",
+	       NR_ROWS, passes, t_out / 1e6 / passes, t_printf / 1e6 / passes, NR_ROWS);
+
+	if ((st_out.len != len) || memcmp(st_out.buf, buf, len)) {
+		show_mismatch(st_out.buf, st_out.len, buf, len);
+		exit(3);
+	}
+	printf("Output identical (%zu bytes)\n", len);
+
+	return 0;
+}
@@ -6,6 +6,10 @@
 #ifndef _IOSTAT_H
 #define _IOSTAT_H
 
+#include <time.h>
+#include <semaphore.h>
+#include <sys/types.h>
+
 #include "common.h"
 
 /* I_: iostat - D_: Display - F_: Flag */
@@ -24,11 +28,14 @@
 #define I_D_HUMAN_READ		0x01000
 #define I_D_PERSIST_NAME	0x02000
 #define I_D_OMIT_SINCE_BOOT	0x04000
-/* Unused			0x08000 */
+#define I_D_MEMORY		0x08000
 #define I_D_DEVMAP_NAME		0x10000
 #define I_D_ISO			0x20000
 #define I_D_GROUP_TOTAL_ONLY	0x40000
 #define I_D_ZERO_OMIT		0x80000
+#define I_D_PER_CPU		0x100000
+#define I_D_HIRES		0x200000
+#define I_D_NET			0x400000
 
 #define DISPLAY_CPU(m)			(((m) & I_D_CPU)              == I_D_CPU)
 #define DISPLAY_DISK(m)			(((m) & I_D_DISK)             == I_D_DISK)
@@ -49,10 +56,55 @@
 #define DISPLAY_ISO(m)			(((m) & I_D_ISO)              == I_D_ISO)
 #define DISPLAY_GROUP_TOTAL_ONLY(m)	(((m) & I_D_GROUP_TOTAL_ONLY) == I_D_GROUP_TOTAL_ONLY)
 #define DISPLAY_ZERO_OMIT(m)		(((m) & I_D_ZERO_OMIT)        == I_D_ZERO_OMIT)
+#define DISPLAY_PER_CPU(m)		(((m) & I_D_PER_CPU)          == I_D_PER_CPU)
+#define USE_HIRES(m)			(((m) & I_D_HIRES)            == I_D_HIRES)
+#define DISPLAY_MEMORY(m)		(((m) & I_D_MEMORY)           == I_D_MEMORY)
+#define DISPLAY_NET(m)			(((m) & I_D_NET)              == I_D_NET)
 
 /* Preallocation constants */
 #define NR_DEV_PREALLOC		4
 
+/* Minimum number of buckets in the device name hash index */
+#define NR_DEV_HASH_MIN		64
+
+/* Initial size of the buffers used to read /proc files */
+#define PROC_BUF_SIZE		16384
+/*
+ * Room that must be left in a buffer after a short read for it to be
+ * considered as the end of the file (longer than any single line).
+ */
+#define PROC_BUF_SLACK		512
+
+/*
+ * Number of counters per device found in /proc/diskstats
+ * (after major, minor and name, i.e. lines of 14, 18 or 20 fields)
+ * and in /sys/block/<dev>/stat.
+ */
+#define NR_DISK_FIELDS		11	/* Before kernel 4.18 */
+#define NR_DISK_FIELDS_DISCARD	15	/* Kernel 4.18+: discard stats added */
+#define NR_DISK_FIELDS_FLUSH	17	/* Kernel 5.5+: flush stats added */
+#define NR_PART_FIELDS		4	/* Partition without extended stats */
+/* Counters parsed: One more than the longest layout, to detect longer ones */
+#define NR_DISK_FIELDS_PARSED	(NR_DISK_FIELDS_FLUSH + 1)
+
+/*
+ * Alignment (in bytes) of the columns of the structure-of-arrays
+ * snapshots. Column sizes are rounded up to a multiple of NR_SOA_LANES
+ * counters so that the batch kernel never needs a partial vector.
+ */
+#define SOA_ALIGN		64
+#define NR_SOA_LANES		4
+
+/* Nanoseconds per second, used by the interval scheduler */
+#define NSEC_PER_SEC		1000000000ULL
+
+/*
+ * Rate per second of a counter over an interval expressed either in
+ * jiffies (d = itv, k = HZ: Same as S_VALUE()) or, in high-resolution
+ * mode, in nanoseconds (d = ns, k = NSEC_PER_SEC).
+ */
+#define R_VALUE(m,n,d,k)	(((double) ((n) - (m))) / (d) * (k))
+
 /* Environment variable */
 #define ENV_POSIXLY_CORRECT	"POSIXLY_CORRECT"
 
@@ -60,7 +112,8 @@
  * Structures for I/O stats.
  * The number of structures allocated corresponds to the number of devices
  * present in the system, plus a preallocation number to handle those
- * that can be registered dynamically.
+ * that can be registered dynamically. When all of them are used, the
+ * tables are doubled in size (see grow_device_tables()).
  * The number of devices is found by using /sys filesystem (if mounted).
  * For each io_stats structure allocated corresponds a io_hdr_stats structure.
  * A io_stats structure is considered as unused or "free" (containing no stats
@@ -112,6 +165,107 @@ struct io_hdr_stats {
 
 #define IO_HDR_STATS_SIZE	(sizeof(struct io_hdr_stats))
 
+/* Network interface using a slot of the interface tables (see net.h) */
+struct net_hdr {
+	/* DISK_REGISTERED, or DISK_UNREGISTERED until it is read again */
+	unsigned int status;
+	unsigned int used;
+	char name[MAX_IFACE_LEN];
+};
+
+#define NET_HDR_SIZE	(sizeof(struct net_hdr))
+
+/*
+ * Structure-of-arrays copy of an io_stats snapshot, used to compute
+ * extended stats for all the devices at once.
+ * Each column is a contiguous, SOA_ALIGN aligned array of counters
+ * indexed by device slot (same index as in st_iodev).
+ */
+#define SOA_RD_SECTORS	0
+#define SOA_WR_SECTORS	1
+#define SOA_RD_IOS	2
+#define SOA_RD_MERGES	3
+#define SOA_WR_IOS	4
+#define SOA_WR_MERGES	5
+#define SOA_RD_TICKS	6
+#define SOA_WR_TICKS	7
+#define SOA_TOT_TICKS	8
+#define SOA_RQ_TICKS	9
+#define NR_SOA_COLS	10
+
+struct io_stats_soa {
+	unsigned long long *col[NR_SOA_COLS];
+	/*
+	 * Snapshot held: Time it was taken (0: none), and device list
+	 * (dict_gen and iodev_nr) of the sample it belongs to.
+	 */
+	unsigned long long ts;
+	unsigned int dict_gen;
+	int dev_nr;
+};
+
+/*
+ * Extended stats computed for every device slot by the batch kernel.
+ * Same layout: One aligned array of values per output column.
+ */
+#define XR_RRQM		0	/* rrqm/s */
+#define XR_WRQM		1	/* wrqm/s */
+#define XR_RIO		2	/* r/s */
+#define XR_WIO		3	/* w/s */
+#define XR_RSEC		4	/* rsec/s (before unit conversion) */
+#define XR_WSEC		5	/* wsec/s (before unit conversion) */
+#define XR_ARQSZ	6	/* avgrq-sz */
+#define XR_AQUSZ	7	/* avgqu-sz */
+#define XR_AWAIT	8	/* await */
+#define XR_R_AWAIT	9	/* r_await */
+#define XR_W_AWAIT	10	/* w_await */
+#define XR_SVCTM	11	/* svctm */
+#define XR_UTIL		12	/* %util (before division by group size) */
+#define NR_XR_COLS	13
+
+/* CPU utilization (in percent), as displayed */
+#define CPU_PCT_USER	0
+#define CPU_PCT_NICE	1
+#define CPU_PCT_KERNEL	2	/* System, hardirq and softirq */
+#define CPU_PCT_IOWAIT	3
+#define CPU_PCT_STEAL	4
+#define CPU_PCT_IDLE	5
+#define NR_CPU_PCT	6
+
+/* Fields of /proc/meminfo (see read_meminfo_buf()) */
+#define MI_MEMTOTAL	0
+#define MI_MEMFREE	1
+#define MI_BUFFERS	2
+#define MI_CACHED	3
+#define MI_SWAPCACHED	4
+#define MI_ACTIVE	5
+#define MI_INACTIVE	6
+#define MI_SWAPTOTAL	7
+#define MI_SWAPFREE	8
+#define MI_DIRTY	9
+#define MI_ANONPAGES	10
+#define MI_SLAB		11
+#define MI_KERNELSTACK	12
+#define MI_PAGETABLES	13
+#define MI_COMMITTED	14
+#define MI_VMALLOCUSED	15
+#define MI_HUGETOTAL	16
+#define MI_HUGEFREE	17
+#define MI_HUGESIZE	18
+#define NR_MEMINFO	19
+
+/*
+ * Perfect hash of the names of the fields above (n is the length of the
+ * name): No two of them share a slot. This is checked when the table is
+ * built, and must be checked again when a field is added.
+ */
+#define MEMINFO_HASH_SIZE	64
+#define MEMINFO_HASH(s, n)	(((n) + 5 * (unsigned char) (s)[0]) & (MEMINFO_HASH_SIZE - 1))
+
+struct io_ext_rates {
+	double *col[NR_XR_COLS];
+};
+
 /* List of devices entered on the command line */
 struct io_dlist {
 	/* Indicate whether its partitions are to be displayed or not */
@@ -122,4 +276,202 @@ struct io_dlist {
 
 #define IO_DLIST_SIZE	(sizeof(struct io_dlist))
 
+/*
+ * A /proc file kept open for the whole life of the process.
+ * Its contents are read again at each interval with pread() from offset 0
+ * into a buffer that is allocated once and only grows with the file.
+ */
+struct proc_file {
+	int fd;
+	/* Buffer containing file contents (NUL terminated) */
+	char *buf;
+	/* Size allocated for buf */
+	size_t size;
+	/* Number of bytes read at last interval */
+	size_t len;
+	/*
+	 * Set for files that are generated a page at a time (e.g.
+	 * /proc/diskstats, /proc/net/dev): A short read doesn't tell the
+	 * end of the file.
+	 */
+	int until_eof;
+};
+
+#define PROC_FILE_SIZE	(sizeof(struct proc_file))
+
+/*
+ * Buffer into which a whole report is formatted before being written
+ * to stdout with a single write().
+ * It is allocated once and only grows when a report doesn't fit.
+ */
+struct out_buf {
+	char *buf;
+	/* Size allocated for buf */
+	size_t size;
+	/* Number of bytes waiting to be written */
+	size_t len;
+};
+
+#define OUT_BUF_SIZE	65536
+/* Room guaranteed before formatting a line */
+#define OUT_BUF_SLACK	512
+
+/*
+ * Values with an absolute value above this are formatted with printf()
+ * by out_fixed2(), as are NaN and infinities. Below it, hundredths are
+ * exact (v * 100 < 2^50) and rounding matches printf().
+ */
+#define FIXED2_MAX	1e13
+
+/* Size of the stdio buffer of the XML log file */
+#define LOG_BUF_SIZE	65536
+
+/* Default size of the history file */
+#define HIST_DEF_SIZE	(64ULL * 1024 * 1024)
+
+/*
+ * Stats needed to display one report: current and previous snapshots
+ * of CPU and I/O stats, and the device headers they refer to.
+ * In synchronous mode, the pointers refer to the global tables.
+ * When the sampler and writer threads are used, each sample owns a copy
+ * of them, so that a sample may be dropped or delayed without the
+ * others being affected.
+ */
+struct stats_sample {
+	/* Index of current snapshot in cpu[], iodev[], uptime[] etc. */
+	int curr;
+	/* Number of devices in iodev[] and hdr */
+	int iodev_nr;
+	/* Number of devices allocated in iodev[] and hdr (owned copies only) */
+	int iodev_alloc;
+	struct stats_cpu *cpu[2];
+	struct io_stats *iodev[2];
+	struct io_hdr_stats *hdr;
+	unsigned long long uptime[2];
+	unsigned long long uptime0[2];
+	/* Time at which each snapshot was taken (ns, CLOCK_MONOTONIC_RAW) */
+	unsigned long long ts[2];
+	/* Time at which current snapshot was taken (ns since the Epoch) */
+	unsigned long long realtime;
+	/* Incremented each time the list of devices in hdr changes */
+	unsigned int dict_gen;
+	struct tm rectime;
+	/* Scheduler state when the sample was taken */
+	long long jitter;
+	unsigned long long missed;
+	/* Number of samples dropped by the sampler so far */
+	unsigned long long dropped;
+	/* Memory stats when the sample was taken (if has_memory is set) */
+	int has_memory;
+	struct stats_memory mem;
+	struct stats_huge huge;
+	/* Network interfaces (if has_net is set), indexed by slot as iodev[] */
+	int has_net;
+	int net_nr;
+	/* Number of slots allocated (owned copies only) */
+	int net_alloc;
+	struct net_hdr *net_hdr;
+	struct stats_net_dev *netdev[2];
+	struct stats_net_edev *netedev[2];
+	/* Interrupts of every IRQ on every CPU (if has_irq is set) */
+	int has_irq;
+	struct irq_matrix *irq;
+	/* Softirqs of every type on every CPU (if has_softirq is set) */
+	int has_softirq;
+	struct irq_matrix *softirq;
+};
+
+#define STATS_SAMPLE_SIZE	(sizeof(struct stats_sample))
+
+/* What the sampler does when the ring of samples is full */
+#define RING_DROP_OLDEST	0
+#define RING_BLOCK		1
+
+/*
+ * Ring of samples passed from the sampler thread to the writer thread.
+ * Samples are never copied through the ring: It only carries indexes
+ * in buf[]. Ready samples are queued in filled[] (at most size of them),
+ * buffers that the writer is done with are returned through freed[].
+ * The sampler is the only one to advance head and free_tail, the writer
+ * the only one to advance free_head. tail is advanced by the writer when
+ * it takes a sample and by the sampler when it drops the oldest one,
+ * hence with a compare-and-swap.
+ * Counters are never wrapped: Slots are addressed modulo the ring size.
+ * The semaphores are only used to sleep when there is nothing to do.
+ * space is only posted when the sampler has set waiting (it only waits
+ * for the writer with the RING_BLOCK policy), and by the SIGINT/SIGTERM
+ * handler.
+ */
+struct sample_ring {
+	struct stats_sample *buf;
+	int nbuf;
+	int size;
+	int policy;
+	int *filled;
+	unsigned long long head;
+	unsigned long long tail;
+	int *freed;
+	unsigned long long free_head;
+	unsigned long long free_tail;
+	unsigned long long dropped;
+	int done;
+	/* Set by the sampler before it waits for a buffer, cleared by the writer */
+	int waiting;
+	sem_t items;
+	sem_t space;
+};
+
+#define RING_DEF_SIZE	16
+/* Time given to the writer to display the samples left when stopped by a signal (s) */
+#define RING_STOP_WAIT	1
+
+/*
+ ***************************************************************************
+ * Functions prototypes (used to display stats from other files)
+ ***************************************************************************
+ */
+
+extern void
+	close_proc_file(struct proc_file *);
+extern void
+	compute_cpu_pct(struct stats_cpu *, struct stats_cpu *, unsigned long long, double *);
+extern int
+	compute_per_cpu_pct(struct stats_sample *, int, double *);
+extern void
+	compute_sample_ext_rates(struct stats_sample *, double, double);
+extern void
+	get_device_itv(struct stats_sample *, double *, double *);
+extern unsigned int
+	hash_dev_name(char *);
+extern char *
+	next_proc_line(struct proc_file *, char **);
+extern int
+	open_proc_file(struct proc_file *, char *);
+extern void
+	out_char(char);
+extern void
+	out_field(const char *, int, int);
+extern void
+	out_fixed2(double, int);
+extern void
+	out_flush(void);
+extern void
+	out_printf(const char *, ...);
+extern void
+	out_str(const char *, int);
+extern void
+	out_ull(unsigned long long, int);
+extern int
+	parse_dec_fields(char **, unsigned long long *, int);
+extern ssize_t
+	read_proc_file(struct proc_file *);
+extern void
+	salloc_io_soa(int);
+extern void
+	sfree_io_soa(void);
+extern void
+	write_disk_stat_header(int *);
+extern void
+	write_ext_stat(int, int, struct io_hdr_stats *, struct io_ext_rates *);
+
 #endif  /* _IOSTAT_H */
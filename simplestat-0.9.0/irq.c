@@ -0,0 +1,476 @@
+/*
+ * irq.c: Interrupt stats per CPU (see irq.h)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "iostat.h"
+#include "common.h"
+#include "count.h"
+#include "irq.h"
+
+extern int flags;
+extern unsigned int actflags;
+
+/* Interrupts of each slot during the interval, and top sources (see write_irq_top()) */
+__thread unsigned long long *irq_sum = NULL;
+__thread int irq_sum_nr = 0;
+__thread int *irq_rank = NULL;
+__thread int irq_rank_nr = 0;
+
+/*
+ * Size the matrices for nr slots. New slots are unused.
+ * Slots keep their numbers, rows of every CPU being moved.
+ */
+void irq_grow(struct irq_matrix *m, int nr)
+{
+	struct stats_irqcpu *cell;
+	size_t size;
+	int i, c;
+
+	for (i = 0; i < 2; i++) {
+		if ((cell = (struct stats_irqcpu *) calloc((size_t) m->cpu_nr * nr,
+							   STATS_IRQCPU_SIZE)) == NULL) {
+			perror("malloc");
+			exit(4);
+		}
+		for (c = 0; m->max && (c < m->cpu_nr); c++) {
+			memcpy(cell + (size_t) c * nr, m->cell[i] + (size_t) c * m->max,
+			       STATS_IRQCPU_SIZE * m->max);
+		}
+		free(m->cell[i]);
+		m->cell[i] = cell;
+	}
+	size = IRQ_DESC_LEN * nr;
+	SREALLOC(m->desc, char, size);
+	memset(m->desc + IRQ_DESC_LEN * m->max, 0, IRQ_DESC_LEN * (nr - m->max));
+	size = nr;
+	SREALLOC(m->status, char, size);
+	memset(m->status + m->max, IRQ_UNUSED, nr - m->max);
+	size = sizeof(int) * nr;
+	SREALLOC(m->line_slot, int, size);
+	memset(m->line_slot + m->max, 0xff, sizeof(int) * (nr - m->max));
+
+	m->max = nr;
+	m->gen++;
+}
+
+/*
+ * Get the slot of the IRQ found on line number line of the file.
+ * An IRQ that was not listed at previous interval takes an unused slot.
+ */
+int irq_slot(struct irq_matrix *m, char *name, int line, int curr)
+{
+	int s, c;
+
+	if ((line < m->max) && ((s = m->line_slot[line]) >= 0) &&
+	    (m->status[s] != IRQ_UNUSED) &&
+	    !strcmp(IRQ_CELL(m, curr, 0, s).irq_name, name))
+		/* Same IRQ as on that line at previous interval */
+		return s;
+
+	/* IRQs have been added or removed: Look for it in every slot */
+	for (s = 0; s < m->max; s++) {
+		if ((m->status[s] != IRQ_UNUSED) &&
+		    !strcmp(IRQ_CELL(m, curr, 0, s).irq_name, name))
+			break;
+	}
+
+	if (s == m->max) {
+		for (s = 0; (s < m->max) && (m->status[s] != IRQ_UNUSED); s++);
+		if (s == m->max) {
+			/* No unused slot left: Make room for new IRQs */
+			irq_grow(m, m->max * 2);
+		}
+		/*
+		 * New IRQ: Its counters at previous interval are 0,
+		 * so that its first stats are those since boot.
+		 */
+		for (c = 0; c < m->cpu_nr; c++) {
+			IRQ_CELL(m, 0, c, s).interrupt = 0;
+			IRQ_CELL(m, 1, c, s).interrupt = 0;
+		}
+		strcpy(IRQ_CELL(m, 0, 0, s).irq_name, name);
+		strcpy(IRQ_CELL(m, 1, 0, s).irq_name, name);
+		m->status[s] = IRQ_LISTED;
+		m->gen++;
+	}
+
+	if (line < m->max) {
+		m->line_slot[line] = s;
+	}
+	return s;
+}
+
+/*
+ * Read the counters of every IRQ on every CPU into matrix curr.
+ * IRQs that are no longer listed give their slot back.
+ */
+void irq_read(struct irq_matrix *m, int curr)
+{
+	unsigned long long extra;
+	char *line, *pos, *p, *name, *d;
+	int c, i, j, n, s;
+
+	/* Every IRQ is potentially gone */
+	for (s = 0; s < m->max; s++) {
+		if (m->status[s] == IRQ_LISTED) {
+			m->status[s] = IRQ_GONE;
+		}
+	}
+
+	if (read_proc_file(&m->pf) < 0) {
+		fprintf(stderr, "Cannot read %s: %s\n", m->file, strerror(errno));
+		exit(2);
+	}
+
+	/* Header: "CPU0 CPU1 ...". /proc/interrupts only lists CPUs online */
+	pos = m->pf.buf;
+	memset(m->online, 0, m->cpu_nr);
+	m->col_nr = 0;
+	if ((p = next_proc_line(&m->pf, &pos)) != NULL) {
+		while ((m->col_nr < m->cpu_nr) && ((p = strstr(p, "CPU")) != NULL)) {
+			c = atoi(p += 3);
+			if ((c < 0) || (c >= m->cpu_nr))
+				break;
+			m->col_cpu[m->col_nr++] = c;
+			m->online[c] = TRUE;
+		}
+	}
+
+	for (i = 0; (line = next_proc_line(&m->pf, &pos)) != NULL; i++) {
+
+		/* "<name>: <counter on each CPU> <description>" */
+		if ((p = strchr(line, ':')) == NULL)
+			continue;
+		*p++ = '\0';
+		for (name = line; *name == ' '; name++);
+		if (strlen(name) >= MAX_IRQ_LEN) {
+			name[MAX_IRQ_LEN - 1] = '\0';
+		}
+
+		s = irq_slot(m, name, i, curr);
+		m->status[s] = IRQ_LISTED;
+
+		n = parse_dec_fields(&p, m->v, m->col_nr);
+		for (j = 0; j < n; j++) {
+			IRQ_CELL(m, curr, m->col_cpu[j], s).interrupt = (unsigned int) m->v[j];
+		}
+		/* Totals (e.g. ERR) have a single counter: It goes to the first CPU */
+		for (; j < m->col_nr; j++) {
+			IRQ_CELL(m, curr, m->col_cpu[j], s).interrupt = 0;
+		}
+		/* Skip the counters of CPUs beyond cpu_nr, if any */
+		while (parse_dec_fields(&p, &extra, 1));
+
+		/* Description, with runs of blanks squeezed */
+		d = m->desc + IRQ_DESC_LEN * s;
+		for (n = 0; *p && (n < IRQ_DESC_LEN - 1); p++) {
+			if ((*p != ' ') || (n && (d[n - 1] != ' '))) {
+				d[n++] = *p;
+			}
+		}
+		while (n && (d[n - 1] == ' ')) {
+			n--;
+		}
+		d[n] = '\0';
+	}
+
+	for (c = 0; c < m->cpu_nr; c++) {
+		if (!m->online[c]) {
+			/* CPU is offline: It has not served any interrupt */
+			memcpy(m->cell[curr] + (size_t) c * m->max,
+			       m->cell[!curr] + (size_t) c * m->max,
+			       STATS_IRQCPU_SIZE * m->max);
+		}
+	}
+
+	for (s = 0; s < m->max; s++) {
+		if (m->status[s] == IRQ_GONE) {
+			/* IRQ has been removed */
+			m->status[s] = IRQ_UNUSED;
+			m->gen++;
+		}
+	}
+}
+
+/*
+ * Open a file of interrupt counters (/proc/interrupts or /proc/softirqs),
+ * and size the matrices for the IRQs it lists plus a few more.
+ */
+void irq_open(struct irq_matrix *m, char *file, int cpu_nr)
+{
+	size_t size;
+
+	memset(m, 0, sizeof(struct irq_matrix));
+	m->file = file;
+	m->cpu_nr = cpu_nr;
+
+	/* File is generated a few lines at a time */
+	m->pf.until_eof = TRUE;
+	if (!open_proc_file(&m->pf, file)) {
+		fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+		exit(2);
+	}
+	size = cpu_nr;
+	SREALLOC(m->online, char, size);
+	size = sizeof(int) * cpu_nr;
+	SREALLOC(m->col_cpu, int, size);
+	size = sizeof(unsigned long long) * cpu_nr;
+	SREALLOC(m->v, unsigned long long, size);
+
+	irq_grow(m, get_irqcpu_nr(file, NR_IRQS, cpu_nr) + NR_IRQCPU_PREALLOC);
+}
+
+/*
+ * Close the file and free the matrices.
+ */
+void irq_close(struct irq_matrix *m)
+{
+	int i;
+
+	close_proc_file(&m->pf);
+	for (i = 0; i < 2; i++) {
+		free(m->cell[i]);
+	}
+	free(m->desc);
+	free(m->status);
+	free(m->line_slot);
+	free(m->col_cpu);
+	free(m->online);
+	free(m->v);
+	memset(m, 0, sizeof(struct irq_matrix));
+}
+
+/*
+ * Copy the counters of the matrices into a copy owned by a buffer of the
+ * ring (allocated the first time). The copy is only enlarged when IRQs
+ * have been added.
+ */
+void irq_copy(struct irq_matrix **dst, struct irq_matrix *src)
+{
+	struct irq_matrix *m = *dst;
+	size_t size;
+	int i;
+
+	if (m == NULL) {
+		if ((m = (struct irq_matrix *) calloc(1, sizeof(struct irq_matrix))) == NULL) {
+			perror("malloc");
+			exit(4);
+		}
+		*dst = m;
+	}
+
+	if ((m->max != src->max) || (m->cpu_nr != src->cpu_nr)) {
+		for (i = 0; i < 2; i++) {
+			size = STATS_IRQCPU_SIZE * src->cpu_nr * src->max;
+			SREALLOC(m->cell[i], struct stats_irqcpu, size);
+		}
+		size = IRQ_DESC_LEN * src->max;
+		SREALLOC(m->desc, char, size);
+		size = src->max;
+		SREALLOC(m->status, char, size);
+		m->max = src->max;
+		m->cpu_nr = src->cpu_nr;
+	}
+
+	m->file = src->file;
+	m->gen = src->gen;
+	for (i = 0; i < 2; i++) {
+		memcpy(m->cell[i], src->cell[i], STATS_IRQCPU_SIZE * src->cpu_nr * src->max);
+	}
+	memcpy(m->desc, src->desc, IRQ_DESC_LEN * src->max);
+	memcpy(m->status, src->status, src->max);
+}
+
+/*
+ * Free a copy made by irq_copy().
+ */
+void irq_free_copy(struct irq_matrix *m)
+{
+	int i;
+
+	if (m == NULL)
+		return;
+
+	for (i = 0; i < 2; i++) {
+		free(m->cell[i]);
+	}
+	free(m->desc);
+	free(m->status);
+	free(m);
+}
+
+/*
+ * Sum the interrupts of each IRQ during the interval into irq_sum[],
+ * one row at a time.
+ * Counters are 32-bit: The difference is right even if they wrapped.
+ */
+void irq_sum_rows(struct irq_matrix *m, int curr)
+{
+	struct stats_irqcpu *ci, *cj;
+	size_t size;
+	int c, s;
+
+	if (irq_sum_nr < m->max) {
+		size = sizeof(unsigned long long) * m->max;
+		SREALLOC(irq_sum, unsigned long long, size);
+		irq_sum_nr = m->max;
+	}
+
+	memset(irq_sum, 0, sizeof(unsigned long long) * m->max);
+	for (c = 0; c < m->cpu_nr; c++) {
+		ci = m->cell[curr] + (size_t) c * m->max;
+		cj = m->cell[!curr] + (size_t) c * m->max;
+		for (s = 0; s < m->max; s++) {
+			irq_sum[s] += ci[s].interrupt - cj[s].interrupt;
+		}
+	}
+}
+
+/*
+ * Display the top_nr IRQs that fired the most during the interval, with
+ * the number of CPUs that served them and the share of the three CPUs
+ * that served them most. An IRQ served by a single CPU, or by CPUs
+ * other than the ones it should be pinned to, shows up at once.
+ * Rates are computed over the same interval as those of devices (see
+ * get_device_itv()).
+ */
+void write_irq_top(struct irq_matrix *m, int curr, int top_nr, double rdiv, double rmul)
+{
+	unsigned int d, busy[3];
+	size_t size;
+	int bcpu[3], c, j, k, n, s, cpus;
+
+	if (irq_rank_nr < top_nr) {
+		size = sizeof(int) * top_nr;
+		SREALLOC(irq_rank, int, size);
+		irq_rank_nr = top_nr;
+	}
+
+	irq_sum_rows(m, curr);
+
+	/* Keep the top_nr busiest IRQs, busiest first */
+	for (s = 0, n = 0; s < m->max; s++) {
+		if ((m->status[s] != IRQ_LISTED) || !irq_sum[s])
+			continue;
+		if ((n == top_nr) && (irq_sum[s] <= irq_sum[irq_rank[n - 1]]))
+			continue;
+		if (n < top_nr) {
+			n++;
+		}
+		for (k = n - 1; (k > 0) && (irq_sum[irq_rank[k - 1]] < irq_sum[s]); k--) {
+			irq_rank[k] = irq_rank[k - 1];
+		}
+		irq_rank[k] = s;
+	}
+
+	/* Disk and network stats end with a blank line */
+	out_printf("%s%-8s%12s%6s  %-31s  %s\n",
+		   (DISPLAY_DISK(flags) || DISPLAY_NET(flags)) ? "" : "\n\n",
+		   "IRQ:", "intr/s", "CPUs", "Busiest CPUs (share)", "Description");
+
+	for (k = 0; k < n; k++) {
+		s = irq_rank[k];
+
+		for (j = 0; j < 3; j++) {
+			busy[j] = 0;
+			bcpu[j] = -1;
+		}
+		for (c = 0, cpus = 0; c < m->cpu_nr; c++) {
+			if (!(d = IRQ_CELL(m, curr, c, s).interrupt - IRQ_CELL(m, !curr, c, s).interrupt))
+				continue;
+			cpus++;
+			if (d <= busy[2])
+				continue;
+			for (j = 2; (j > 0) && (busy[j - 1] < d); j--) {
+				busy[j] = busy[j - 1];
+				bcpu[j] = bcpu[j - 1];
+			}
+			busy[j] = d;
+			bcpu[j] = c;
+		}
+
+		out_str(IRQ_CELL(m, curr, 0, s).irq_name, 8);
+		out_fixed2(irq_sum[s] / rdiv * rmul, 12);
+		out_ull(cpus, 6);
+		for (j = 0; j < 3; j++) {
+			if (bcpu[j] < 0) {
+				out_str("", 11);
+			}
+			else {
+				out_printf("%6d:%3.0f%%", bcpu[j], 100.0 * busy[j] / irq_sum[s]);
+			}
+		}
+		out_str("  ", 0);
+		out_str(m->desc + IRQ_DESC_LEN * s, 0);
+		out_char('\n');
+	}
+	out_printf("\n");
+}
+
+/*
+ * Display the softirqs of each type (NET_RX, TIMER, etc.) served by every
+ * CPU during the interval, per second, after those of CPU "all".
+ * Columns are in the order of /proc/softirqs.
+ * Rates are computed over the same interval as those of devices (see
+ * get_device_itv()).
+ */
+void write_softirq_stat(struct irq_matrix *m, int curr, double rdiv, double rmul)
+{
+	struct stats_irqcpu *ci, *cj;
+	char name[MAX_IRQ_LEN + 2];
+	unsigned int d;
+	int c, s;
+
+	irq_sum_rows(m, curr);
+
+	/* Disk, network and interrupt stats end with a blank line */
+	out_printf("%sSoftirq:",
+		   (DISPLAY_DISK(flags) || DISPLAY_NET(flags) ||
+		    DISPLAY_IRQ_CPU(actflags)) ? "" : "\n\n");
+	for (s = 0; s < m->max; s++) {
+		if (m->status[s] == IRQ_LISTED) {
+			snprintf(name, sizeof(name), "%s/s", IRQ_CELL(m, curr, 0, s).irq_name);
+			out_field(name, strlen(name), 11);
+		}
+	}
+	out_char('\n');
+
+	out_str("all", 8);
+	for (s = 0; s < m->max; s++) {
+		if (m->status[s] == IRQ_LISTED) {
+			out_fixed2(irq_sum[s] / rdiv * rmul, 11);
+		}
+	}
+	out_char('\n');
+
+	for (c = 0; c < m->cpu_nr; c++) {
+		ci = m->cell[curr] + (size_t) c * m->max;
+		cj = m->cell[!curr] + (size_t) c * m->max;
+
+		if (DISPLAY_ZERO_OMIT(flags)) {
+			for (s = 0, d = 0; (s < m->max) && !d; s++) {
+				if (m->status[s] == IRQ_LISTED) {
+					d = ci[s].interrupt - cj[s].interrupt;
+				}
+			}
+			if (!d)
+				/* No activity: Ignore it */
+				continue;
+		}
+
+		snprintf(name, sizeof(name), "%d", c);
+		out_str(name, 8);
+		for (s = 0; s < m->max; s++) {
+			if (m->status[s] == IRQ_LISTED) {
+				out_fixed2((ci[s].interrupt - cj[s].interrupt) / rdiv * rmul, 11);
+			}
+		}
+		out_char('\n');
+	}
+	out_printf("\n");
+}
@@ -0,0 +1,86 @@
+/*
+ * irq.h: Interrupt stats per CPU
+ */
+
+#ifndef _IRQ_H
+#define _IRQ_H
+
+#include "iostat.h"
+#include "mpstat.h"
+
+/*
+ * With option --irq <N>, SimpleStat reads /proc/interrupts at each
+ * interval and displays the N interrupt sources that fired the most,
+ * with the CPUs that served them.
+ * Counters are kept in a dense matrix of stats_irqcpu, laid out as in
+ * mpstat: One row of max slots per CPU, the counter of IRQ slot s on
+ * CPU c being at [c * max + s], and the name of the IRQ of a slot being
+ * in the row of CPU 0. The matrices read at the previous and current
+ * intervals are in cell[] (indexed with curr, as st_iodev).
+ * The file is read at once and parsed in a single pass: Each line is
+ * first looked for in the slot it had at the previous interval, so that
+ * slots are only searched when IRQs are added or removed. Matrices are
+ * only enlarged (doubled) when no slot is left.
+ * With option --softirqs, /proc/softirqs is read the same way into a
+ * matrix of its own (one slot per type of softirq), and the softirqs
+ * served by every CPU are displayed per type.
+ */
+
+/* Maximum length of the description of an IRQ (e.g. "IO-APIC 9-fasteoi acpi") */
+#define IRQ_DESC_LEN	48
+
+/* Status of a slot */
+#define IRQ_UNUSED	0
+#define IRQ_LISTED	1
+/* Slot was in use but its IRQ has not been found yet in the file */
+#define IRQ_GONE	2
+
+struct irq_matrix {
+	/* File the counters are read from */
+	char *file;
+	/* Number of slots (length of a row) and of CPUs (number of rows) */
+	int max;
+	int cpu_nr;
+	struct stats_irqcpu *cell[2];
+	/* Description (IRQ_DESC_LEN characters) and status of each slot */
+	char *desc;
+	char *status;
+	/* Slot of each line of the file at the last interval (-1: none) */
+	int *line_slot;
+	/* CPU of each column of the file */
+	int *col_cpu;
+	int col_nr;
+	/* Set for the CPUs found in the header of the file */
+	char *online;
+	/* Counters of the line being parsed */
+	unsigned long long *v;
+	/* Incremented when IRQs are added or removed */
+	unsigned int gen;
+	struct proc_file pf;
+};
+
+/* Counter of IRQ slot s on CPU c */
+#define IRQ_CELL(m, i, c, s)	((m)->cell[i][(c) * (m)->max + (s)])
+
+/*
+ ***************************************************************************
+ * Functions prototypes
+ ***************************************************************************
+ */
+
+extern void
+	irq_close(struct irq_matrix *);
+extern void
+	irq_copy(struct irq_matrix **, struct irq_matrix *);
+extern void
+	irq_free_copy(struct irq_matrix *);
+extern void
+	irq_open(struct irq_matrix *, char *, int);
+extern void
+	irq_read(struct irq_matrix *, int);
+extern void
+	write_irq_top(struct irq_matrix *, int, int, double, double);
+extern void
+	write_softirq_stat(struct irq_matrix *, int, double, double);
+
+#endif  /* _IRQ_H */
@@ -0,0 +1,346 @@
+/*
+ * net.c: Network interface stats (see net.h)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "iostat.h"
+#include "common.h"
+#include "rd_stats.h"
+#include "net.h"
+
+extern int flags;
+
+/*
+ * Look for an interface in the hash index.
+ * Return its slot number, or -1 if the interface is not in use.
+ */
+int net_lookup_slot(struct net_table *nt, char *name)
+{
+	unsigned int b = hash_dev_name(name) & nt->hash_mask;
+
+	while (nt->hash[b] >= 0) {
+		if (!strcmp(nt->hdr[nt->hash[b]].name, name))
+			return nt->hash[b];
+		b = (b + 1) & nt->hash_mask;
+	}
+
+	return -1;
+}
+
+/*
+ * Add a slot in use to the hash index.
+ */
+void net_insert_slot(struct net_table *nt, int slot)
+{
+	unsigned int b = hash_dev_name(nt->hdr[slot].name) & nt->hash_mask;
+
+	while (nt->hash[b] >= 0) {
+		b = (b + 1) & nt->hash_mask;
+	}
+	nt->hash[b] = slot;
+}
+
+/*
+ * Remove a slot from the hash index (see remove_dev_slot()).
+ */
+void net_remove_slot(struct net_table *nt, int slot)
+{
+	unsigned int i, j, k;
+
+	i = hash_dev_name(nt->hdr[slot].name) & nt->hash_mask;
+	while (nt->hash[i] != slot) {
+		if (nt->hash[i] < 0)
+			/* Not indexed */
+			return;
+		i = (i + 1) & nt->hash_mask;
+	}
+
+	j = i;
+	while (1) {
+		j = (j + 1) & nt->hash_mask;
+		if (nt->hash[j] < 0)
+			break;
+		k = hash_dev_name(nt->hdr[nt->hash[j]].name) & nt->hash_mask;
+		/* Entry stays where it is if its home bucket is in ]i, j] */
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+			continue;
+		nt->hash[i] = nt->hash[j];
+		i = j;
+	}
+	nt->hash[i] = -1;
+}
+
+/*
+ * (Re)build the hash index with a size suited to the number of slots.
+ */
+void net_build_hash(struct net_table *nt)
+{
+	unsigned int size = NR_DEV_HASH_MIN;
+	int i;
+
+	/* Keep the load factor of the index below 1/2 */
+	while (size < 2 * (unsigned int) nt->nr) {
+		size <<= 1;
+	}
+
+	if (!nt->hash || (size != nt->hash_mask + 1)) {
+		free(nt->hash);
+		if ((nt->hash = (int *) malloc(sizeof(int) * size)) == NULL) {
+			perror("malloc");
+			exit(4);
+		}
+		nt->hash_mask = size - 1;
+	}
+	memset(nt->hash, 0xff, sizeof(int) * size);
+
+	for (i = 0; i < nt->nr; i++) {
+		if (nt->hdr[i].used) {
+			net_insert_slot(nt, i);
+		}
+	}
+}
+
+/*
+ * Size the interface tables for nr slots. New slots are unused.
+ * Slots keep their numbers, and the counters read at previous and
+ * current intervals stay paired.
+ */
+void net_grow(struct net_table *nt, int nr)
+{
+	size_t size;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		size = STATS_NET_DEV_SIZE * nr;
+		SREALLOC(nt->dev[i], struct stats_net_dev, size);
+		memset(nt->dev[i] + nt->nr, 0, STATS_NET_DEV_SIZE * (nr - nt->nr));
+		size = STATS_NET_EDEV_SIZE * nr;
+		SREALLOC(nt->edev[i], struct stats_net_edev, size);
+		memset(nt->edev[i] + nt->nr, 0, STATS_NET_EDEV_SIZE * (nr - nt->nr));
+	}
+	size = NET_HDR_SIZE * nr;
+	SREALLOC(nt->hdr, struct net_hdr, size);
+	memset(nt->hdr + nt->nr, 0, NET_HDR_SIZE * (nr - nt->nr));
+	size = sizeof(int) * nr;
+	SREALLOC(nt->free, int, size);
+
+	/* Push new slots in reverse order so that lowest ones are used first */
+	for (i = nr - 1; i >= nt->nr; i--) {
+		nt->free[nt->free_nr++] = i;
+	}
+
+	nt->nr = nr;
+	net_build_hash(nt);
+	nt->gen++;
+}
+
+/*
+ * Save the counters of an interface read from /proc/net/dev.
+ */
+void net_save(struct net_table *nt, char *name, int curr, unsigned long long *v)
+{
+	struct stats_net_dev *sd;
+	struct stats_net_edev *se;
+	struct net_hdr *nh;
+	int i;
+
+	if ((i = net_lookup_slot(nt, name)) < 0) {
+		if (!nt->free_nr) {
+			/* No unused slot left: Make room for new interfaces */
+			net_grow(nt, nt->nr * 2);
+		}
+		/*
+		 * New interface: Its counters at previous interval are 0,
+		 * so that its first stats are those since it was created.
+		 */
+		i = nt->free[--nt->free_nr];
+		nh = nt->hdr + i;
+		nh->used = TRUE;
+		strncpy(nh->name, name, MAX_IFACE_LEN - 1);
+		nh->name[MAX_IFACE_LEN - 1] = '\0';
+		net_insert_slot(nt, i);
+		memset(nt->dev[!curr] + i, 0, STATS_NET_DEV_SIZE);
+		memset(nt->edev[!curr] + i, 0, STATS_NET_EDEV_SIZE);
+		nt->gen++;
+	}
+	nt->hdr[i].status = DISK_REGISTERED;
+
+	sd = nt->dev[curr] + i;
+	sd->rx_packets    = v[NET_RX_PACKETS];
+	sd->tx_packets    = v[NET_TX_PACKETS];
+	sd->rx_bytes      = v[NET_RX_BYTES];
+	sd->tx_bytes      = v[NET_TX_BYTES];
+	sd->rx_compressed = v[NET_RX_COMPRESSED];
+	sd->tx_compressed = v[NET_TX_COMPRESSED];
+	sd->multicast     = v[NET_RX_MULTICAST];
+
+	se = nt->edev[curr] + i;
+	se->collisions        = v[NET_TX_COLLS];
+	se->rx_errors         = v[NET_RX_ERRS];
+	se->tx_errors         = v[NET_TX_ERRS];
+	se->rx_dropped        = v[NET_RX_DROP];
+	se->tx_dropped        = v[NET_TX_DROP];
+	se->rx_fifo_errors    = v[NET_RX_FIFO];
+	se->tx_fifo_errors    = v[NET_TX_FIFO];
+	se->rx_frame_errors   = v[NET_RX_FRAME];
+	se->tx_carrier_errors = v[NET_TX_CARRIER];
+}
+
+/*
+ * Read the counters of every interface into snapshot curr.
+ * Interfaces that are no longer listed give their slot back.
+ */
+void net_read(struct net_table *nt, int curr)
+{
+	unsigned long long v[NR_NET_FIELDS];
+	char *line, *pos, *p, *name;
+	int i;
+
+	/* Every interface is potentially gone */
+	for (i = 0; i < nt->nr; i++) {
+		if (nt->hdr[i].used) {
+			nt->hdr[i].status = DISK_UNREGISTERED;
+		}
+	}
+
+	if (read_proc_file(&nt->pf) < 0) {
+		fprintf(stderr, "Cannot read %s: %s\n", NET_DEV, strerror(errno));
+		exit(2);
+	}
+
+	pos = nt->pf.buf;
+	while ((line = next_proc_line(&nt->pf, &pos)) != NULL) {
+
+		/* "<name>: <16 counters>", after two lines of headers */
+		if ((p = strchr(line, ':')) == NULL)
+			continue;
+		*p++ = '\0';
+		for (name = line; *name == ' '; name++);
+
+		if (parse_dec_fields(&p, v, NR_NET_FIELDS) < NR_NET_FIELDS)
+			continue;
+		net_save(nt, name, curr, v);
+	}
+
+	for (i = 0; i < nt->nr; i++) {
+		if (nt->hdr[i].used && (nt->hdr[i].status == DISK_UNREGISTERED)) {
+			/* Interface has been removed */
+			net_remove_slot(nt, i);
+			nt->hdr[i].used = FALSE;
+			nt->free[nt->free_nr++] = i;
+			nt->gen++;
+		}
+	}
+}
+
+/*
+ * Open /proc/net/dev, and size the interface tables for the interfaces
+ * it lists plus a few more.
+ */
+void net_open(struct net_table *nt)
+{
+	char *line, *pos;
+	int nr = 0;
+
+	memset(nt, 0, sizeof(struct net_table));
+
+	/* File is generated one page at a time */
+	nt->pf.until_eof = TRUE;
+	if (!open_proc_file(&nt->pf, NET_DEV) || (read_proc_file(&nt->pf) < 0)) {
+		fprintf(stderr, "Cannot open %s: %s\n", NET_DEV, strerror(errno));
+		exit(2);
+	}
+	pos = nt->pf.buf;
+	while ((line = next_proc_line(&nt->pf, &pos)) != NULL) {
+		if (strchr(line, ':')) {
+			nr++;
+		}
+	}
+
+	net_grow(nt, nr + NR_DEV_PREALLOC);
+}
+
+/*
+ * Close /proc/net/dev and free the interface tables.
+ */
+void net_close(struct net_table *nt)
+{
+	int i;
+
+	close_proc_file(&nt->pf);
+	for (i = 0; i < 2; i++) {
+		free(nt->dev[i]);
+		free(nt->edev[i]);
+	}
+	free(nt->hdr);
+	free(nt->hash);
+	free(nt->free);
+	memset(nt, 0, sizeof(struct net_table));
+}
+
+/*
+ * Difference between two values of a counter. Counters start again
+ * from 0 when an interface is removed and created again with the
+ * same name between two intervals.
+ */
+unsigned long long net_delta(unsigned long long prev, unsigned long long curr)
+{
+	return (curr >= prev) ? curr - prev : curr;
+}
+
+/*
+ * Display the stats of every network interface.
+ * Rates are computed over the same interval as those of devices (see
+ * get_device_itv()).
+ */
+void write_net_stat(struct stats_sample *smp, double rdiv, double rmul)
+{
+	struct stats_net_dev *ndi, *ndj;
+	struct stats_net_edev *nei, *nej;
+	struct net_hdr *nh;
+	int curr = smp->curr, i;
+
+	/* Disk stats end with a blank line */
+	out_printf("%sInterface:          rxkB/s    txkB/s   rxpck/s   txpck/s"
+		   "   rxerr/s   txerr/s  rxdrop/s  txdrop/s\n",
+		   DISPLAY_DISK(flags) ? "" : "\n\n");
+
+	for (i = 0, nh = smp->net_hdr; i < smp->net_nr; i++, nh++) {
+		if (!nh->used)
+			continue;
+
+		ndi = smp->netdev[curr] + i;
+		ndj = smp->netdev[!curr] + i;
+		nei = smp->netedev[curr] + i;
+		nej = smp->netedev[!curr] + i;
+
+		if (!DISPLAY_UNFILTERED(flags)) {
+			if (!ndi->rx_packets && !ndi->tx_packets)
+				/* Interface has never been used */
+				continue;
+		}
+
+		if (DISPLAY_ZERO_OMIT(flags)) {
+			if ((ndi->rx_packets == ndj->rx_packets) &&
+			    (ndi->tx_packets == ndj->tx_packets))
+				/* No activity: Ignore it */
+				continue;
+		}
+
+		out_str(nh->name, 16);
+		out_fixed2(net_delta(ndj->rx_bytes, ndi->rx_bytes) / rdiv * rmul / 1024, 10);
+		out_fixed2(net_delta(ndj->tx_bytes, ndi->tx_bytes) / rdiv * rmul / 1024, 10);
+		out_fixed2(net_delta(ndj->rx_packets, ndi->rx_packets) / rdiv * rmul, 10);
+		out_fixed2(net_delta(ndj->tx_packets, ndi->tx_packets) / rdiv * rmul, 10);
+		out_fixed2(net_delta(nej->rx_errors, nei->rx_errors) / rdiv * rmul, 10);
+		out_fixed2(net_delta(nej->tx_errors, nei->tx_errors) / rdiv * rmul, 10);
+		out_fixed2(net_delta(nej->rx_dropped, nei->rx_dropped) / rdiv * rmul, 10);
+		out_fixed2(net_delta(nej->tx_dropped, nei->tx_dropped) / rdiv * rmul, 10);
+		out_char('\n');
+	}
+	out_printf("\n");
+}
@@ -0,0 +1,75 @@
+/*
+ * net.h: Network interface stats
+ */
+
+#ifndef _NET_H
+#define _NET_H
+
+#include "iostat.h"
+#include "rd_stats.h"
+
+/*
+ * With option --net, SimpleStat reads /proc/net/dev at each interval and
+ * displays the throughput, packets, errors and drops of every network
+ * interface.
+ * Interfaces are kept in tables of slots, as devices are: The counters
+ * read at the previous and current intervals are in dev[] and edev[]
+ * (indexed with curr, as st_iodev), and a hash index maps the name of an
+ * interface to its slot. An interface that appears takes an unused
+ * slot, one that disappears gives its slot back. Tables are only
+ * enlarged (doubled) when no slot is left: Once the number of interfaces
+ * has been reached, reading them allocates nothing.
+ */
+
+/* Fields of a line of /proc/net/dev, after the name of the interface */
+#define NET_RX_BYTES		0
+#define NET_RX_PACKETS		1
+#define NET_RX_ERRS		2
+#define NET_RX_DROP		3
+#define NET_RX_FIFO		4
+#define NET_RX_FRAME		5
+#define NET_RX_COMPRESSED	6
+#define NET_RX_MULTICAST	7
+#define NET_TX_BYTES		8
+#define NET_TX_PACKETS		9
+#define NET_TX_ERRS		10
+#define NET_TX_DROP		11
+#define NET_TX_FIFO		12
+#define NET_TX_COLLS		13
+#define NET_TX_CARRIER		14
+#define NET_TX_COMPRESSED	15
+#define NR_NET_FIELDS		16
+
+struct net_table {
+	/* Number of slots */
+	int nr;
+	struct net_hdr *hdr;
+	struct stats_net_dev *dev[2];
+	struct stats_net_edev *edev[2];
+	/* Hash index from interface name to slot in use (-1: empty bucket) */
+	int *hash;
+	unsigned int hash_mask;
+	/* Stack of unused slots */
+	int *free;
+	int free_nr;
+	/* Incremented when interfaces are added or removed */
+	unsigned int gen;
+	struct proc_file pf;
+};
+
+/*
+ ***************************************************************************
+ * Functions prototypes
+ ***************************************************************************
+ */
+
+extern void
+	net_close(struct net_table *);
+extern void
+	net_open(struct net_table *);
+extern void
+	net_read(struct net_table *, int);
+extern void
+	write_net_stat(struct stats_sample *, double, double);
+
+#endif  /* _NET_H */
@@ -0,0 +1,230 @@
+/*
+ * parsebench.c: Compare the parsing of /proc/diskstats lines by
+ * SimpleStat (parse_dec_fields() and set_io_stats()) with the sscanf()
+ * conversion it replaced, for speed and values.
+ *
+ * Usage: parsebench [ <passes> ]
+ *
+ * 10k lines are generated with the layouts found in /proc/diskstats:
+ * 14 fields (up to Linux 4.18), 18 fields (discard stats, Linux 4.18+),
+ * 20 fields (flush stats, Linux 5.5+), and 7 fields (partitions of
+ * Linux 2.4/2.6 kernels). Both conversions must give the same values.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iostat.h"
+
+#define NR_LINES	10000
+#define LINE_LEN	256
+#define DEFAULT_PASSES	20
+
+extern int
+	parse_name_field(char **, char *, int);
+extern int
+	set_io_stats(struct io_stats *, unsigned long long *, int);
+
+struct bench_dev {
+	unsigned int major;
+	unsigned int minor;
+	char name[MAX_NAME_LEN];
+	int found;
+	struct io_stats sdev;
+};
+
+unsigned long long seed = 0x5353524653535246ULL;
+
+/*
+ * Pseudo-random number generator (xorshift64), so that every run uses
+ * the same values.
+ */
+unsigned long long next_rand(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+/*
+ * Get a counter as found in /proc/diskstats: Times and the number of
+ * I/Os in progress are 32-bit values, other counters are unsigned long.
+ */
+unsigned long long rand_counter(int is_32bit)
+{
+	unsigned long long r = next_rand();
+
+	if (is_32bit)
+		return (r >> 8) & 0xffffffffULL;
+
+	/* From 0 to 2^56, most of them small */
+	return (r >> 8) >> (r % 56);
+}
+
+/*
+ * Generate a line of /proc/diskstats with nr counters into line.
+ */
+void gen_line(char *line, int i, int nr)
+{
+	/* Counters stored as unsigned int by SimpleStat */
+	static const int is_32bit[NR_DISK_FIELDS] = {0, 0, 0, 1, 0, 0, 0, 1, 1, 1, 1};
+	int len, k;
+
+	len = snprintf(line, LINE_LEN, "%4d %7d %s%d ",
+		       (int) (next_rand() % 260), i % 1024,
+		       (nr == NR_PART_FIELDS) ? "hda" : "sd", i);
+	for (k = 0; k < nr; k++) {
+		len += snprintf(line + len, LINE_LEN - len, " %llu",
+				rand_counter((k < NR_DISK_FIELDS) && is_32bit[k]));
+	}
+	snprintf(line + len, LINE_LEN - len, "\n");
+}
+
+/*
+ * Parse lines with sscanf(), as SimpleStat 0.9.0 did.
+ */
+void parse_sscanf(char lines[][LINE_LEN], struct bench_dev *dev)
+{
+	struct io_stats *sdev;
+	int i, n;
+	unsigned int ios_pgr, tot_ticks, rq_ticks, wr_ticks;
+	unsigned long rd_ios, rd_merges_or_rd_sec, rd_ticks_or_wr_sec, wr_ios;
+	unsigned long wr_merges, rd_sec_or_wr_ios, wr_sec;
+
+	for (i = 0; i < NR_LINES; i++) {
+		sdev = &dev[i].sdev;
+
+		n = sscanf(lines[i], "%u %u %s %lu %lu %lu %lu %lu %lu %lu %u %u %u %u",
+			   &dev[i].major, &dev[i].minor, dev[i].name,
+			   &rd_ios, &rd_merges_or_rd_sec, &rd_sec_or_wr_ios, &rd_ticks_or_wr_sec,
+			   &wr_ios, &wr_merges, &wr_sec, &wr_ticks, &ios_pgr, &tot_ticks, &rq_ticks);
+
+		if (n == 14) {
+			sdev->rd_ios     = rd_ios;
+			sdev->rd_merges  = rd_merges_or_rd_sec;
+			sdev->rd_sectors = rd_sec_or_wr_ios;
+			sdev->rd_ticks   = (unsigned int) rd_ticks_or_wr_sec;
+			sdev->wr_ios     = wr_ios;
+			sdev->wr_merges  = wr_merges;
+			sdev->wr_sectors = wr_sec;
+			sdev->wr_ticks   = wr_ticks;
+			sdev->ios_pgr    = ios_pgr;
+			sdev->tot_ticks  = tot_ticks;
+			sdev->rq_ticks   = rq_ticks;
+			dev[i].found = 1;
+		}
+		else if (n == 7) {
+			sdev->rd_ios     = rd_ios;
+			sdev->rd_sectors = rd_merges_or_rd_sec;
+			sdev->wr_ios     = rd_sec_or_wr_ios;
+			sdev->wr_sectors = rd_ticks_or_wr_sec;
+			dev[i].found = 1;
+		}
+	}
+}
+
+/*
+ * Parse lines as read_diskstats_line() does.
+ */
+void parse_fields(char lines[][LINE_LEN], struct bench_dev *dev)
+{
+	unsigned long long v[NR_DISK_FIELDS_PARSED];
+	char *line;
+	int i, nr;
+
+	for (i = 0; i < NR_LINES; i++) {
+		line = lines[i];
+
+		if (parse_dec_fields(&line, v, 2) != 2)
+			continue;
+		dev[i].major = (unsigned int) v[0];
+		dev[i].minor = (unsigned int) v[1];
+		if (!parse_name_field(&line, dev[i].name, MAX_NAME_LEN))
+			continue;
+		nr = parse_dec_fields(&line, v, NR_DISK_FIELDS_PARSED);
+		dev[i].found = set_io_stats(&dev[i].sdev, v, nr);
+	}
+}
+
+/*
+ * Get monotonic time in ns.
+ */
+unsigned long long get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	static const int layout[] = {NR_DISK_FIELDS, NR_DISK_FIELDS_DISCARD,
+				     NR_DISK_FIELDS_FLUSH, NR_PART_FIELDS};
+	char (*lines)[LINE_LEN];
+	struct bench_dev *dev_s, *dev_p;
+	unsigned long long t0, t_sscanf = 0, t_parse = 0;
+	int passes = DEFAULT_PASSES, nr_layout[4] = {0, 0, 0, 0};
+	int i, k, bad = 0;
+	size_t size = sizeof(struct bench_dev) * NR_LINES;
+
+	if ((argc > 2) || ((argc == 2) && ((passes = atoi(argv[1])) < 1))) {
+		fprintf(stderr, "Usage: %s [ <passes> ]\n", argv[0]);
+		exit(1);
+	}
+
+	if (((lines = malloc(LINE_LEN * NR_LINES)) == NULL) ||
+	    ((dev_s = (struct bench_dev *) malloc(size)) == NULL) ||
+	    ((dev_p = (struct bench_dev *) malloc(size)) == NULL)) {
+		perror("malloc");
+		exit(4);
+	}
+	for (i = 0; i < NR_LINES; i++) {
+		/* Mostly devices, a few old partition lines */
+		k = next_rand() % 10;
+		k = (k < 9) ? k / 3 : 3;
+		nr_layout[k]++;
+		gen_line(lines[i], i, layout[k]);
+	}
+
+	for (i = 0; i < passes; i++) {
+		memset(dev_s, 0, size);
+		t0 = get_time_ns();
+		parse_sscanf(lines, dev_s);
+		t_sscanf += get_time_ns() - t0;
+
+		memset(dev_p, 0, size);
+		t0 = get_time_ns();
+		parse_fields(lines, dev_p);
+		t_parse += get_time_ns() - t0;
+	}
+
+	printf("%d lines (%d with 14 fields, %d with 18, %d with 20, %d with 7) x %d passes\n",
+	       NR_LINES, nr_layout[0], nr_layout[1], nr_layout[2], nr_layout[3], passes);
+	printf("sscanf() %.2f ms, parse_dec_fields() %.2f ms per %d lines\n",
+	       t_sscanf / 1e6 / passes, t_parse / 1e6 / passes, NR_LINES);
+
+	for (i = 0; i < NR_LINES; i++) {
+		if (!dev_s[i].found || !dev_p[i].found ||
+		    (dev_s[i].major != dev_p[i].major) || (dev_s[i].minor != dev_p[i].minor) ||
+		    strcmp(dev_s[i].name, dev_p[i].name) ||
+		    memcmp(&dev_s[i].sdev, &dev_p[i].sdev, IO_STATS_SIZE)) {
+			if (!bad) {
+				printf("First mismatch at line %d: %s", i, lines[i]);
+			}
+			bad++;
+		}
+	}
+	if (bad) {
+		printf("%d lines differ\n", bad);
+		exit(3);
+	}
+	printf("Values identical\n");
+
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * procbench.c: Count the system calls made to read /proc/stat and
+ * /proc/diskstats at each sample, with fopen()/fgets() as SimpleStat 0.9.0
+ * did, and with the descriptors kept open and read with pread()
+ * (read_stat_cpu_buf() and read_proc_file()).
+ *
+ * Usage: procbench [ <samples> ]
+ *
+ * Each way of reading is run in a child process traced with ptrace()
+ * (as strace -c -f would), which stops itself with SIGSTOP before and
+ * after the samples. Only the system calls made between both stops are
+ * counted. A run with no sample gives the calls made by the stops
+ * themselves, which are deducted. The same samples are then timed
+ * without tracing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include "iostat.h"
+
+#define DEFAULT_SAMPLES	1000
+
+extern struct proc_file pf_stat;
+extern void
+	read_stat_cpu_buf(struct stats_cpu *, int, unsigned long long *, unsigned long long *);
+
+struct proc_file pf_disk = {-1, NULL, 0, 0, TRUE};
+
+/* Checksum of the data read, so that reading cannot be optimized out */
+unsigned long long sum = 0;
+
+/*
+ * Read /proc/stat and /proc/diskstats with stdio, as SimpleStat 0.9.0
+ * did (the files are opened again at each sample).
+ */
+void sample_stdio(void)
+{
+	FILE *fp;
+	char line[8192];
+
+	if ((fp = fopen(STAT, "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			sum += line[0];
+		}
+		fclose(fp);
+	}
+	if ((fp = fopen(DISKSTATS, "r")) != NULL) {
+		while (fgets(line, 256, fp) != NULL) {
+			sum += line[0];
+		}
+		fclose(fp);
+	}
+}
+
+/*
+ * Read /proc/stat and /proc/diskstats with the descriptors opened once,
+ * as SimpleStat does now.
+ */
+void sample_pread(void)
+{
+	struct stats_cpu st_cpu;
+	unsigned long long uptime = 0;
+	char *line, *pos;
+
+	read_stat_cpu_buf(&st_cpu, 1, &uptime, NULL);
+	sum += uptime;
+
+	if (read_proc_file(&pf_disk) >= 0) {
+		pos = pf_disk.buf;
+		while ((line = next_proc_line(&pf_disk, &pos)) != NULL) {
+			sum += line[0];
+		}
+	}
+}
+
+/*
+ * Open the files read with pread().
+ */
+void open_files(void)
+{
+	if (!open_proc_file(&pf_stat, STAT) ||
+	    !open_proc_file(&pf_disk, DISKSTATS)) {
+		fprintf(stderr, "Cannot open %s or %s: %s\n", STAT, DISKSTATS, strerror(errno));
+		exit(2);
+	}
+}
+
+/*
+ * Count the system calls made by a child process to read nr samples
+ * with function sample().
+ * Return the number of system calls counted.
+ */
+long count_syscalls(void (*sample)(void), int nr)
+{
+	pid_t pid;
+	long count = 0;
+	int status, in_syscall = 0, i;
+
+	if ((pid = fork()) < 0) {
+		perror("fork");
+		exit(4);
+	}
+	if (!pid) {
+		/* Child */
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0) {
+			perror("ptrace");
+			_exit(2);
+		}
+		if (sample == sample_pread) {
+			open_files();
+		}
+		/* First sample allocates stdio and /proc buffers */
+		sample();
+
+		raise(SIGSTOP);
+		for (i = 0; i < nr; i++) {
+			sample();
+		}
+		raise(SIGSTOP);
+		_exit(0);
+	}
+
+	/* Wait for the child to stop before its samples */
+	if ((waitpid(pid, &status, 0) < 0) || !WIFSTOPPED(status)) {
+		fprintf(stderr, "Cannot trace process %d\n", (int) pid);
+		exit(2);
+	}
+	if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *) PTRACE_O_TRACESYSGOOD) < 0) {
+		perror("ptrace");
+		exit(2);
+	}
+
+	for (;;) {
+		if ((ptrace(PTRACE_SYSCALL, pid, NULL, NULL) < 0) ||
+		    (waitpid(pid, &status, 0) < 0) || !WIFSTOPPED(status)) {
+			fprintf(stderr, "Lost traced process %d\n", (int) pid);
+			exit(2);
+		}
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+			/* Syscall entry and exit stops alternate */
+			if (!in_syscall) {
+				count++;
+			}
+			in_syscall = !in_syscall;
+		}
+		else if (WSTOPSIG(status) == SIGSTOP)
+			/* End of the samples */
+			break;
+	}
+
+	kill(pid, SIGKILL);
+	waitpid(pid, &status, 0);
+
+	return count;
+}
+
+/*
+ * Get monotonic time in ns.
+ */
+unsigned long long get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Time nr samples read with function sample().
+ * Return the time taken, in ns.
+ */
+unsigned long long time_samples(void (*sample)(void), int nr)
+{
+	unsigned long long t0;
+	int i;
+
+	sample();
+	t0 = get_time_ns();
+	for (i = 0; i < nr; i++) {
+		sample();
+	}
+
+	return get_time_ns() - t0;
+}
+
+int main(int argc, char **argv)
+{
+	long sc_stdio, sc_pread;
+	unsigned long long t_stdio, t_pread;
+	int nr = DEFAULT_SAMPLES;
+
+	if ((argc > 2) || ((argc == 2) && ((nr = atoi(argv[1])) < 1))) {
+		fprintf(stderr, "Usage: %s [ <samples> ]\n", argv[0]);
+		exit(1);
+	}
+
+	sc_stdio = count_syscalls(sample_stdio, nr) - count_syscalls(sample_stdio, 0);
+	sc_pread = count_syscalls(sample_pread, nr) - count_syscalls(sample_pread, 0);
+
+	t_stdio = time_samples(sample_stdio, nr);
+	open_files();
+	t_pread = time_samples(sample_pread, nr);
+
+	printf("%d samples of %s and %s (%zu and %zu bytes):\n",
+	       nr, STAT, DISKSTATS, pf_stat.len, pf_disk.len);
+	printf("  fopen()/fgets(): %.2f syscalls, %.2f us per sample\n",
+	       (double) sc_stdio / nr, t_stdio / 1e3 / nr);
+	printf("  pread():         %.2f syscalls, %.2f us per sample\n",
+	       (double) sc_pread / nr, t_pread / 1e3 / nr);
+
+	close_proc_file(&pf_stat);
+	close_proc_file(&pf_disk);
+
+	return 0;
+}
@@ -0,0 +1,463 @@
+/*
+ * prom.c: Serve the latest stats in Prometheus text format (see prom.h)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "iostat.h"
+#include "common.h"
+#include "prom.h"
+
+extern int cpu_nr;
+extern __thread struct out_buf st_out;
+extern __thread struct io_ext_rates st_xrates;
+
+/* Modes of CPU utilization, in the order of compute_cpu_pct() */
+char *prom_cpu_mode[NR_CPU_PCT] = {
+	"user", "nice", "kernel", "iowait", "steal", "idle"
+};
+
+/* Extended stats of devices, in the order of st_xrates */
+struct prom_metric {
+	char *name;
+	char *help;
+	/* Factor the stat is multiplied by */
+	double mul;
+};
+
+struct prom_metric prom_dev_metric[NR_XR_COLS] = {
+	{"read_merges_per_second", "Read requests merged per second (rrqm/s).", 1},
+	{"write_merges_per_second", "Write requests merged per second (wrqm/s).", 1},
+	{"reads_per_second", "Read requests completed per second (r/s).", 1},
+	{"writes_per_second", "Write requests completed per second (w/s).", 1},
+	{"read_bytes_per_second", "Bytes read per second.", 512},
+	{"written_bytes_per_second", "Bytes written per second.", 512},
+	{"request_size_sectors", "Average size of requests in sectors (avgrq-sz).", 1},
+	{"queue_length", "Average queue length (avgqu-sz).", 1},
+	{"await_milliseconds", "Average time requests took to be served (await).", 1},
+	{"read_await_milliseconds", "Average time read requests took to be served (r_await).", 1},
+	{"write_await_milliseconds", "Average time write requests took to be served (w_await).", 1},
+	{"service_time_milliseconds", "Average service time of requests (svctm).", 1},
+	{"utilization_percent", "Time the device was busy, in percent (%util).", 1}
+};
+
+/*
+ * Return current time in milliseconds (CLOCK_MONOTONIC).
+ */
+unsigned long long prom_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Append the HELP and TYPE lines of a metric to the page being rendered.
+ */
+void prom_family(const char *name, const char *help, const char *type)
+{
+	out_str("# HELP simplestat_", 0);
+	out_str(name, 0);
+	out_char(' ');
+	out_str(help, 0);
+	out_str("\n# TYPE simplestat_", 0);
+	out_str(name, 0);
+	out_char(' ');
+	out_str(type, 0);
+	out_char('\n');
+}
+
+/*
+ * Render the stats of a sample (as they are displayed) into the page
+ * that is not being served, and serve it from now on.
+ * Extended stats of the devices must have been computed into st_xrates
+ * (see compute_sample_ext_rates()).
+ */
+void prom_render(struct prom_server *ps, struct stats_sample *smp)
+{
+	struct out_buf report = st_out;
+	unsigned long long itv;
+	double v[NR_CPU_PCT];
+	char cpu_name[16];
+	int curr = smp->curr, cpu, i, c;
+
+	/* Page is built with the functions used for the report */
+	st_out = ps->page[!ps->cur];
+	st_out.len = 0;
+
+	prom_family("sample_timestamp_seconds", "Time at which the stats were taken.", "gauge");
+	out_printf("simplestat_sample_timestamp_seconds %llu.%03llu\n",
+		   smp->realtime / NSEC_PER_SEC, smp->realtime % NSEC_PER_SEC / 1000000);
+
+	/* CPU "all", then every CPU online, as in write_cpu_stat() and write_per_cpu_stat() */
+	prom_family("cpu_percent", "CPU utilization in percent over the last interval.", "gauge");
+	for (cpu = 0; cpu <= cpu_nr; cpu++) {
+		if (!cpu) {
+			itv = get_interval(smp->uptime[!curr], smp->uptime[curr]);
+			compute_cpu_pct(smp->cpu[!curr], smp->cpu[curr], itv, v);
+			strcpy(cpu_name, "all");
+		}
+		else if (compute_per_cpu_pct(smp, cpu, v)) {
+			snprintf(cpu_name, sizeof(cpu_name), "%d", cpu - 1);
+		}
+		else
+			/* CPU is offline */
+			continue;
+
+		for (i = 0; i < NR_CPU_PCT; i++) {
+			out_str("simplestat_cpu_percent{cpu=\"", 0);
+			out_str(cpu_name, 0);
+			out_str("\",mode=\"", 0);
+			out_str(prom_cpu_mode[i], 0);
+			out_str("\"} ", 0);
+			out_fixed2(v[i], 0);
+			out_char('\n');
+		}
+	}
+
+	/* Every device in use, as in write_ext_stat() */
+	for (c = 0; c < NR_XR_COLS; c++) {
+		prom_family(prom_dev_metric[c].name, prom_dev_metric[c].help, "gauge");
+		for (i = 0; i < smp->iodev_nr; i++) {
+			if (!smp->hdr[i].used)
+				continue;
+			out_str("simplestat_", 0);
+			out_str(prom_dev_metric[c].name, 0);
+			out_str("{device=\"", 0);
+			out_str(smp->hdr[i].name, 0);
+			out_str("\"} ", 0);
+			out_fixed2((c == XR_UTIL) ? st_xrates.col[c][i] / smp->hdr[i].used
+						  : st_xrates.col[c][i] * prom_dev_metric[c].mul, 0);
+			out_char('\n');
+		}
+	}
+
+	ps->page[!ps->cur] = st_out;
+	st_out = report;
+
+	pthread_mutex_lock(&ps->lock);
+	ps->cur = !ps->cur;
+	pthread_mutex_unlock(&ps->lock);
+}
+
+/*
+ * Disconnect a client. Its buffers are kept for the next one.
+ */
+void prom_drop(struct prom_client *pc)
+{
+	close(pc->fd);
+	pc->fd = -1;
+}
+
+/*
+ * Prepare the response to a request received in full.
+ */
+void prom_respond(struct prom_server *ps, struct prom_client *pc)
+{
+	struct out_buf *page;
+	char hdr[256], *path, *status = "200 OK";
+	size_t body_len, size;
+	int n, found = FALSE;
+
+	pc->req[pc->req_len] = '\0';
+	if (strncmp(pc->req, "GET ", 4)) {
+		status = "405 Method Not Allowed";
+	}
+	else {
+		path = pc->req + 4;
+		n = strcspn(path, " ?\r\n");
+		if (((n == 1) && (path[0] == '/')) || ((n == 8) && !strncmp(path, "/metrics", 8))) {
+			found = TRUE;
+		}
+		else {
+			status = "404 Not Found";
+		}
+	}
+
+	pthread_mutex_lock(&ps->lock);
+	page = &ps->page[ps->cur];
+	body_len = found ? page->len : 0;
+	n = snprintf(hdr, sizeof(hdr),
+		     "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+		     "Connection: close\r\n\r\n",
+		     status, PROM_CONTENT_TYPE, body_len);
+
+	if ((size = n + body_len) > pc->resp.size) {
+		SREALLOC(pc->resp.buf, char, size);
+		pc->resp.size = size;
+	}
+	memcpy(pc->resp.buf, hdr, n);
+	if (body_len) {
+		memcpy(pc->resp.buf + n, page->buf, body_len);
+	}
+	pthread_mutex_unlock(&ps->lock);
+
+	pc->resp.len = size;
+	pc->sent = 0;
+}
+
+/*
+ * Read what a client has sent. Its request is answered once its
+ * headers have been received.
+ */
+void prom_read(struct prom_server *ps, struct prom_client *pc)
+{
+	ssize_t n;
+
+	n = recv(pc->fd, pc->req + pc->req_len, PROM_REQ_SIZE - 1 - pc->req_len, 0);
+	if (n <= 0) {
+		if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+			return;
+		prom_drop(pc);
+		return;
+	}
+	pc->req_len += n;
+	pc->req[pc->req_len] = '\0';
+
+	/* Requests are answered as they are: Anything too long is cut */
+	if (strstr(pc->req, "\r\n\r\n") || strstr(pc->req, "\n\n") ||
+	    (pc->req_len == PROM_REQ_SIZE - 1)) {
+		prom_respond(ps, pc);
+	}
+}
+
+/*
+ * Send the rest of the response to a client.
+ */
+void prom_write(struct prom_client *pc)
+{
+	ssize_t n;
+
+	n = send(pc->fd, pc->resp.buf + pc->sent, pc->resp.len - pc->sent, MSG_NOSIGNAL);
+	if (n < 0) {
+		if ((errno == EAGAIN) || (errno == EINTR))
+			return;
+		prom_drop(pc);
+		return;
+	}
+	if ((pc->sent += n) == pc->resp.len) {
+		prom_drop(pc);
+	}
+}
+
+/*
+ * Accept new clients on a listening socket while there is room for them.
+ */
+void prom_accept(struct prom_server *ps, int lfd, unsigned long long now)
+{
+	struct prom_client *pc;
+	int fd, i;
+
+	for (i = 0; i < PROM_MAX_CLIENTS; i++) {
+		pc = ps->client + i;
+		if (pc->fd >= 0)
+			continue;
+		if ((fd = accept(lfd, NULL, NULL)) < 0)
+			return;
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		pc->fd = fd;
+		pc->req_len = 0;
+		pc->resp.len = 0;
+		pc->sent = 0;
+		pc->active = now;
+	}
+}
+
+/*
+ * Server thread: Answer the requests of the clients, until woken up.
+ */
+void *prom_thread(void *arg)
+{
+	struct prom_server *ps = (struct prom_server *) arg;
+	struct prom_client *pc;
+	struct pollfd pfd[PROM_MAX_CLIENTS + 3];
+	int slot[PROM_MAX_CLIENTS + 3];
+	unsigned long long now;
+	int i, n, room;
+
+	for (;;) {
+		n = 0;
+		pfd[n].fd = ps->wake[0];
+		pfd[n++].events = POLLIN;
+
+		room = FALSE;
+		for (i = 0; i < PROM_MAX_CLIENTS; i++) {
+			pc = ps->client + i;
+			if (pc->fd < 0) {
+				room = TRUE;
+				continue;
+			}
+			pfd[n].fd = pc->fd;
+			/* Response is being sent once the request has been received */
+			pfd[n].events = pc->resp.len ? POLLOUT : POLLIN;
+			slot[n++] = i;
+		}
+		if (room) {
+			/* Clients left waiting are accepted once others are done */
+			if (ps->unix_fd >= 0) {
+				pfd[n].fd = ps->unix_fd;
+				pfd[n].events = POLLIN;
+				slot[n++] = -1;
+			}
+			if (ps->tcp_fd >= 0) {
+				pfd[n].fd = ps->tcp_fd;
+				pfd[n].events = POLLIN;
+				slot[n++] = -1;
+			}
+		}
+
+		if (poll(pfd, n, 1000) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			exit(4);
+		}
+		if (pfd[0].revents)
+			/* Time to stop */
+			break;
+
+		now = prom_now();
+		for (i = 1; i < n; i++) {
+			if (!pfd[i].revents)
+				continue;
+			if (slot[i] < 0) {
+				prom_accept(ps, pfd[i].fd, now);
+				continue;
+			}
+			pc = ps->client + slot[i];
+			pc->active = now;
+			if (pc->resp.len) {
+				prom_write(pc);
+			}
+			else {
+				prom_read(ps, pc);
+			}
+		}
+
+		for (i = 0; i < PROM_MAX_CLIENTS; i++) {
+			pc = ps->client + i;
+			if ((pc->fd >= 0) && (now - pc->active > PROM_TIMEOUT)) {
+				prom_drop(pc);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Create a listening socket. Exit on error.
+ */
+int prom_listen(int domain, struct sockaddr *addr, socklen_t len, char *what)
+{
+	int fd, on = 1;
+
+	if (((fd = socket(domain, SOCK_STREAM, 0)) < 0) ||
+	    ((domain == AF_INET) &&
+	     (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0)) ||
+	    (bind(fd, addr, len) < 0) ||
+	    (listen(fd, SOMAXCONN) < 0)) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", what, strerror(errno));
+		exit(2);
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	return fd;
+}
+
+/*
+ * Start serving stats on a unix socket (if path is not NULL) and on a
+ * TCP port of the loopback interface (if port is not 0).
+ */
+void prom_open(struct prom_server *ps, char *path, int port)
+{
+	struct sockaddr_un sun;
+	struct sockaddr_in sin;
+	char what[32];
+	int i, rc;
+
+	memset(ps, 0, sizeof(struct prom_server));
+	ps->unix_fd = ps->tcp_fd = -1;
+	for (i = 0; i < PROM_MAX_CLIENTS; i++) {
+		ps->client[i].fd = -1;
+	}
+
+	if (path) {
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(sun.sun_path)) {
+			fprintf(stderr, "Socket name too long: %s\n", path);
+			exit(2);
+		}
+		strcpy(sun.sun_path, path);
+		/* Remove the socket left by a previous run */
+		unlink(path);
+		ps->unix_fd = prom_listen(AF_UNIX, (struct sockaddr *) &sun, sizeof(sun), path);
+		ps->path = path;
+	}
+
+	if (port) {
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(port);
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		snprintf(what, sizeof(what), "127.0.0.1:%d", port);
+		ps->tcp_fd = prom_listen(AF_INET, (struct sockaddr *) &sin, sizeof(sin), what);
+	}
+
+	if (pipe(ps->wake) < 0) {
+		perror("pipe");
+		exit(4);
+	}
+	pthread_mutex_init(&ps->lock, NULL);
+	if ((rc = pthread_create(&ps->tid, NULL, prom_thread, ps)) != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+		exit(4);
+	}
+}
+
+/*
+ * Stop serving stats.
+ */
+void prom_close(struct prom_server *ps)
+{
+	int i;
+
+	if (write(ps->wake[1], "", 1) == 1) {
+		pthread_join(ps->tid, NULL);
+	}
+	close(ps->wake[0]);
+	close(ps->wake[1]);
+
+	for (i = 0; i < PROM_MAX_CLIENTS; i++) {
+		if (ps->client[i].fd >= 0) {
+			prom_drop(ps->client + i);
+		}
+		free(ps->client[i].resp.buf);
+	}
+	if (ps->unix_fd >= 0) {
+		close(ps->unix_fd);
+		unlink(ps->path);
+	}
+	if (ps->tcp_fd >= 0) {
+		close(ps->tcp_fd);
+	}
+	free(ps->page[0].buf);
+	free(ps->page[1].buf);
+	pthread_mutex_destroy(&ps->lock);
+}
@@ -0,0 +1,75 @@
+/*
+ * prom.h: Serve the latest stats in Prometheus text format
+ */
+
+#ifndef _PROM_H
+#define _PROM_H
+
+#include <pthread.h>
+
+#include "iostat.h"
+
+/*
+ * With option --serve <socket> (and/or --serve-tcp <port>), SimpleStat
+ * answers HTTP GET requests on a unix socket (and/or on a TCP port of
+ * the loopback interface) with the stats of the last interval, in the
+ * Prometheus text exposition format.
+ * The page is rendered once per interval by the sampling thread, before
+ * the report is displayed (see export_stats()), into the buffer that is
+ * not being served. Buffers are then swapped. Requests are answered by a thread
+ * of their own, which only copies the current page: Scraping doesn't
+ * read any /proc file, and many clients may scrape at once.
+ */
+
+/* Maximum number of clients served at once (others wait to be accepted) */
+#define PROM_MAX_CLIENTS	64
+/* Maximum size of a request */
+#define PROM_REQ_SIZE		4096
+/* Clients idle for longer than this are disconnected (ms) */
+#define PROM_TIMEOUT		5000
+
+#define PROM_CONTENT_TYPE	"text/plain; version=0.0.4; charset=utf-8"
+
+/* Client connection */
+struct prom_client {
+	/* -1: slot not in use */
+	int fd;
+	/* Request received so far */
+	char req[PROM_REQ_SIZE];
+	size_t req_len;
+	/* Response (copy of the current page), and bytes sent so far */
+	struct out_buf resp;
+	size_t sent;
+	/* Time of last activity (ms, CLOCK_MONOTONIC) */
+	unsigned long long active;
+};
+
+struct prom_server {
+	/* Listening sockets (-1: not used) */
+	int unix_fd;
+	int tcp_fd;
+	char *path;
+	/* Pages rendered: cur is being served, the other one is rendered next */
+	struct out_buf page[2];
+	int cur;
+	pthread_mutex_t lock;
+	/* Written to wake up the server thread when it must stop */
+	int wake[2];
+	pthread_t tid;
+	struct prom_client client[PROM_MAX_CLIENTS];
+};
+
+/*
+ ***************************************************************************
+ * Functions prototypes
+ ***************************************************************************
+ */
+
+extern void
+	prom_close(struct prom_server *);
+extern void
+	prom_open(struct prom_server *, char *, int);
+extern void
+	prom_render(struct prom_server *, struct stats_sample *);
+
+#endif  /* _PROM_H */
@@ -0,0 +1,313 @@
+/*
+ * push.c: Push the latest stats over UDP (see push.h)
+ */
+
+/* For sendmmsg() */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "iostat.h"
+#include "common.h"
+#include "push.h"
+
+extern int cpu_nr;
+extern __thread struct out_buf st_out;
+extern __thread struct io_ext_rates st_xrates;
+
+/* Modes of CPU utilization, in the order of compute_cpu_pct() */
+char *push_cpu_mode[NR_CPU_PCT] = {
+	"user", "nice", "kernel", "iowait", "steal", "idle"
+};
+
+/* Extended stats of devices, in the order of st_xrates */
+struct push_metric {
+	char *name;
+	/* Factor the stat is multiplied by */
+	double mul;
+};
+
+struct push_metric push_dev_metric[NR_XR_COLS] = {
+	{"rrqm_s", 1}, {"wrqm_s", 1}, {"r_s", 1}, {"w_s", 1},
+	{"read_bytes_s", 512}, {"written_bytes_s", 512},
+	{"avgrq_sz", 1}, {"avgqu_sz", 1},
+	{"await", 1}, {"r_await", 1}, {"w_await", 1}, {"svctm", 1},
+	{"util", 1}
+};
+
+/*
+ * Append a name to the lines. Characters of special are escaped with a
+ * backslash (InfluxDB) or replaced with an underscore (statsd).
+ */
+void push_name(struct push_sink *ps, const char *s, const char *special)
+{
+	if (!strpbrk(s, special)) {
+		out_str(s, 0);
+		return;
+	}
+	for (; *s; s++) {
+		if (!strchr(special, *s)) {
+			out_char(*s);
+		}
+		else if (ps->format == PUSH_INFLUX) {
+			out_char('\\');
+			out_char(*s);
+		}
+		else {
+			out_char('_');
+		}
+	}
+}
+
+/*
+ * A line has just been appended: Cut the lines before it into a datagram
+ * if it doesn't fit in the datagram being filled.
+ */
+void push_eol(struct push_sink *ps)
+{
+	if ((st_out.len - ps->start > PUSH_DGRAM_SIZE) && (ps->eol > ps->start)) {
+		if (ps->cut_nr + 1 >= ps->cut_max) {
+			/* Only happens when devices are added */
+			size_t size = sizeof(size_t) * ps->cut_max * 2;
+
+			SREALLOC(ps->cut, size_t, size);
+			ps->cut_max *= 2;
+		}
+		ps->cut[ps->cut_nr++] = ps->eol;
+		ps->start = ps->eol;
+	}
+	ps->eol = st_out.len;
+}
+
+/*
+ * Append the CPU utilization of a CPU to the lines.
+ */
+void push_cpu(struct push_sink *ps, const char *cpu_name, double *v,
+	      unsigned long long ts)
+{
+	int i;
+
+	if (ps->format == PUSH_INFLUX) {
+		out_str("simplestat_cpu,cpu=", 0);
+		out_str(cpu_name, 0);
+		for (i = 0; i < NR_CPU_PCT; i++) {
+			out_char(i ? ',' : ' ');
+			out_str(push_cpu_mode[i], 0);
+			out_char('=');
+			out_fixed2(v[i], 0);
+		}
+		out_char(' ');
+		out_ull(ts, 0);
+		out_char('\n');
+		push_eol(ps);
+		return;
+	}
+
+	for (i = 0; i < NR_CPU_PCT; i++) {
+		out_str("simplestat.cpu.", 0);
+		out_str(cpu_name, 0);
+		out_char('.');
+		out_str(push_cpu_mode[i], 0);
+		out_char(':');
+		out_fixed2(v[i], 0);
+		out_str("|g\n", 0);
+		push_eol(ps);
+	}
+}
+
+/*
+ * Append the extended stats of device number i to the lines.
+ */
+void push_dev(struct push_sink *ps, struct stats_sample *smp, int i)
+{
+	double v;
+	int c;
+
+	if (ps->format == PUSH_INFLUX) {
+		out_str("simplestat_disk,device=", 0);
+		push_name(ps, smp->hdr[i].name, ", =");
+	}
+	for (c = 0; c < NR_XR_COLS; c++) {
+		/* As in write_ext_stat() */
+		v = (c == XR_UTIL) ? st_xrates.col[c][i] / smp->hdr[i].used
+				   : st_xrates.col[c][i] * push_dev_metric[c].mul;
+		if (ps->format == PUSH_INFLUX) {
+			out_char(c ? ',' : ' ');
+		}
+		else {
+			out_str("simplestat.disk.", 0);
+			push_name(ps, smp->hdr[i].name, ".:|@ ");
+			out_char('.');
+		}
+		out_str(push_dev_metric[c].name, 0);
+		if (ps->format == PUSH_INFLUX) {
+			out_char('=');
+			out_fixed2(v, 0);
+		}
+		else {
+			out_char(':');
+			out_fixed2(v, 0);
+			out_str("|g\n", 0);
+			push_eol(ps);
+		}
+	}
+	if (ps->format == PUSH_INFLUX) {
+		out_char(' ');
+		out_ull(smp->realtime, 0);
+		out_char('\n');
+		push_eol(ps);
+	}
+}
+
+/*
+ * Send the stats of a sample (as they are displayed) to the collector.
+ * Extended stats of the devices must have been computed into st_xrates
+ * (see compute_sample_ext_rates()).
+ */
+void push_send(struct push_sink *ps, struct stats_sample *smp)
+{
+	struct out_buf report = st_out;
+	unsigned long long itv;
+	double v[NR_CPU_PCT];
+	char cpu_name[16];
+	size_t from;
+	int curr = smp->curr, cpu, i, n;
+
+	/* Lines are formatted with the functions used for the report */
+	st_out = ps->lines;
+	st_out.len = 0;
+	ps->start = ps->eol = 0;
+	ps->cut_nr = 0;
+
+	/* CPU "all", then every CPU online, as in write_cpu_stat() and write_per_cpu_stat() */
+	for (cpu = 0; cpu <= cpu_nr; cpu++) {
+		if (!cpu) {
+			itv = get_interval(smp->uptime[!curr], smp->uptime[curr]);
+			compute_cpu_pct(smp->cpu[!curr], smp->cpu[curr], itv, v);
+			strcpy(cpu_name, "all");
+		}
+		else if (compute_per_cpu_pct(smp, cpu, v)) {
+			snprintf(cpu_name, sizeof(cpu_name), "%d", cpu - 1);
+		}
+		else
+			/* CPU is offline */
+			continue;
+
+		push_cpu(ps, cpu_name, v, smp->realtime);
+	}
+
+	/* Every device in use, as in write_ext_stat() */
+	for (i = 0; i < smp->iodev_nr; i++) {
+		if (smp->hdr[i].used) {
+			push_dev(ps, smp, i);
+		}
+	}
+
+	ps->lines = st_out;
+	st_out = report;
+	if (!ps->lines.len)
+		return;
+	ps->cut[ps->cut_nr++] = ps->lines.len;
+
+	if (ps->cut_nr > ps->dgram_max) {
+		size_t size = sizeof(struct mmsghdr) * ps->cut_nr;
+
+		SREALLOC(ps->msg, struct mmsghdr, size);
+		size = sizeof(struct iovec) * ps->cut_nr;
+		SREALLOC(ps->iov, struct iovec, size);
+		ps->dgram_max = ps->cut_nr;
+	}
+	/* Datagrams point into the lines: Nothing is copied */
+	for (i = 0, from = 0; i < ps->cut_nr; from = ps->cut[i++]) {
+		ps->iov[i].iov_base = ps->lines.buf + from;
+		ps->iov[i].iov_len = ps->cut[i] - from;
+		memset(&ps->msg[i], 0, sizeof(struct mmsghdr));
+		ps->msg[i].msg_hdr.msg_iov = ps->iov + i;
+		ps->msg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (i = 0; i < ps->cut_nr; i += n) {
+		if ((n = sendmmsg(ps->fd, ps->msg + i, ps->cut_nr - i, MSG_DONTWAIT)) <= 0) {
+			if ((n < 0) && (errno == EINTR)) {
+				n = 0;
+				continue;
+			}
+			/* Collector is not there, or socket buffer is full */
+			ps->dropped += ps->cut_nr - i;
+			return;
+		}
+		ps->sent += n;
+	}
+}
+
+/*
+ * Open the socket stats are sent through, to <address>:<port>.
+ */
+void push_open(struct push_sink *ps, char *dest, int format)
+{
+	struct sockaddr_in sin;
+	char addr[INET_ADDRSTRLEN], *p;
+	size_t size;
+	int port;
+
+	memset(ps, 0, sizeof(struct push_sink));
+	ps->format = format;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	if (!(p = strrchr(dest, ':')) || ((size_t) (p - dest) >= sizeof(addr)) ||
+	    !p[1] || (strspn(p + 1, DIGITS) != strlen(p + 1)) ||
+	    ((port = atoi(p + 1)) < 1) || (port > 65535)) {
+		fprintf(stderr, "Invalid address: %s\n", dest);
+		exit(2);
+	}
+	memcpy(addr, dest, p - dest);
+	addr[p - dest] = '\0';
+	sin.sin_port = htons(port);
+	if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1) {
+		fprintf(stderr, "Invalid address: %s\n", dest);
+		exit(2);
+	}
+
+	/* Connected, so that datagrams need no address */
+	if (((ps->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) ||
+	    (connect(ps->fd, (struct sockaddr *) &sin, sizeof(sin)) < 0)) {
+		fprintf(stderr, "Cannot send to %s: %s\n", dest, strerror(errno));
+		exit(2);
+	}
+
+	/* Allocate room for the lines and datagrams of a typical interval */
+	SREALLOC(ps->lines.buf, char, OUT_BUF_SIZE);
+	ps->lines.size = OUT_BUF_SIZE;
+	ps->cut_max = ps->dgram_max = OUT_BUF_SIZE / PUSH_DGRAM_SIZE * 2;
+	size = sizeof(size_t) * ps->cut_max;
+	SREALLOC(ps->cut, size_t, size);
+	size = sizeof(struct mmsghdr) * ps->dgram_max;
+	SREALLOC(ps->msg, struct mmsghdr, size);
+	size = sizeof(struct iovec) * ps->dgram_max;
+	SREALLOC(ps->iov, struct iovec, size);
+}
+
+/*
+ * Close the socket.
+ */
+void push_close(struct push_sink *ps)
+{
+	if (ps->fd >= 0) {
+		close(ps->fd);
+	}
+	free(ps->lines.buf);
+	free(ps->cut);
+	free(ps->msg);
+	free(ps->iov);
+	memset(ps, 0, sizeof(struct push_sink));
+	ps->fd = -1;
+}
@@ -0,0 +1,68 @@
+/*
+ * push.h: Push the latest stats over UDP in InfluxDB line protocol or statsd
+ */
+
+#ifndef _PUSH_H
+#define _PUSH_H
+
+#include "iostat.h"
+
+/*
+ * With option --push <address>:<port>, SimpleStat sends the stats it has
+ * just computed (the CPU utilization of CPU "all" and of every CPU, and
+ * the extended stats of every device) to a collector listening on UDP
+ * after each interval, in InfluxDB line protocol (default) or as statsd
+ * gauges (--push-format statsd).
+ * The lines of an interval are formatted into a single buffer, which is
+ * allocated once. They are cut at line boundaries into datagrams of up to
+ * PUSH_DGRAM_SIZE bytes, which are then sent in place with one system
+ * call. Datagrams that cannot be sent right away are dropped: The
+ * sampling loop never waits for the collector.
+ */
+
+/* Formats of the lines */
+#define PUSH_INFLUX	0
+#define PUSH_STATSD	1
+
+/*
+ * Maximum size of a datagram. Small enough for the default receive
+ * buffers of statsd and Telegraf, and for the MTU of the loopback
+ * interface.
+ */
+#define PUSH_DGRAM_SIZE	8192
+
+struct push_sink {
+	int fd;
+	int format;
+	/* Lines of the interval */
+	struct out_buf lines;
+	/* Start of the datagram being filled, and end of its last line */
+	size_t start;
+	size_t eol;
+	/* Offsets at which lines are cut into datagrams (room for cut_max) */
+	size_t *cut;
+	int cut_nr;
+	int cut_max;
+	/* Datagrams to be sent (room for dgram_max) */
+	struct mmsghdr *msg;
+	struct iovec *iov;
+	int dgram_max;
+	/* Datagrams sent and dropped so far */
+	unsigned long long sent;
+	unsigned long long dropped;
+};
+
+/*
+ ***************************************************************************
+ * Functions prototypes
+ ***************************************************************************
+ */
+
+extern void
+	push_close(struct push_sink *);
+extern void
+	push_open(struct push_sink *, char *, int);
+extern void
+	push_send(struct push_sink *, struct stats_sample *);
+
+#endif  /* _PUSH_H */
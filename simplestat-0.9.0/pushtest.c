@@ -0,0 +1,314 @@
+/*
+ * pushtest.c: Check the datagrams sent by push_send() (option --push),
+ * in InfluxDB line protocol and as statsd gauges.
+ *
+ * Usage: pushtest [ <devices> ]
+ *
+ * A UDP socket is bound to 127.0.0.1 and a push_sink is connected to it.
+ * A sample with enough devices to need several datagrams is pushed in
+ * each format, and the datagrams received must be:
+ * - no larger than PUSH_DGRAM_SIZE bytes,
+ * - cut at the end of a line,
+ * - made of all the lines of the sample (every CPU once, every device
+ *   once per line of its format), in order.
+ * The socket is then closed: The datagrams of the next pushes must all
+ * be counted, either as sent or as dropped, and some must be dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "iostat.h"
+#include "common.h"
+#include "push.h"
+
+#define DEFAULT_DEVICES	100
+#define NR_TEST_CPUS	4
+#define RCV_BUF_SIZE	(4 * 1024 * 1024)
+#define NR_PUSH_NO_LISTENER	4
+
+extern int cpu_nr;
+extern __thread struct io_ext_rates st_xrates;
+
+unsigned long long seed = 0x5353524653535246ULL;
+
+/*
+ * Pseudo-random number generator (xorshift64), so that every run uses
+ * the same values.
+ */
+unsigned long long next_rand(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+/*
+ * Fill a sample with NR_TEST_CPUS CPUs and dev_nr devices, and the extended
+ * stats of its devices.
+ */
+void fill_sample(struct stats_sample *smp, int dev_nr)
+{
+	int cpu, i, c, k;
+
+	memset(smp, 0, sizeof(struct stats_sample));
+	smp->curr = 1;
+	smp->iodev_nr = dev_nr;
+	smp->realtime = 1760000000000000000ULL;
+
+	cpu_nr = NR_TEST_CPUS;
+	for (k = 0; k < 2; k++) {
+		if ((smp->cpu[k] = (struct stats_cpu *) calloc(NR_TEST_CPUS + 1, STATS_CPU_SIZE)) == NULL) {
+			perror("calloc");
+			exit(4);
+		}
+	}
+	for (cpu = 1; cpu <= NR_TEST_CPUS; cpu++) {
+		smp->cpu[0][cpu].cpu_user = next_rand() % 100000;
+		smp->cpu[0][cpu].cpu_sys = next_rand() % 100000;
+		smp->cpu[0][cpu].cpu_idle = next_rand() % 100000;
+		smp->cpu[1][cpu] = smp->cpu[0][cpu];
+		smp->cpu[1][cpu].cpu_user += next_rand() % 50;
+		smp->cpu[1][cpu].cpu_sys += next_rand() % 20;
+		smp->cpu[1][cpu].cpu_idle += 100;
+		for (k = 0; k < 2; k++) {
+			smp->cpu[k][0].cpu_user += smp->cpu[k][cpu].cpu_user;
+			smp->cpu[k][0].cpu_sys += smp->cpu[k][cpu].cpu_sys;
+			smp->cpu[k][0].cpu_idle += smp->cpu[k][cpu].cpu_idle;
+		}
+	}
+	for (k = 0; k < 2; k++) {
+		smp->uptime[k] = smp->cpu[k][0].cpu_user + smp->cpu[k][0].cpu_sys +
+				 smp->cpu[k][0].cpu_idle;
+	}
+
+	if ((smp->hdr = (struct io_hdr_stats *) calloc(dev_nr, IO_HDR_STATS_SIZE)) == NULL) {
+		perror("calloc");
+		exit(4);
+	}
+	for (i = 0; i < dev_nr; i++) {
+		snprintf(smp->hdr[i].name, MAX_NAME_LEN, "vol%04d", i);
+		smp->hdr[i].used = 1;
+	}
+	for (c = 0; c < NR_XR_COLS; c++) {
+		if ((st_xrates.col[c] = (double *) malloc(sizeof(double) * dev_nr)) == NULL) {
+			perror("malloc");
+			exit(4);
+		}
+		for (i = 0; i < dev_nr; i++) {
+			st_xrates.col[c][i] = (double) (next_rand() >> (20 + next_rand() % 40)) / 100.0;
+		}
+	}
+}
+
+/*
+ * Check the lines received for a sample of dev_nr devices.
+ * Return the number of wrong or missing lines.
+ */
+int check_lines(char *buf, size_t len, int format, int dev_nr)
+{
+	char *line = buf, *eol, *p;
+	int *seen, cpu_lines = 0, bad = 0, dev_lines, i;
+
+	if ((seen = (int *) calloc(dev_nr, sizeof(int))) == NULL) {
+		perror("calloc");
+		exit(4);
+	}
+	for (; (line < buf + len) && ((eol = memchr(line, '\n', buf + len - line)) != NULL);
+	     line = eol + 1) {
+		if (format == PUSH_INFLUX) {
+			if (!strncmp(line, "simplestat_cpu,cpu=", 19)) {
+				cpu_lines++;
+				continue;
+			}
+			p = "simplestat_disk,device=vol";
+		}
+		else {
+			if (!strncmp(line, "simplestat.cpu.", 15)) {
+				cpu_lines++;
+				continue;
+			}
+			p = "simplestat.disk.vol";
+		}
+		if (strncmp(line, p, strlen(p)) ||
+		    ((i = atoi(line + strlen(p))) < 0) || (i >= dev_nr)) {
+			printf("Unexpected line: %.*s\n", (int) (eol - line), line);
+			bad++;
+			continue;
+		}
+		seen[i]++;
+	}
+	if (line != buf + len) {
+		printf("Last line is not terminated\n");
+		bad++;
+	}
+
+	/* Every CPU online plus CPU "all" */
+	if (cpu_lines != (NR_TEST_CPUS + 1) * ((format == PUSH_INFLUX) ? 1 : NR_CPU_PCT)) {
+		printf("%d CPU lines\n", cpu_lines);
+		bad++;
+	}
+	dev_lines = (format == PUSH_INFLUX) ? 1 : NR_XR_COLS;
+	for (i = 0; i < dev_nr; i++) {
+		if (seen[i] != dev_lines) {
+			printf("%d lines for device vol%04d\n", seen[i], i);
+			bad++;
+		}
+	}
+	free(seen);
+
+	return bad;
+}
+
+/*
+ * Push a sample in a format and check the datagrams received on socket fd,
+ * then close fd and push again.
+ * Return the number of errors found.
+ */
+int test_format(int fd, char *dest, int format, struct stats_sample *smp)
+{
+	struct push_sink ps;
+	char *rcv, *all;
+	ssize_t n;
+	size_t len = 0;
+	int dgrams = 0, bad = 0, i;
+	unsigned long long sent, dropped;
+
+	if (((rcv = (char *) malloc(PUSH_DGRAM_SIZE * 8)) == NULL) ||
+	    ((all = (char *) malloc(RCV_BUF_SIZE)) == NULL)) {
+		perror("malloc");
+		exit(4);
+	}
+
+	push_open(&ps, dest, format);
+	push_send(&ps, smp);
+
+	/* Datagrams sent over the loopback interface are already queued */
+	while ((n = recv(fd, rcv, PUSH_DGRAM_SIZE * 8, MSG_DONTWAIT)) >= 0) {
+		dgrams++;
+		if ((n == 0) || (n > PUSH_DGRAM_SIZE)) {
+			printf("Datagram #%d is %zd bytes\n", dgrams, n);
+			bad++;
+		}
+		else if (rcv[n - 1] != '\n') {
+			printf("Datagram #%d is not cut at the end of a line\n", dgrams);
+			bad++;
+		}
+		if (len + n <= RCV_BUF_SIZE) {
+			memcpy(all + len, rcv, n);
+			len += n;
+		}
+	}
+	if (errno != EAGAIN) {
+		perror("recv");
+		exit(2);
+	}
+
+	bad += check_lines(all, len, format, smp->iodev_nr);
+	if ((len != ps.lines.len) || memcmp(all, ps.lines.buf, len)) {
+		printf("Lines received differ from lines sent\n");
+		bad++;
+	}
+	if ((ps.sent != (unsigned long long) dgrams) || ps.dropped) {
+		printf("%d datagrams received, %llu sent, %llu dropped\n",
+		       dgrams, ps.sent, ps.dropped);
+		bad++;
+	}
+	printf("%s: %zu bytes in %d datagrams\n",
+	       (format == PUSH_INFLUX) ? "influx" : "statsd", len, dgrams);
+
+	/*
+	 * No one listening any more: The kernel accepts datagrams until the
+	 * ICMP port unreachable of one of them comes back, then refuses the
+	 * next send once. Every datagram is either sent or dropped.
+	 */
+	close(fd);
+	sent = ps.sent;
+	dropped = ps.dropped;
+	for (i = 0; i < NR_PUSH_NO_LISTENER; i++) {
+		push_send(&ps, smp);
+		if (ps.sent + ps.dropped - sent - dropped != (unsigned long long) ps.cut_nr * (i + 1)) {
+			printf("No listener: Push #%d of %d datagrams, %llu sent, %llu dropped so far\n",
+			       i + 1, ps.cut_nr, ps.sent - sent, ps.dropped - dropped);
+			bad++;
+		}
+	}
+	if (ps.dropped == dropped) {
+		printf("No listener: No datagram dropped\n");
+		bad++;
+	}
+	printf("%s: No listener: %llu datagrams sent, %llu dropped in %d pushes\n",
+	       (format == PUSH_INFLUX) ? "influx" : "statsd",
+	       ps.sent - sent, ps.dropped - dropped, NR_PUSH_NO_LISTENER);
+
+	push_close(&ps);
+	free(rcv);
+	free(all);
+
+	return bad;
+}
+
+/*
+ * Bind a UDP socket to 127.0.0.1 on a free port.
+ * Return the socket, and its address into dest.
+ */
+int open_listener(char *dest, size_t len)
+{
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	int fd, size = RCV_BUF_SIZE;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) ||
+	    (bind(fd, (struct sockaddr *) &sin, sizeof(sin)) < 0) ||
+	    (getsockname(fd, (struct sockaddr *) &sin, &slen) < 0)) {
+		perror("socket");
+		exit(2);
+	}
+	/* Room for all the datagrams of a push (needs CAP_NET_ADMIN beyond rmem_max) */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+	snprintf(dest, len, "127.0.0.1:%d", ntohs(sin.sin_port));
+
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	struct stats_sample smp;
+	char dest[32];
+	int dev_nr = DEFAULT_DEVICES, fd, bad;
+
+	if ((argc > 2) || ((argc == 2) && ((dev_nr = atoi(argv[1])) < 1))) {
+		fprintf(stderr, "Usage: %s [ <devices> ]\n", argv[0]);
+		exit(1);
+	}
+
+	fill_sample(&smp, dev_nr);
+
+	fd = open_listener(dest, sizeof(dest));
+	bad = test_format(fd, dest, PUSH_INFLUX, &smp);
+
+	fd = open_listener(dest, sizeof(dest));
+	bad += test_format(fd, dest, PUSH_STATSD, &smp);
+
+	if (bad) {
+		printf("%d errors\n", bad);
+		exit(3);
+	}
+	printf("All datagrams OK\n");
+
+	return 0;
+}
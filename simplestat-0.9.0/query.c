@@ -0,0 +1,785 @@
+/*
+ * query.c: Time-range and device queries over recorded files (see query.h)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "iostat.h"
+#include "common.h"
+#include "record.h"
+#include "query.h"
+#include "rollup.h"
+
+extern int flags;
+extern int cpu_nr;
+extern __thread struct io_ext_rates st_xrates;
+
+/* Names of the stats devices may be ranked by (see write_disk_stat_header()) */
+char *qix_metric_name[NR_XR_COLS] = {
+	"rrqm/s", "wrqm/s", "r/s", "w/s", "rkB/s", "wkB/s", "avgrq-sz",
+	"avgqu-sz", "await", "r_await", "w_await", "svctm", "%util"
+};
+
+/*
+ * Return the number of a device name in the query index, or -1 if it
+ * isn't there. If add is set, the name is added when it is not found.
+ */
+int qix_name(struct qix *qx, char *name, int add)
+{
+	unsigned int h, i, size;
+	int n;
+
+	if (!qx->hash || (qx->hdr.name_nr * 2 >= qx->hash_mask + 1)) {
+		/* Keep the hash index half empty */
+		for (size = NR_DEV_HASH_MIN; size <= qx->hdr.name_nr * 2; size <<= 1);
+		free(qx->hash);
+		if ((qx->hash = (int *) malloc(sizeof(int) * size)) == NULL) {
+			perror("malloc");
+			exit(4);
+		}
+		memset(qx->hash, 0xff, sizeof(int) * size);
+		qx->hash_mask = size - 1;
+		for (n = 0; n < (int) qx->hdr.name_nr; n++) {
+			for (h = hash_dev_name(qx->name[n].name) & qx->hash_mask;
+			     qx->hash[h] >= 0; h = (h + 1) & qx->hash_mask);
+			qx->hash[h] = n;
+		}
+	}
+
+	for (h = hash_dev_name(name) & qx->hash_mask; (n = qx->hash[h]) >= 0;
+	     h = (h + 1) & qx->hash_mask) {
+		if (!strcmp(qx->name[n].name, name))
+			return n;
+	}
+	if (!add)
+		return -1;
+
+	if (qx->hdr.name_nr == qx->name_size) {
+		qx->name_size = qx->name_size ? qx->name_size * 2 : NR_DEV_HASH_MIN;
+		size = QIX_NAME_SIZE * qx->name_size;
+		SREALLOC(qx->name, struct qix_name, size);
+	}
+	i = qx->hdr.name_nr++;
+	strncpy(qx->name[i].name, name, MAX_NAME_LEN - 1);
+	qx->name[i].name[MAX_NAME_LEN - 1] = '\0';
+	qx->hash[h] = i;
+
+	return i;
+}
+
+/*
+ * Update the name numbers of the slots of the dictionary in effect,
+ * if it has changed since last sample.
+ */
+void qix_map_slots(struct qix_query *q, int add)
+{
+	struct stats_sample *smp = &q->cur.smp;
+	size_t size;
+	int i;
+
+	if (q->slot_name && (q->dict_gen == smp->dict_gen))
+		return;
+
+	size = sizeof(int) * (smp->iodev_nr + 1);
+	SREALLOC(q->slot_name, int, size);
+	for (i = 0; i < smp->iodev_nr; i++) {
+		q->slot_name[i] = smp->hdr[i].used ? qix_name(q->qx, smp->hdr[i].name, add) : -1;
+	}
+	q->dict_gen = smp->dict_gen;
+}
+
+/*
+ * Tell whether a device was active during a sample (stats in st_xrates).
+ */
+int qix_active(int i)
+{
+	double **x = st_xrates.col;
+
+	return (x[XR_RIO][i] > 0) || (x[XR_WIO][i] > 0) ||
+	       (x[XR_AQUSZ][i] > 0) || (x[XR_UTIL][i] > 0);
+}
+
+/*
+ * Add the stats of device slot i (in st_xrates) to a device summary.
+ */
+void qix_add_sample(struct qix_dev *qd, int i)
+{
+	double **x = st_xrates.col;
+	double v;
+	int c;
+
+	for (c = 0; c < NR_XR_COLS; c++) {
+		v = x[c][i];
+		if (!qd->count || (v < qd->min[c])) {
+			qd->min[c] = v;
+		}
+		if (!qd->count || (v > qd->max[c])) {
+			qd->max[c] = v;
+		}
+		qd->sum[c] += v;
+	}
+	qd->count++;
+}
+
+/*
+ * Add a device summary to another one.
+ */
+void qix_add_summary(struct qix_dev *qd, struct qix_dev *qs)
+{
+	int c;
+
+	for (c = 0; c < NR_XR_COLS; c++) {
+		if (!qd->count || (qs->min[c] < qd->min[c])) {
+			qd->min[c] = qs->min[c];
+		}
+		if (!qd->count || (qs->max[c] > qd->max[c])) {
+			qd->max[c] = qs->max[c];
+		}
+		qd->sum[c] += qs->sum[c];
+	}
+	qd->count += qs->count;
+}
+
+/*
+ * Compare two name numbers (qsort() callback).
+ */
+int qix_cmp_int(const void *a, const void *b)
+{
+	return *((int *) a) - *((int *) b);
+}
+
+/*
+ * Make room in the query index for one more block and n more summaries.
+ */
+void qix_reserve(struct qix *qx, unsigned int n)
+{
+	size_t size;
+
+	if (qx->hdr.block_nr == qx->block_size) {
+		qx->block_size = qx->block_size ? qx->block_size * 2 : REC_INDEX_INIT;
+		size = QIX_BLOCK_SIZE * qx->block_size;
+		SREALLOC(qx->blk, struct qix_block, size);
+	}
+	if (qx->hdr.sum_nr + n > qx->sum_size) {
+		while (qx->hdr.sum_nr + n > qx->sum_size) {
+			qx->sum_size = qx->sum_size ? qx->sum_size * 2 : REC_INDEX_INIT;
+		}
+		size = QIX_DEV_SIZE * qx->sum_size;
+		SREALLOC(qx->sum, struct qix_dev, size);
+	}
+}
+
+/*
+ * Return the number of index entries per block.
+ */
+unsigned int qix_step(struct rec_reader *rd)
+{
+	/* Keyframes are indexed in a compressed file, else every sample */
+	return (rd->fh.flags & REC_F_COMPRESSED) ?
+	       QIX_BLOCK_SAMPLES / REC_KEYFRAME_INTERVAL : QIX_BLOCK_SAMPLES;
+}
+
+/*
+ * Decode the samples of a block made of index entries [e, e + nr[,
+ * and compute their extended stats.
+ * As with a replay, decoding goes on up to the first sample of next
+ * block, and the first sample decoded is only used as a base: It is
+ * summarized in the block before.
+ * Return 1 each time a sample is ready, 0 at the end of the block.
+ */
+int qix_next_sample(struct qix_query *q, unsigned int e, unsigned int nr)
+{
+	struct rec_reader *rd = q->rd;
+	double rdiv, rmul;
+	unsigned long long end;
+
+	if (!q->cur.nr && !rec_seek(&q->cur, e))
+		/* Samples of the block have been dropped from a history file */
+		return 0;
+	end = (e + nr < rd->idx_nr) ? rd->idx[e + nr].offset : rd->end;
+
+	while (rec_read_sample(&q->cur, end)) {
+		if (q->cur.nr == 1)
+			continue;
+		get_device_itv(&q->cur.smp, &rdiv, &rmul);
+		compute_sample_ext_rates(&q->cur.smp, rdiv, rmul);
+		return 1;
+	}
+	/* Next block starts with a seek */
+	q->cur.nr = 0;
+
+	return 0;
+}
+
+/*
+ * Build the query index of a recorded file (see query.h).
+ */
+void qix_build(struct qix_query *q)
+{
+	struct rec_reader *rd = q->rd;
+	struct qix *qx = q->qx;
+	struct qix_block *qb;
+	struct qix_dev *acc = NULL;
+	unsigned int e, step = qix_step(rd), acc_nr = 0, c, i;
+	int *touched = NULL, n, slot;
+	size_t size;
+
+	for (e = 0; e < rd->idx_nr; e += step) {
+		qix_reserve(qx, 0);
+		qb = qx->blk + qx->hdr.block_nr;
+		memset(qb, 0, QIX_BLOCK_SIZE);
+		qb->entry = e;
+		qb->entry_nr = (rd->idx_nr - e < step) ? rd->idx_nr - e : step;
+
+		while (qix_next_sample(q, qb->entry, qb->entry_nr)) {
+			qix_map_slots(q, TRUE);
+			if (acc_nr < qx->name_size) {
+				/* New devices */
+				size = QIX_DEV_SIZE * qx->name_size;
+				SREALLOC(acc, struct qix_dev, size);
+				size = sizeof(int) * qx->name_size;
+				SREALLOC(touched, int, size);
+				for (i = acc_nr; i < qx->name_size; i++) {
+					acc[i].count = 0;
+				}
+				acc_nr = qx->name_size;
+			}
+
+			if (!qb->sample_nr) {
+				qb->first = q->cur.smp.realtime;
+			}
+			qb->last = q->cur.smp.realtime;
+			qb->sample_nr++;
+
+			for (slot = 0; slot < q->cur.smp.iodev_nr; slot++) {
+				if (((n = q->slot_name[slot]) < 0) || !qix_active(slot))
+					continue;
+				if (!acc[n].count) {
+					for (c = 0; c < NR_XR_COLS; c++) {
+						acc[n].sum[c] = 0;
+					}
+					acc[n].name = n;
+					touched[qb->sum_nr++] = n;
+				}
+				qix_add_sample(acc + n, slot);
+			}
+		}
+
+		if (!qb->sample_nr)
+			continue;
+
+		/* Save the summaries of the devices active in the block, by name number */
+		qsort(touched, qb->sum_nr, sizeof(int), qix_cmp_int);
+		qix_reserve(qx, qb->sum_nr);
+		qb = qx->blk + qx->hdr.block_nr;
+		qb->sum = qx->hdr.sum_nr;
+		for (i = 0; i < qb->sum_nr; i++) {
+			qx->sum[qb->sum + i] = acc[touched[i]];
+			acc[touched[i]].count = 0;
+		}
+		qx->hdr.sum_nr += qb->sum_nr;
+		qx->hdr.block_nr++;
+	}
+
+	free(acc);
+	free(touched);
+}
+
+/*
+ * Read len bytes of a file. Return 1 on success.
+ */
+int qix_read(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = read(fd, buf, len)) <= 0) {
+			if ((n < 0) && (errno == EINTR))
+				continue;
+			return 0;
+		}
+		buf = (char *) buf + n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+/*
+ * Write len bytes to a file. Return 1 on success.
+ */
+int qix_write(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		buf = (char *) buf + n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+/*
+ * Load the query index of a recorded file whose status is st.
+ * Return 0 if there is none, or if it is out of date.
+ */
+int qix_load(struct qix *qx, char *filename, struct stat *st)
+{
+	struct qix_header hdr;
+	int fd, ok;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return 0;
+
+	if (!qix_read(fd, &hdr, QIX_HEADER_SIZE) ||
+	    (hdr.magic != QIX_MAGIC) || (hdr.version != QIX_VERSION) ||
+	    (hdr.metric_nr != NR_XR_COLS) ||
+	    (hdr.src_size != (unsigned long long) st->st_size) ||
+	    (hdr.src_mtime != (unsigned long long) st->st_mtim.tv_sec * NSEC_PER_SEC +
+			      st->st_mtim.tv_nsec) ||
+	    (hdr.src_ino != (unsigned long long) st->st_ino)) {
+		close(fd);
+		return 0;
+	}
+
+	qx->hdr = hdr;
+	qx->name_size = hdr.name_nr;
+	qx->block_size = hdr.block_nr;
+	qx->sum_size = hdr.sum_nr;
+	if (((qx->name = malloc(QIX_NAME_SIZE * (size_t) hdr.name_nr + 1)) == NULL) ||
+	    ((qx->blk = malloc(QIX_BLOCK_SIZE * (size_t) hdr.block_nr + 1)) == NULL) ||
+	    ((qx->sum = malloc(QIX_DEV_SIZE * (size_t) hdr.sum_nr + 1)) == NULL)) {
+		perror("malloc");
+		exit(4);
+	}
+	ok = qix_read(fd, qx->name, QIX_NAME_SIZE * (size_t) hdr.name_nr) &&
+	     qix_read(fd, qx->blk, QIX_BLOCK_SIZE * (size_t) hdr.block_nr) &&
+	     qix_read(fd, qx->sum, QIX_DEV_SIZE * (size_t) hdr.sum_nr);
+	close(fd);
+
+	if (!ok) {
+		free(qx->name);
+		free(qx->blk);
+		free(qx->sum);
+		memset(qx, 0, sizeof(struct qix));
+	}
+
+	return ok;
+}
+
+/*
+ * Save the query index of a recorded file.
+ * It is written to a temporary file first, so that a query running
+ * meanwhile never reads an incomplete index. Queries still work if it
+ * cannot be saved: The index will be built again next time.
+ */
+void qix_save(struct qix *qx, char *filename)
+{
+	char tmp[MAX_FILE_LEN + 8];
+	int fd, ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return;
+
+	ok = qix_write(fd, &qx->hdr, QIX_HEADER_SIZE) &&
+	     qix_write(fd, qx->name, QIX_NAME_SIZE * (size_t) qx->hdr.name_nr) &&
+	     qix_write(fd, qx->blk, QIX_BLOCK_SIZE * (size_t) qx->hdr.block_nr) &&
+	     qix_write(fd, qx->sum, QIX_DEV_SIZE * (size_t) qx->hdr.sum_nr);
+	if (close(fd) < 0) {
+		ok = FALSE;
+	}
+
+	if (!ok || (rename(tmp, filename) < 0)) {
+		unlink(tmp);
+	}
+}
+
+/*
+ * Load the buckets of a rollup file (see rollup.h) as the blocks of
+ * a query index.
+ * Return 0 if the file is not a rollup file.
+ */
+int qix_load_rollup(struct qix_query *q, char *filename)
+{
+	struct qix *qx = q->qx;
+	struct qix_block *qb;
+	struct ru_header rh;
+	struct ru_record rr;
+	struct ru_bucket bkt;
+	struct qix_name qn;
+	unsigned int i;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+		exit(2);
+	}
+	if (!qix_read(fd, &rh, RU_HEADER_SIZE) || (rh.magic != RU_MAGIC)) {
+		close(fd);
+		return 0;
+	}
+	if ((rh.version != RU_VERSION) || !rh.span || (rh.cpu_metric_nr != NR_CPU_PCT) ||
+	    (rh.metric_nr != NR_XR_COLS)) {
+		fprintf(stderr, "Invalid rollup file: %s\n", filename);
+		exit(2);
+	}
+	q->span = (unsigned long long) rh.span * NSEC_PER_SEC;
+
+	/* A record cut short (recording was interrupted) ends the file */
+	while (qix_read(fd, &rr, RU_RECORD_SIZE)) {
+		if (rr.type == RU_NAMES) {
+			for (i = 0; i < rr.len / QIX_NAME_SIZE; i++) {
+				if (!qix_read(fd, &qn, QIX_NAME_SIZE))
+					break;
+				qn.name[MAX_NAME_LEN - 1] = '\0';
+				qix_name(qx, qn.name, TRUE);
+			}
+			if (i < rr.len / QIX_NAME_SIZE)
+				break;
+			continue;
+		}
+		if ((rr.type != RU_BUCKET) || !qix_read(fd, &bkt, RU_BUCKET_SIZE) ||
+		    (rr.len != RU_BUCKET_SIZE + RU_CPU_SIZE * rh.cpu_nr + QIX_DEV_SIZE * bkt.dev_nr) ||
+		    (lseek(fd, RU_CPU_SIZE * rh.cpu_nr, SEEK_CUR) < 0))
+			break;
+
+		qix_reserve(qx, bkt.dev_nr);
+		qb = qx->blk + qx->hdr.block_nr;
+		memset(qb, 0, QIX_BLOCK_SIZE);
+		qb->first = bkt.first;
+		qb->last = bkt.last;
+		qb->sample_nr = bkt.sample_nr;
+		qb->sum = qx->hdr.sum_nr;
+		qb->sum_nr = bkt.dev_nr;
+		if (!qix_read(fd, qx->sum + qb->sum, QIX_DEV_SIZE * bkt.dev_nr))
+			break;
+		for (i = 0; i < bkt.dev_nr; i++) {
+			if (qx->sum[qb->sum + i].name >= qx->hdr.name_nr)
+				break;
+		}
+		if (i < bkt.dev_nr)
+			break;
+		qx->hdr.sum_nr += qb->sum_nr;
+		qx->hdr.block_nr++;
+	}
+	close(fd);
+
+	return 1;
+}
+
+/*
+ * Open a recorded file to query it, and load its query index
+ * (building it if needed). A rollup file is loaded instead of being
+ * indexed.
+ */
+void qix_open(struct qix_query *q, struct rec_reader *rd, struct qix *qx,
+	      char *filename, unsigned long long from, unsigned long long to)
+{
+	char qixname[MAX_FILE_LEN];
+	struct stat st;
+
+	memset(q, 0, sizeof(struct qix_query));
+	memset(qx, 0, sizeof(struct qix));
+	q->rd = rd;
+	q->qx = qx;
+	q->from = from;
+	q->to = to;
+	q->name = -1;
+	q->fctr = DISPLAY_MEGABYTES(flags) ? 2048 : DISPLAY_KILOBYTES(flags) ? 2 : 1;
+
+	if (qix_load_rollup(q, filename))
+		return;
+
+	rec_open_read(rd, filename);
+	rec_init_cursor(&q->cur, rd);
+
+	/*
+	 * Stats are computed as on the machine they were recorded on, and
+	 * from the times at which samples were taken (as with a replay).
+	 */
+	cpu_nr = rd->fh.cpu_nr - 1;
+	hz = rd->fh.hz;
+	flags |= I_D_HIRES;
+
+	snprintf(qixname, sizeof(qixname), "%s%s", filename, QIX_SUFFIX);
+	if (!fstat(rd->fd, &st) && qix_load(qx, qixname, &st))
+		return;
+
+	qix_build(q);
+	qx->hdr.magic = QIX_MAGIC;
+	qx->hdr.version = QIX_VERSION;
+	qx->hdr.metric_nr = NR_XR_COLS;
+	qx->hdr.src_size = st.st_size;
+	qx->hdr.src_mtime = (unsigned long long) st.st_mtim.tv_sec * NSEC_PER_SEC +
+			    st.st_mtim.tv_nsec;
+	qx->hdr.src_ino = st.st_ino;
+	qix_save(qx, qixname);
+}
+
+/*
+ * Close a recorded file being queried.
+ */
+void qix_close(struct qix_query *q)
+{
+	struct qix *qx = q->qx;
+
+	if (!q->span) {
+		rec_free_cursor(&q->cur);
+		rec_close_read(q->rd);
+	}
+	free(q->slot_name);
+	free(q->acc);
+	free(qx->name);
+	free(qx->blk);
+	free(qx->sum);
+	free(qx->hash);
+	sfree_io_soa();
+}
+
+/*
+ * Return the summary of device name n in a block, or NULL if the
+ * device was not active in it.
+ */
+struct qix_dev *qix_find_sum(struct qix *qx, struct qix_block *qb, int n)
+{
+	struct qix_dev *qd = qx->sum + qb->sum;
+	int lo = 0, hi = qb->sum_nr - 1, mid;
+
+	/* Summaries are sorted by name number */
+	while (lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((int) qd[mid].name == n)
+			return qd + mid;
+		if ((int) qd[mid].name < n) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid - 1;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Display the average extended stats of a device over a bucket of a
+ * rollup file, with the time at which the bucket starts.
+ */
+void qix_write_bucket(struct qix_query *q, struct qix_block *qb, struct qix_dev *qd)
+{
+	struct io_hdr_stats shi;
+	char timestamp[64];
+	struct tm tm;
+	time_t t;
+	int c;
+
+	t = (time_t) ((qb->first - qb->first % q->span) / NSEC_PER_SEC);
+	localtime_r(&t, &tm);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm);
+	out_str(timestamp, 20);
+
+	memset(&shi, 0, IO_HDR_STATS_SIZE);
+	strcpy(shi.name, q->qx->name[qd->name].name);
+	shi.used = 1;
+	for (c = 0; c < NR_XR_COLS; c++) {
+		st_xrates.col[c][0] = qd->sum[c] / qd->count;
+	}
+	write_ext_stat(0, q->fctr, &shi, &st_xrates);
+}
+
+/*
+ * Display the extended stats of a device for each sample of a range of
+ * time in which it was active (for each bucket, with a rollup file).
+ */
+void query_device(char *filename, char *devname, unsigned long long from,
+		  unsigned long long to)
+{
+	struct rec_reader rd;
+	struct qix qx;
+	struct qix_query q;
+	struct qix_block *qb;
+	struct qix_dev *qd;
+	struct stats_sample *smp = &q.cur.smp;
+	char timestamp[64];
+	unsigned int b;
+	int slot, fctr = 1;
+
+	qix_open(&q, &rd, &qx, filename, from, to);
+
+	if ((q.name = qix_name(&qx, devname, FALSE)) < 0) {
+		fprintf(stderr, "No stats for device %s in %s\n", devname, filename);
+		exit(1);
+	}
+
+	flags |= I_D_EXTENDED;
+	out_str("Time:", 20);
+	write_disk_stat_header(&fctr);
+	out_flush();
+
+	if (q.span) {
+		salloc_io_soa(1);
+	}
+
+	for (b = 0; b < qx.hdr.block_nr; b++) {
+		qb = qx.blk + b;
+		if (qb->first > to)
+			break;
+		if ((qb->last < from) || !(qd = qix_find_sum(&qx, qb, q.name)))
+			/* Out of range, or device was idle */
+			continue;
+
+		if (q.span) {
+			qix_write_bucket(&q, qb, qd);
+			out_flush();
+			continue;
+		}
+
+		while (qix_next_sample(&q, qb->entry, qb->entry_nr)) {
+			if ((smp->realtime < from) || (smp->realtime > to))
+				continue;
+
+			qix_map_slots(&q, FALSE);
+			for (slot = 0; slot < smp->iodev_nr; slot++) {
+				if (q.slot_name[slot] == q.name)
+					break;
+			}
+			if ((slot == smp->iodev_nr) || !qix_active(slot))
+				continue;
+
+			strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &smp->rectime);
+			out_str(timestamp, 20);
+			write_ext_stat(slot, fctr, smp->hdr + slot, &st_xrates);
+		}
+		out_flush();
+	}
+
+	qix_close(&q);
+}
+
+/* Stat devices are sorted by, and their stats (for qix_cmp_avg()) */
+int qix_sort_metric;
+struct qix_dev *qix_sort_acc;
+
+/*
+ * Compare the averages of the stat devices are ranked by, highest
+ * first (qsort() callback).
+ */
+int qix_cmp_avg(const void *a, const void *b)
+{
+	struct qix_dev *qa = qix_sort_acc + *((int *) a);
+	struct qix_dev *qb = qix_sort_acc + *((int *) b);
+	double va = qa->sum[qix_sort_metric] / qa->count;
+	double vb = qb->sum[qix_sort_metric] / qb->count;
+
+	return (va < vb) - (va > vb);
+}
+
+/*
+ * Display the devices with the highest average value of a stat over a
+ * range of time. Averages are computed over the samples in which each
+ * device was active (over the buckets in the range, with a rollup file).
+ */
+void query_top(char *filename, int top, char *metric, unsigned long long from,
+	       unsigned long long to)
+{
+	struct rec_reader rd;
+	struct qix qx;
+	struct qix_query q;
+	struct qix_block *qb;
+	struct qix_dev *qd;
+	struct stats_sample *smp = &q.cur.smp;
+	unsigned int b, i;
+	int *rank, rank_nr = 0, slot, n, m;
+	double f;
+
+	for (m = 0; m < NR_XR_COLS; m++) {
+		if (!strcmp(metric, qix_metric_name[m]))
+			break;
+	}
+	if (m == NR_XR_COLS) {
+		fprintf(stderr, "Unknown stat: %s\n", metric);
+		exit(1);
+	}
+
+	qix_open(&q, &rd, &qx, filename, from, to);
+
+	if (((q.acc = (struct qix_dev *) calloc(qx.hdr.name_nr + 1, QIX_DEV_SIZE)) == NULL) ||
+	    ((rank = (int *) malloc(sizeof(int) * (qx.hdr.name_nr + 1))) == NULL)) {
+		perror("malloc");
+		exit(4);
+	}
+
+	for (b = 0; b < qx.hdr.block_nr; b++) {
+		qb = qx.blk + b;
+		if (qb->first > to)
+			break;
+		if (qb->last < from)
+			continue;
+
+		if (q.span || ((qb->first >= from) && (qb->last <= to))) {
+			/* Whole block is in the range (or is a bucket): Use its summaries */
+			for (i = 0, qd = qx.sum + qb->sum; i < qb->sum_nr; i++, qd++) {
+				qix_add_summary(q.acc + qd->name, qd);
+			}
+			continue;
+		}
+
+		while (qix_next_sample(&q, qb->entry, qb->entry_nr)) {
+			if ((smp->realtime < from) || (smp->realtime > to))
+				continue;
+
+			qix_map_slots(&q, FALSE);
+			for (slot = 0; slot < smp->iodev_nr; slot++) {
+				if (((n = q.slot_name[slot]) >= 0) && qix_active(slot)) {
+					qix_add_sample(q.acc + n, slot);
+				}
+			}
+		}
+	}
+
+	for (n = 0; n < (int) qx.hdr.name_nr; n++) {
+		if (q.acc[n].count) {
+			rank[rank_nr++] = n;
+		}
+	}
+	qix_sort_metric = m;
+	qix_sort_acc = q.acc;
+	qsort(rank, rank_nr, sizeof(int), qix_cmp_avg);
+
+	/* Sectors are displayed in the unit selected */
+	f = ((m == XR_RSEC) || (m == XR_WSEC)) ? q.fctr : 1;
+
+	out_printf("Device:      %9s      min      max  samples\n", metric);
+	for (n = 0; (n < rank_nr) && (n < top); n++) {
+		qd = q.acc + rank[n];
+		out_str(qx.name[rank[n]].name, 13);
+		out_char(' ');
+		out_fixed2(qd->sum[m] / qd->count / f, 9);
+		out_char(' ');
+		out_fixed2(qd->min[m] / f, 8);
+		out_char(' ');
+		out_fixed2(qd->max[m] / f, 8);
+		out_char(' ');
+		out_ull(qd->count, 8);
+		out_char('\n');
+	}
+	out_flush();
+
+	free(rank);
+	qix_close(&q);
+}
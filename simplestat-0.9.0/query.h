@@ -0,0 +1,153 @@
+/*
+ * query.h: Time-range and device queries over recorded files
+ */
+
+#ifndef _QUERY_H
+#define _QUERY_H
+
+#include "iostat.h"
+#include "record.h"
+
+/*
+ * Queries use an index saved next to the recorded file (same name with
+ * QIX_SUFFIX appended), built the first time the file is queried and
+ * rebuilt whenever the file has changed.
+ * The samples of the recorded file are split into blocks of about
+ * QIX_BLOCK_SAMPLES samples, starting at entries of the file index.
+ * For each block, the query index saves the time of its first and last
+ * samples and, for each device that was active in it, the min, max and
+ * sum of every extended stat (see write_ext_stat()) over the samples
+ * in which the device was active.
+ * A query only decodes the blocks that overlap the range of time asked
+ * for, and in which the devices asked for were active. Blocks that are
+ * entirely in the range are not decoded at all by a top-N query: Their
+ * summaries are used instead.
+ *
+ * The file starts with a header, followed by the device names
+ * (name_nr qix_name structures), the blocks (block_nr qix_block
+ * structures) and the device summaries (sum_nr qix_dev structures,
+ * sorted by block then name number).
+ *
+ * The rollup files saved along with a recorded file (see rollup.h) can
+ * be queried the same way. Their buckets are used as blocks, and are
+ * never split: A bucket is used as a whole as soon as part of it is in
+ * the range of time asked for.
+ */
+
+#define QIX_MAGIC	0x53535149	/* "SSQI" */
+#define QIX_VERSION	1
+#define QIX_SUFFIX	".qix"
+
+/* Number of samples per block */
+#define QIX_BLOCK_SAMPLES	600
+
+struct qix_header {
+	unsigned int magic;
+	unsigned int version;
+	/* Number of stats summarized for each device */
+	unsigned int metric_nr;
+	unsigned int name_nr;
+	unsigned int block_nr;
+	unsigned int sum_nr;
+	/* Recorded file the index has been built from */
+	unsigned long long src_size;
+	unsigned long long src_mtime;
+	unsigned long long src_ino;
+};
+
+#define QIX_HEADER_SIZE	(sizeof(struct qix_header))
+
+struct qix_block {
+	/* Time of first and last samples summarized (ns since the Epoch) */
+	unsigned long long first;
+	unsigned long long last;
+	/* Entries of the file index the block is made of */
+	unsigned int entry;
+	unsigned int entry_nr;
+	/* Number of samples summarized */
+	unsigned int sample_nr;
+	/* Device summaries of the block: [sum, sum + sum_nr[ */
+	unsigned int sum;
+	unsigned int sum_nr;
+};
+
+#define QIX_BLOCK_SIZE	(sizeof(struct qix_block))
+
+/* Stats of a device over the samples in which it was active */
+struct qix_dev {
+	/* Number of the device name */
+	unsigned int name;
+	/* Number of samples */
+	unsigned int count;
+	double min[NR_XR_COLS];
+	double max[NR_XR_COLS];
+	double sum[NR_XR_COLS];
+};
+
+#define QIX_DEV_SIZE	(sizeof(struct qix_dev))
+
+struct qix_name {
+	char name[MAX_NAME_LEN];
+};
+
+#define QIX_NAME_SIZE	(sizeof(struct qix_name))
+
+/* Query index in memory */
+struct qix {
+	struct qix_header hdr;
+	struct qix_name *name;
+	struct qix_block *blk;
+	struct qix_dev *sum;
+	/* Allocated sizes */
+	unsigned int name_size;
+	unsigned int block_size;
+	unsigned int sum_size;
+	/* Hash index from device name to its number (-1: empty bucket) */
+	int *hash;
+	unsigned int hash_mask;
+};
+
+/* Query being run */
+struct qix_query {
+	struct rec_reader *rd;
+	struct rec_cursor cur;
+	struct qix *qx;
+	/* Range of time (ns since the Epoch) */
+	unsigned long long from;
+	unsigned long long to;
+	/* Device whose stats are displayed (-1: top-N query) */
+	int name;
+	/* Stat devices are ranked by (top-N query) */
+	int metric;
+	/* Stats of every device over the range (top-N query) */
+	struct qix_dev *acc;
+	/* Number of the name of each slot of the dictionary in effect */
+	int *slot_name;
+	unsigned int dict_gen;
+	int fctr;
+	/* Time span of a bucket (ns) if a rollup file is queried, else 0 */
+	unsigned long long span;
+};
+
+/*
+ ***************************************************************************
+ * Functions prototypes
+ ***************************************************************************
+ */
+
+extern int
+	qix_active(int);
+extern void
+	qix_add_sample(struct qix_dev *, int);
+extern void
+	qix_add_summary(struct qix_dev *, struct qix_dev *);
+extern int
+	qix_cmp_int(const void *, const void *);
+extern int
+	qix_name(struct qix *, char *, int);
+extern void
+	query_device(char *, char *, unsigned long long, unsigned long long);
+extern void
+	query_top(char *, int, char *, unsigned long long, unsigned long long);
+
+#endif  /* _QUERY_H */
@@ -0,0 +1,1294 @@
+/*
+ * record.c: Record raw stats into binary files (see record.h)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "iostat.h"
+#include "common.h"
+#include "rd_stats.h"
+#include "record.h"
+
+/*
+ * Make room for at least len more bytes in the buffer of records.
+ */
+void rec_reserve(struct rec_file *rf, size_t len)
+{
+	size_t size;
+
+	if (rf->buf.len + len <= rf->buf.size)
+		return;
+
+	size = rf->buf.size ? rf->buf.size : OUT_BUF_SIZE;
+	while (size < rf->buf.len + len) {
+		size <<= 1;
+	}
+	SREALLOC(rf->buf.buf, char, size);
+	rf->buf.size = size;
+}
+
+/*
+ * Append data to the buffer of records.
+ */
+void rec_append(struct rec_file *rf, void *data, size_t len)
+{
+	rec_reserve(rf, len);
+	memcpy(rf->buf.buf + rf->buf.len, data, len);
+	rf->buf.len += len;
+}
+
+/*
+ * Write the buffer of records at the end of the file.
+ * Recording stops if the file cannot be written.
+ */
+void rec_flush(struct rec_file *rf)
+{
+	char *p = rf->buf.buf;
+	size_t len = rf->buf.len;
+	ssize_t n;
+
+	rf->buf.len = 0;
+
+	while (len > 0) {
+		if ((n = write(rf->fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Cannot write record: %s\n", strerror(errno));
+			close(rf->fd);
+			rf->fd = -1;
+			return;
+		}
+		p += n;
+		len -= n;
+		rf->off += n;
+	}
+}
+
+/*
+ * Add a sample record to the index.
+ */
+void rec_add_index(struct rec_file *rf, unsigned long long realtime,
+		   unsigned long long offset)
+{
+	size_t size;
+
+	if (rf->idx_nr == rf->idx_size) {
+		rf->idx_size = rf->idx_size ? rf->idx_size * 2 : REC_INDEX_INIT;
+		size = REC_INDEX_SIZE * rf->idx_size;
+		SREALLOC(rf->idx, struct rec_index, size);
+	}
+	rf->idx[rf->idx_nr].realtime = realtime;
+	rf->idx[rf->idx_nr].offset = offset;
+	rf->idx[rf->idx_nr].dict_off = rf->dict_off;
+	rf->idx_nr++;
+}
+
+/*
+ * Save an unsigned value as a varint: 7 bits per byte, least significant
+ * first, the high bit being set on every byte but the last one.
+ * Return a pointer past the last byte written.
+ */
+unsigned char *put_varint(unsigned char *p, unsigned long long v)
+{
+	while (v >= 0x80) {
+		*p++ = (unsigned char) v | 0x80;
+		v >>= 7;
+	}
+	*p++ = (unsigned char) v;
+
+	return p;
+}
+
+/*
+ * Append the header of a record of a compressed file.
+ */
+void rec_append_frame(struct rec_file *rf, int type, size_t len)
+{
+	unsigned char *p;
+
+	rec_reserve(rf, 1 + VARINT_MAX);
+	p = (unsigned char *) rf->buf.buf + rf->buf.len;
+	*p++ = type;
+	p = put_varint(p, len);
+	rf->buf.len = (char *) p - rf->buf.buf;
+}
+
+/*
+ * Get the values of current snapshot of a sample, in the order in which
+ * they are encoded in a compressed file.
+ */
+void rec_get_values(struct rec_file *rf, struct stats_sample *smp,
+		    unsigned long long *v)
+{
+	struct stats_cpu *sc = smp->cpu[smp->curr];
+	struct io_stats *si = smp->iodev[smp->curr];
+	unsigned int i;
+
+	*v++ = smp->realtime;
+	*v++ = smp->ts[smp->curr];
+	*v++ = smp->uptime[smp->curr];
+	*v++ = smp->uptime0[smp->curr];
+
+	for (i = 0; i < rf->cpu_nr; i++, sc++) {
+		*v++ = sc->cpu_user;
+		*v++ = sc->cpu_nice;
+		*v++ = sc->cpu_sys;
+		*v++ = sc->cpu_idle;
+		*v++ = sc->cpu_iowait;
+		*v++ = sc->cpu_steal;
+		*v++ = sc->cpu_hardirq;
+		*v++ = sc->cpu_softirq;
+		*v++ = sc->cpu_guest;
+		*v++ = sc->cpu_guest_nice;
+	}
+
+	for (i = 0; i < (unsigned int) smp->iodev_nr; i++, si++) {
+		*v++ = si->rd_sectors;
+		*v++ = si->wr_sectors;
+		*v++ = si->rd_ios;
+		*v++ = si->rd_merges;
+		*v++ = si->wr_ios;
+		*v++ = si->wr_merges;
+		*v++ = si->rd_ticks;
+		*v++ = si->wr_ticks;
+		*v++ = si->ios_pgr;
+		*v++ = si->tot_ticks;
+		*v++ = si->rq_ticks;
+	}
+}
+
+/*
+ * Encode the nr fields of an entity against their previous values
+ * (see record.h). prev is NULL for a keyframe.
+ * Return a pointer past the last byte written.
+ */
+unsigned char *rec_encode_entity(unsigned char *p, unsigned long long *cur,
+				 unsigned long long *prev, int nr)
+{
+	unsigned long long d[REC_NR_IO_FIELDS], z, w, pv;
+	unsigned int mask = 0, wrap = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		pv = prev ? prev[i] : 0;
+		if (cur[i] == pv)
+			continue;
+
+		mask |= 1U << i;
+		z = ZIGZAG(cur[i] - pv);
+		if ((cur[i] < pv) && (pv <= 0xffffffff)) {
+			/*
+			 * Counter may have wrapped around 32 bits (see
+			 * write_basic_stat()): Save the difference modulo 2^32
+			 * if it is smaller than the decrease.
+			 */
+			w = (cur[i] - pv) & 0xffffffff;
+			if (w < z) {
+				wrap |= 1U << i;
+				z = w;
+			}
+		}
+		d[i] = z;
+	}
+
+	if (wrap) {
+		mask |= REC_WRAP_BIT(nr);
+	}
+	p = put_varint(p, mask);
+	if (wrap) {
+		p = put_varint(p, wrap);
+	}
+	for (i = 0; i < nr; i++) {
+		if (mask & (1U << i)) {
+			p = put_varint(p, d[i]);
+		}
+	}
+
+	return p;
+}
+
+/*
+ * Fill the header of a file recorded from now on.
+ */
+void rec_fill_file_header(struct rec_file *rf, struct file_header *fh,
+			  unsigned long long start)
+{
+	memset(fh, 0, FILE_HEADER_SIZE);
+	fh->magic = REC_MAGIC;
+	fh->version = REC_VERSION;
+	fh->rec_hdr_size = RECORD_HEADER_SIZE;
+	fh->cpu_size = STATS_CPU_SIZE;
+	fh->io_size = IO_STATS_SIZE;
+	fh->io_hdr_size = IO_HDR_STATS_SIZE;
+	fh->cpu_nr = rf->cpu_nr;
+	fh->hz = HZ;
+	fh->flags = rf->compress ? REC_F_COMPRESSED : 0;
+	if (rf->map) {
+		fh->flags |= REC_F_HISTORY;
+	}
+	fh->start = start;
+}
+
+/*
+ * Append the device dictionary of a sample to the buffer of records.
+ * The file header is written before the first one, else it is saved
+ * as a dictionary record.
+ */
+void rec_append_dict(struct rec_file *rf, struct stats_sample *smp)
+{
+	struct file_header fh;
+	struct record_header rh;
+	size_t len = IO_HDR_STATS_SIZE * smp->iodev_nr;
+
+	/* Samples indexed from now on use this dictionary */
+	rf->dict_off = rf->started ? rf->off + rf->buf.len : 0;
+
+	if (!rf->started) {
+		rec_fill_file_header(rf, &fh, smp->realtime);
+		fh.dev_nr = smp->iodev_nr;
+		rec_append(rf, &fh, FILE_HEADER_SIZE);
+		rf->started = TRUE;
+	}
+	else if (rf->compress) {
+		rec_append_frame(rf, REC_DICT, len);
+	}
+	else {
+		memset(&rh, 0, RECORD_HEADER_SIZE);
+		rh.type = REC_DICT;
+		rh.len = len;
+		rh.realtime = smp->realtime;
+		rec_append(rf, &rh, RECORD_HEADER_SIZE);
+	}
+	rec_append(rf, smp->hdr, len);
+}
+
+/*
+ * Make the device dictionary of a sample the one in effect.
+ */
+void rec_set_dict(struct rec_file *rf, struct stats_sample *smp)
+{
+	size_t size;
+	int i;
+
+	rf->dev_nr = smp->iodev_nr;
+	rf->dict_gen = smp->dict_gen;
+
+	if (rf->compress) {
+		/* Values are laid out differently: Next sample is a keyframe */
+		rf->val_nr = REC_NR_HDR_FIELDS + REC_NR_CPU_FIELDS * rf->cpu_nr +
+			     REC_NR_IO_FIELDS * rf->dev_nr;
+		for (i = 0; i < 2; i++) {
+			size = sizeof(unsigned long long) * rf->val_nr;
+			SREALLOC(rf->val[i], unsigned long long, size);
+		}
+		rf->since_key = -1;
+	}
+}
+
+/*
+ * Append current snapshot of a sample to the buffer of records,
+ * as a keyframe or a delta against previous sample.
+ */
+void rec_append_compressed(struct rec_file *rf, struct stats_sample *smp)
+{
+	unsigned long long *cur = rf->val[rf->val_curr];
+	unsigned long long *prev = rf->val[!rf->val_curr];
+	unsigned char *p, *start;
+	unsigned int i;
+	size_t max;
+	int key;
+
+	rec_get_values(rf, smp, cur);
+
+	key = (rf->since_key < 0) || (rf->since_key >= REC_KEYFRAME_INTERVAL);
+	if (rf->map && !key) {
+		/*
+		 * Keep groups of samples small compared to the history,
+		 * so that evicting the oldest ones always makes enough room.
+		 */
+		key = (rf->rh->head - rf->group) > (rf->rh->data_size / RING_GROUP_RATIO);
+	}
+	if (key) {
+		if (rf->map) {
+			/*
+			 * History file: The dictionary starts each group of
+			 * samples (a keyframe and following deltas), so that
+			 * the oldest group can be dropped at any time.
+			 */
+			rec_append_dict(rf, smp);
+			rf->new_group = TRUE;
+		}
+		else {
+			/* Keyframes are decoded on their own: Index them */
+			rec_add_index(rf, smp->realtime, rf->off + rf->buf.len);
+		}
+		rf->since_key = 0;
+		prev = NULL;
+	}
+	rf->since_key++;
+
+	/* Worst case: Two masks per entity, and each field */
+	max = rf->val_nr * VARINT_MAX + (1 + rf->cpu_nr + rf->dev_nr) * 2 * VARINT_MAX;
+	if (rf->enc.size < max) {
+		SREALLOC(rf->enc.buf, char, max);
+		rf->enc.size = max;
+	}
+	start = p = (unsigned char *) rf->enc.buf;
+
+	p = rec_encode_entity(p, cur, prev, REC_NR_HDR_FIELDS);
+	cur += REC_NR_HDR_FIELDS;
+	if (prev) {
+		prev += REC_NR_HDR_FIELDS;
+	}
+	for (i = 0; i < rf->cpu_nr; i++) {
+		p = rec_encode_entity(p, cur, prev, REC_NR_CPU_FIELDS);
+		cur += REC_NR_CPU_FIELDS;
+		if (prev) {
+			prev += REC_NR_CPU_FIELDS;
+		}
+	}
+	for (i = 0; i < (unsigned int) rf->dev_nr; i++) {
+		p = rec_encode_entity(p, cur, prev, REC_NR_IO_FIELDS);
+		cur += REC_NR_IO_FIELDS;
+		if (prev) {
+			prev += REC_NR_IO_FIELDS;
+		}
+	}
+
+	rf->last_rec = rf->buf.len;
+	rec_append_frame(rf, key ? REC_KEYFRAME : REC_DELTA, p - start);
+	rec_append(rf, start, p - start);
+
+	/* Current values are the base of next delta */
+	rf->val_curr ^= 1;
+}
+
+/*
+ * Open a file to record raw stats into. An existing file is truncated.
+ * cpu_nr is the number of stats_cpu structures saved for each sample.
+ * If compress is set, samples are delta encoded.
+ */
+void rec_open(struct rec_file *rf, char *filename, int cpu_nr, int compress)
+{
+	memset(rf, 0, sizeof(struct rec_file));
+	rf->compress = compress;
+	rf->since_key = -1;
+
+	if ((rf->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+		exit(2);
+	}
+	rf->cpu_nr = cpu_nr;
+}
+
+/*
+ * Open a history file: A file of fixed size, mapped in memory, holding
+ * the most recent samples in a circular data area (see record.h).
+ * If the file already exists with the same size and layout, recording
+ * goes on after the samples it contains. Else it is created, and its
+ * blocks are allocated at once so that writing to the mapping never
+ * fails for lack of space.
+ */
+void rec_open_history(struct rec_file *rf, char *filename, int cpu_nr,
+		      unsigned long long size)
+{
+	struct ring_header *rh, hdr;
+	struct stat st;
+	int reuse = FALSE, rc;
+
+	memset(rf, 0, sizeof(struct rec_file));
+	rf->cpu_nr = cpu_nr;
+	rf->compress = TRUE;
+	rf->since_key = -1;
+
+	/* Data area size is a multiple of the header size */
+	size -= size % RING_DATA_OFF;
+	if (size < RING_MIN_SIZE) {
+		size = RING_MIN_SIZE;
+	}
+
+	if ((rf->fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+		exit(2);
+	}
+
+	if (!fstat(rf->fd, &st) && (st.st_size == (off_t) size)) {
+		/* Existing history file: Check that we can go on with it */
+		if ((pread(rf->fd, &hdr, RING_HEADER_SIZE, 0) == RING_HEADER_SIZE) &&
+		    (hdr.fh.magic == REC_MAGIC) &&
+		    (hdr.fh.version == REC_VERSION) &&
+		    (hdr.fh.flags == (REC_F_COMPRESSED | REC_F_HISTORY)) &&
+		    (hdr.fh.rec_hdr_size == RECORD_HEADER_SIZE) &&
+		    (hdr.fh.cpu_size == STATS_CPU_SIZE) &&
+		    (hdr.fh.io_size == IO_STATS_SIZE) &&
+		    (hdr.fh.io_hdr_size == IO_HDR_STATS_SIZE) &&
+		    (hdr.fh.cpu_nr == (unsigned int) cpu_nr) &&
+		    (hdr.data_off == RING_DATA_OFF) &&
+		    (hdr.data_size == size - RING_DATA_OFF) &&
+		    (hdr.head - hdr.tail <= hdr.data_size)) {
+			reuse = TRUE;
+		}
+	}
+	if (!reuse) {
+		if ((ftruncate(rf->fd, 0) < 0) ||
+		    ((rc = posix_fallocate(rf->fd, 0, size)) && (errno = rc))) {
+			fprintf(stderr, "Cannot allocate %s: %s\n", filename, strerror(errno));
+			exit(2);
+		}
+	}
+
+	if ((rf->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			    rf->fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "Cannot map %s: %s\n", filename, strerror(errno));
+		exit(2);
+	}
+	rf->map_size = size;
+	rf->rh = rh = (struct ring_header *) rf->map;
+
+	if (!reuse) {
+		rec_fill_file_header(rf, &rh->fh, 0);
+		rh->data_off = RING_DATA_OFF;
+		rh->data_size = size - RING_DATA_OFF;
+		rh->head = rh->tail = rh->last = 0;
+	}
+	/* The file header is already there */
+	rf->started = TRUE;
+	rf->group = rh->head;
+}
+
+/*
+ * Return the offset of the record following the one at offset off in
+ * the data area of a history file.
+ */
+unsigned long long rec_ring_next(struct ring_header *rh, char *data,
+				 unsigned long long off)
+{
+	unsigned char *p = (unsigned char *) data + off % rh->data_size;
+	unsigned long long len = 0;
+	int shift = 0;
+
+	if (*p == REC_PAD)
+		/* Rest of the data area is unused: Go to its beginning */
+		return off + rh->data_size - off % rh->data_size;
+
+	/* Skip type and length (varint) */
+	for (p++, off++; *p & 0x80; p++, off++, shift += 7) {
+		len |= (unsigned long long) (*p & 0x7f) << shift;
+	}
+	len |= (unsigned long long) *p << shift;
+
+	return off + 1 + len;
+}
+
+/*
+ * Drop the oldest groups of samples from a history file until the data
+ * area can hold everything up to offset end.
+ */
+void rec_ring_evict(struct rec_file *rf, unsigned long long end)
+{
+	struct ring_header *rh = rf->rh;
+	char *data = rf->map + rh->data_off;
+	unsigned long long tail = rh->tail;
+
+	while (end - tail > rh->data_size) {
+		/* Skip the dictionary starting the group, then up to the next one */
+		tail = rec_ring_next(rh, data, tail);
+		while ((tail < rh->head) &&
+		       ((unsigned char) data[tail % rh->data_size] != REC_DICT)) {
+			tail = rec_ring_next(rh, data, tail);
+		}
+		/* Samples are dropped before they are overwritten */
+		__atomic_store_n(&rh->tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * Copy the buffer of records to the data area of a history file.
+ * Records never wrap around the end of the data area: If there is not
+ * enough room left, it is marked as unused and records are written at
+ * the beginning of the area.
+ * The head is moved once the records are complete, so that the last
+ * sample can always be read back, even if the program was killed.
+ * Nothing is synced explicitly: Dirty pages are written back by the kernel.
+ */
+void rec_ring_write(struct rec_file *rf)
+{
+	struct ring_header *rh = rf->rh;
+	char *data = rf->map + rh->data_off;
+	unsigned long long head = rh->head, pos = head % rh->data_size;
+	size_t len = rf->buf.len;
+
+	if (len > rh->data_size / RING_GROUP_RATIO) {
+		fprintf(stderr, "History file is too small for %d devices\n", rf->dev_nr);
+		exit(2);
+	}
+
+	if (len > rh->data_size - pos) {
+		rec_ring_evict(rf, head + (rh->data_size - pos) + len);
+		data[pos] = REC_PAD;
+		head += rh->data_size - pos;
+		pos = 0;
+	}
+	else {
+		rec_ring_evict(rf, head + len);
+	}
+
+	if (rf->new_group) {
+		rf->group = head;
+		rf->new_group = FALSE;
+	}
+
+	memcpy(data + pos, rf->buf.buf, len);
+	rf->buf.len = 0;
+
+	/* Offset of the sample record, which comes last */
+	__atomic_store_n(&rh->last, head + rf->last_rec, __ATOMIC_RELEASE);
+	__atomic_store_n(&rh->head, head + len, __ATOMIC_RELEASE);
+}
+
+/*
+ * Append current snapshot of a sample to the file.
+ * The records it needs (file header, dictionary) are written along with
+ * it in a single write().
+ */
+void rec_write_sample(struct rec_file *rf, struct stats_sample *smp)
+{
+	struct record_header rh;
+	int curr = smp->curr;
+
+	if (rf->fd < 0)
+		return;
+
+	if (!rf->started || (rf->dict_gen != smp->dict_gen) ||
+	    (rf->dev_nr != smp->iodev_nr)) {
+		/* List of devices has changed */
+		if (!rf->map) {
+			rec_append_dict(rf, smp);
+		}
+		rec_set_dict(rf, smp);
+	}
+
+	if (rf->map) {
+		/* Dictionary is saved with each keyframe in a history file */
+		rec_append_compressed(rf, smp);
+		rec_ring_write(rf);
+		return;
+	}
+
+	if (rf->compress) {
+		rec_append_compressed(rf, smp);
+		rec_flush(rf);
+		return;
+	}
+
+	rec_add_index(rf, smp->realtime, rf->off + rf->buf.len);
+
+	memset(&rh, 0, RECORD_HEADER_SIZE);
+	rh.type = REC_SAMPLE;
+	rh.len = STATS_CPU_SIZE * rf->cpu_nr + IO_STATS_SIZE * smp->iodev_nr;
+	rh.realtime = smp->realtime;
+	rh.mono = smp->ts[curr];
+	rh.uptime = smp->uptime[curr];
+	rh.uptime0 = smp->uptime0[curr];
+	rec_append(rf, &rh, RECORD_HEADER_SIZE);
+	rec_append(rf, smp->cpu[curr], STATS_CPU_SIZE * rf->cpu_nr);
+	rec_append(rf, smp->iodev[curr], IO_STATS_SIZE * smp->iodev_nr);
+
+	rec_flush(rf);
+}
+
+/*
+ * Append the index and the trailer, and close the file.
+ */
+void rec_close(struct rec_file *rf)
+{
+	struct record_header rh;
+	struct file_trailer ft;
+
+	if (rf->map) {
+		munmap(rf->map, rf->map_size);
+	}
+	else if (rf->fd >= 0) {
+		if (rf->started) {
+			memset(&ft, 0, FILE_TRAILER_SIZE);
+			ft.index_off = rf->off;
+			ft.index_nr = rf->idx_nr;
+			ft.magic = REC_MAGIC;
+
+			if (rf->compress) {
+				rec_append_frame(rf, REC_INDEX, REC_INDEX_SIZE * rf->idx_nr);
+			}
+			else {
+				memset(&rh, 0, RECORD_HEADER_SIZE);
+				rh.type = REC_INDEX;
+				rh.len = REC_INDEX_SIZE * rf->idx_nr;
+				rec_append(rf, &rh, RECORD_HEADER_SIZE);
+			}
+			rec_append(rf, rf->idx, REC_INDEX_SIZE * rf->idx_nr);
+			rec_append(rf, &ft, FILE_TRAILER_SIZE);
+			rec_flush(rf);
+		}
+	}
+	if (rf->fd >= 0) {
+		close(rf->fd);
+	}
+
+	free(rf->idx);
+	free(rf->buf.buf);
+	free(rf->enc.buf);
+	free(rf->val[0]);
+	free(rf->val[1]);
+	memset(rf, 0, sizeof(struct rec_file));
+	rf->fd = -1;
+}
+
+/*
+ ***************************************************************************
+ * Reading recorded files
+ ***************************************************************************
+ */
+
+/*
+ * Read a varint ending before end.
+ * Return a pointer past its last byte, or NULL if it is truncated.
+ */
+unsigned char *get_varint(unsigned char *p, unsigned char *end,
+			  unsigned long long *v)
+{
+	unsigned long long x = 0;
+	int shift;
+
+	for (shift = 0; (p < end) && (shift < 64); shift += 7) {
+		x |= (unsigned long long) (*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*v = x;
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Decode the nr fields of an entity (see rec_encode_entity()), updating
+ * their previous values in place.
+ * Return a pointer past the last byte read, or NULL if the entity
+ * doesn't end before end.
+ */
+unsigned char *rec_decode_entity(unsigned char *p, unsigned char *end,
+				 unsigned long long *val, int nr)
+{
+	unsigned long long mask, wrap = 0, d;
+	int i;
+
+	if ((p = get_varint(p, end, &mask)) == NULL)
+		return NULL;
+	if ((mask & REC_WRAP_BIT(nr)) && ((p = get_varint(p, end, &wrap)) == NULL))
+		return NULL;
+
+	for (i = 0; i < nr; i++) {
+		if (!(mask & (1ULL << i)))
+			continue;
+		if ((p = get_varint(p, end, &d)) == NULL)
+			return NULL;
+		if (wrap & (1ULL << i)) {
+			/* Counter has wrapped around 32 bits */
+			val[i] = (val[i] + d) & 0xffffffff;
+		}
+		else {
+			val[i] += UNZIGZAG(d);
+		}
+	}
+
+	return p;
+}
+
+/*
+ * Get the record at offset off.
+ * Return its type, or -1 if it is truncated. *p is set to its data
+ * (to its header in a file that is not compressed), *len to the length
+ * of the data and *next to the offset of next record.
+ */
+int rec_get_record(struct rec_reader *rd, unsigned long long off,
+		   unsigned char **p, unsigned long long *len,
+		   unsigned long long *next)
+{
+	struct record_header rh;
+	unsigned char *q, *end;
+	unsigned long long pos;
+	int type;
+
+	if (off >= rd->end)
+		return -1;
+
+	if (!(rd->fh.flags & REC_F_COMPRESSED)) {
+		if (rd->end - off < RECORD_HEADER_SIZE)
+			return -1;
+		memcpy(&rh, rd->map + off, RECORD_HEADER_SIZE);
+		if (rd->end - off - RECORD_HEADER_SIZE < rh.len)
+			return -1;
+		*p = (unsigned char *) rd->map + off;
+		*len = RECORD_HEADER_SIZE + rh.len;
+		*next = off + *len;
+		return rh.type;
+	}
+
+	if (rd->history) {
+		pos = off % rd->rh.data_size;
+		q = (unsigned char *) rd->data + pos;
+		if (*q == REC_PAD) {
+			*len = 0;
+			*next = off + rd->rh.data_size - pos;
+			return REC_PAD;
+		}
+		/* Records never wrap around the end of the data area */
+		end = (unsigned char *) rd->data + rd->rh.data_size;
+	}
+	else {
+		q = (unsigned char *) rd->map + off;
+		end = (unsigned char *) rd->map + rd->end;
+	}
+
+	type = *q;
+	if ((*p = get_varint(q + 1, end, len)) == NULL)
+		return -1;
+	if (((unsigned long long) (end - *p) < *len) ||
+	    (rd->end - off < (unsigned long long) (*p - q) + *len))
+		return -1;
+	*next = off + (*p - q) + *len;
+
+	return type;
+}
+
+/*
+ * Get the offset of the oldest record of a history file that may still
+ * be written to. The writer moves it past records (with release
+ * ordering) before overwriting them: A record read at an offset below
+ * it may have been overwritten while it was being read.
+ */
+unsigned long long rec_ring_tail(struct rec_reader *rd)
+{
+	/* Records read so far are ordered before the tail is loaded */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&((struct ring_header *) rd->map)->tail, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Add a record to the index of a file being read.
+ */
+void rec_read_add_index(struct rec_reader *rd, unsigned long long realtime,
+			unsigned long long offset, unsigned long long dict_off)
+{
+	size_t size;
+
+	if (rd->idx_nr == rd->idx_size) {
+		rd->idx_size = rd->idx_size ? rd->idx_size * 2 : REC_INDEX_INIT;
+		size = REC_INDEX_SIZE * rd->idx_size;
+		SREALLOC(rd->idx, struct rec_index, size);
+	}
+	rd->idx[rd->idx_nr].realtime = realtime;
+	rd->idx[rd->idx_nr].offset = offset;
+	rd->idx[rd->idx_nr].dict_off = dict_off;
+	rd->idx_nr++;
+}
+
+/*
+ * Index a file that has no trailer (or a history file) by going through
+ * its records. The end of the records is set to the first record that
+ * is truncated.
+ */
+void rec_scan_index(struct rec_reader *rd)
+{
+	unsigned long long off, next, len, tail, dict_off = 0;
+	unsigned long long hdr[REC_NR_HDR_FIELDS];
+	struct record_header rh;
+	unsigned char *p;
+	int type;
+
+	for (off = rd->begin; ; off = next) {
+		if ((type = rec_get_record(rd, off, &p, &len, &next)) < 0)
+			break;
+
+		if (rd->history && ((tail = rec_ring_tail(rd)) > off)) {
+			/*
+			 * The writer has dropped the record meanwhile: Start
+			 * again from the oldest group of samples.
+			 */
+			rd->begin = rd->rh.tail = tail;
+			rd->idx_nr = 0;
+			dict_off = 0;
+			next = tail;
+			continue;
+		}
+
+		if (type == REC_DICT) {
+			dict_off = off;
+		}
+		else if (type == REC_SAMPLE) {
+			memcpy(&rh, p, RECORD_HEADER_SIZE);
+			rec_read_add_index(rd, rh.realtime, off, dict_off);
+		}
+		else if (type == REC_KEYFRAME) {
+			/* Time of the sample is the first field of a keyframe */
+			memset(hdr, 0, sizeof(hdr));
+			if (rec_decode_entity(p, p + len, hdr, REC_NR_HDR_FIELDS) == NULL)
+				break;
+			rec_read_add_index(rd, hdr[0], off, dict_off);
+		}
+		else if (type == REC_INDEX)
+			break;
+	}
+	rd->end = off;
+}
+
+/*
+ * Check that the sizes saved in a file header are those of this machine.
+ */
+int rec_check_header(struct file_header *fh)
+{
+	return (fh->magic == REC_MAGIC) &&
+	       (fh->version == REC_VERSION) &&
+	       (fh->rec_hdr_size == RECORD_HEADER_SIZE) &&
+	       (fh->cpu_size == STATS_CPU_SIZE) &&
+	       (fh->io_size == IO_STATS_SIZE) &&
+	       (fh->io_hdr_size == IO_HDR_STATS_SIZE) &&
+	       (fh->cpu_nr > 0);
+}
+
+/*
+ * Open a file of raw stats (of any kind) to read it.
+ * The index saved at the end of the file is used if there is one,
+ * else it is rebuilt.
+ */
+void rec_open_read(struct rec_reader *rd, char *filename)
+{
+	struct file_trailer ft;
+	struct stat st;
+	unsigned long long len, next;
+	unsigned char *p;
+
+	memset(rd, 0, sizeof(struct rec_reader));
+
+	if ((rd->fd = open(filename, O_RDONLY)) < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+		exit(2);
+	}
+	if (fstat(rd->fd, &st) < 0) {
+		fprintf(stderr, "Cannot stat %s: %s\n", filename, strerror(errno));
+		exit(2);
+	}
+	if ((size_t) st.st_size < FILE_HEADER_SIZE) {
+		fprintf(stderr, "Invalid file of raw stats: %s\n", filename);
+		exit(2);
+	}
+
+	rd->map_size = st.st_size;
+	if ((rd->map = mmap(NULL, rd->map_size, PROT_READ, MAP_SHARED,
+			    rd->fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "Cannot map %s: %s\n", filename, strerror(errno));
+		exit(2);
+	}
+	memcpy(&rd->fh, rd->map, FILE_HEADER_SIZE);
+
+	if (!rec_check_header(&rd->fh)) {
+		fprintf(stderr, "Invalid file of raw stats: %s\n", filename);
+		exit(2);
+	}
+
+	if (rd->fh.flags & REC_F_HISTORY) {
+		/* Samples may still be appended: Read those recorded so far */
+		memcpy(&rd->rh, rd->map, RING_HEADER_SIZE);
+		rd->rh.tail = __atomic_load_n(&((struct ring_header *) rd->map)->tail,
+					      __ATOMIC_ACQUIRE);
+		rd->rh.head = __atomic_load_n(&((struct ring_header *) rd->map)->head,
+					      __ATOMIC_ACQUIRE);
+		if ((rd->rh.data_off + rd->rh.data_size != rd->map_size) ||
+		    !rd->rh.data_size || (rd->rh.head - rd->rh.tail > rd->rh.data_size)) {
+			fprintf(stderr, "Invalid history file: %s\n", filename);
+			exit(2);
+		}
+		rd->history = TRUE;
+		rd->data = rd->map + rd->rh.data_off;
+		rd->begin = rd->rh.tail;
+		rd->end = rd->rh.head;
+		rec_scan_index(rd);
+		return;
+	}
+
+	rd->begin = FILE_HEADER_SIZE + IO_HDR_STATS_SIZE * (unsigned long long) rd->fh.dev_nr;
+	rd->end = rd->map_size;
+	if (rd->begin > rd->end) {
+		fprintf(stderr, "Invalid file of raw stats: %s\n", filename);
+		exit(2);
+	}
+
+	if (rd->map_size >= rd->begin + FILE_TRAILER_SIZE) {
+		memcpy(&ft, rd->map + rd->map_size - FILE_TRAILER_SIZE, FILE_TRAILER_SIZE);
+		rd->end = rd->map_size - FILE_TRAILER_SIZE;
+		if ((ft.magic == REC_MAGIC) && (ft.index_off >= rd->begin) &&
+		    (rec_get_record(rd, ft.index_off, &p, &len, &next) == REC_INDEX) &&
+		    (next == rd->end)) {
+			/* Use the index saved in the file */
+			if (!(rd->fh.flags & REC_F_COMPRESSED)) {
+				p += RECORD_HEADER_SIZE;
+				len -= RECORD_HEADER_SIZE;
+			}
+			if (len == REC_INDEX_SIZE * (unsigned long long) ft.index_nr) {
+				rd->idx_nr = rd->idx_size = ft.index_nr;
+				SREALLOC(rd->idx, struct rec_index, len ? len : 1);
+				memcpy(rd->idx, p, len);
+				rd->end = ft.index_off;
+				return;
+			}
+		}
+		rd->end = rd->map_size;
+	}
+
+	/* Recording was interrupted */
+	rec_scan_index(rd);
+}
+
+/*
+ * Close a file of raw stats being read.
+ */
+void rec_close_read(struct rec_reader *rd)
+{
+	munmap(rd->map, rd->map_size);
+	close(rd->fd);
+	free(rd->idx);
+	memset(rd, 0, sizeof(struct rec_reader));
+	rd->fd = -1;
+}
+
+/*
+ * Return the number of the last index entry of a file being read whose
+ * sample was taken at or before realtime (0 if there is none).
+ */
+unsigned int rec_find_index(struct rec_reader *rd, unsigned long long realtime)
+{
+	unsigned int lo = 0, hi = rd->idx_nr, mid;
+
+	/* Entries are sorted: Find the first one after realtime */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (rd->idx[mid].realtime <= realtime) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	return lo ? lo - 1 : 0;
+}
+
+/*
+ * Initialize a cursor to read a file.
+ */
+void rec_init_cursor(struct rec_cursor *cur, struct rec_reader *rd)
+{
+	int i;
+
+	memset(cur, 0, sizeof(struct rec_cursor));
+	cur->rd = rd;
+	for (i = 0; i < 2; i++) {
+		if ((cur->smp.cpu[i] =
+		     (struct stats_cpu *) calloc(rd->fh.cpu_nr, STATS_CPU_SIZE)) == NULL) {
+			perror("malloc");
+			exit(4);
+		}
+	}
+}
+
+/*
+ * Free the buffers of a cursor.
+ */
+void rec_free_cursor(struct rec_cursor *cur)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		free(cur->smp.cpu[i]);
+		free(cur->smp.iodev[i]);
+	}
+	free(cur->smp.hdr);
+	free(cur->val);
+	memset(cur, 0, sizeof(struct rec_cursor));
+}
+
+/*
+ * Make a dictionary of dev_nr devices the one of the samples read next.
+ * Stats of the last sample read are moved to the slots of the devices
+ * in the new dictionary, so that next sample can be compared with it.
+ */
+void rec_read_dict(struct rec_cursor *cur, unsigned char *p, int dev_nr)
+{
+	struct stats_sample *smp = &cur->smp;
+	struct io_hdr_stats *hdr;
+	struct io_stats *iodev[2];
+	size_t size;
+	int i, j, k = 0;
+
+	if (smp->hdr && (dev_nr == smp->iodev_nr) &&
+	    !memcmp(smp->hdr, p, IO_HDR_STATS_SIZE * dev_nr))
+		/* Same dictionary (e.g. at the beginning of a group of samples) */
+		return;
+
+	size = IO_HDR_STATS_SIZE * dev_nr;
+	if ((hdr = (struct io_hdr_stats *) malloc(size ? size : 1)) == NULL) {
+		perror("malloc");
+		exit(4);
+	}
+	memcpy(hdr, p, size);
+	for (i = 0; i < 2; i++) {
+		if ((iodev[i] = (struct io_stats *) calloc(dev_nr ? dev_nr : 1,
+							   IO_STATS_SIZE)) == NULL) {
+			perror("malloc");
+			exit(4);
+		}
+	}
+
+	for (i = 0; i < dev_nr; i++) {
+		if (!hdr[i].used)
+			continue;
+		/* Devices are usually in the same order: Search from last match */
+		for (j = 0; j < smp->iodev_nr; j++, k = (k + 1) % smp->iodev_nr) {
+			if (smp->hdr[k].used && !strcmp(smp->hdr[k].name, hdr[i].name)) {
+				iodev[smp->curr][i] = smp->iodev[smp->curr][k];
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		free(smp->iodev[i]);
+		smp->iodev[i] = iodev[i];
+	}
+	free(smp->hdr);
+	smp->hdr = hdr;
+	smp->iodev_nr = smp->iodev_alloc = dev_nr;
+	smp->dict_gen++;
+
+	if (cur->rd->fh.flags & REC_F_COMPRESSED) {
+		/* Values are laid out differently: Next sample is a keyframe */
+		cur->val_nr = REC_NR_HDR_FIELDS +
+			      REC_NR_CPU_FIELDS * cur->rd->fh.cpu_nr +
+			      REC_NR_IO_FIELDS * dev_nr;
+		size = sizeof(unsigned long long) * cur->val_nr;
+		SREALLOC(cur->val, unsigned long long, size);
+	}
+}
+
+/*
+ * Make the decoded values of a compressed sample its current snapshot
+ * (see rec_get_values()).
+ */
+void rec_set_values(struct rec_cursor *cur, unsigned long long *v)
+{
+	struct stats_sample *smp = &cur->smp;
+	struct stats_cpu *sc = smp->cpu[smp->curr];
+	struct io_stats *si = smp->iodev[smp->curr];
+	unsigned int i;
+
+	smp->realtime = *v++;
+	smp->ts[smp->curr] = *v++;
+	smp->uptime[smp->curr] = *v++;
+	smp->uptime0[smp->curr] = *v++;
+
+	for (i = 0; i < cur->rd->fh.cpu_nr; i++, sc++) {
+		sc->cpu_user       = *v++;
+		sc->cpu_nice       = *v++;
+		sc->cpu_sys        = *v++;
+		sc->cpu_idle       = *v++;
+		sc->cpu_iowait     = *v++;
+		sc->cpu_steal      = *v++;
+		sc->cpu_hardirq    = *v++;
+		sc->cpu_softirq    = *v++;
+		sc->cpu_guest      = *v++;
+		sc->cpu_guest_nice = *v++;
+	}
+
+	for (i = 0; i < (unsigned int) smp->iodev_nr; i++, si++) {
+		si->rd_sectors = *v++;
+		si->wr_sectors = *v++;
+		si->rd_ios     = *v++;
+		si->rd_merges  = *v++;
+		si->wr_ios     = *v++;
+		si->wr_merges  = *v++;
+		si->rd_ticks   = *v++;
+		si->wr_ticks   = *v++;
+		si->ios_pgr    = *v++;
+		si->tot_ticks  = *v++;
+		si->rq_ticks   = *v++;
+	}
+}
+
+/*
+ * Decode a compressed sample into the values of the cursor.
+ * Return 0 if the record is invalid.
+ */
+int rec_decode_sample(struct rec_cursor *cur, unsigned char *p,
+		      unsigned char *end)
+{
+	unsigned long long *v = cur->val;
+	unsigned int i, n;
+
+	p = rec_decode_entity(p, end, v, REC_NR_HDR_FIELDS);
+	v += REC_NR_HDR_FIELDS;
+	for (i = 0; p && (i < cur->rd->fh.cpu_nr); i++) {
+		p = rec_decode_entity(p, end, v, REC_NR_CPU_FIELDS);
+		v += REC_NR_CPU_FIELDS;
+	}
+	n = cur->smp.iodev_nr;
+	for (i = 0; p && (i < n); i++) {
+		p = rec_decode_entity(p, end, v, REC_NR_IO_FIELDS);
+		v += REC_NR_IO_FIELDS;
+	}
+
+	return p != NULL;
+}
+
+/*
+ * Position a cursor on entry i of the index.
+ * The sample read next is compared with a sample of zeros (stats since
+ * boot) until another sample has been read.
+ * Return 1 on success, or 0 if the dictionary of the entry can't be read
+ * (the group of samples has been dropped from a history file since the
+ * index was built): There is no data left to read then.
+ */
+int rec_seek(struct rec_cursor *cur, unsigned int i)
+{
+	struct rec_reader *rd = cur->rd;
+	struct rec_index *e = rd->idx + i;
+	unsigned long long len, next, tail;
+	unsigned char *p;
+	int j;
+
+	if (!rd->history && !e->dict_off) {
+		/* Dictionary following the file header */
+		rec_read_dict(cur, (unsigned char *) rd->map + FILE_HEADER_SIZE,
+			      rd->fh.dev_nr);
+	}
+	else {
+		if (rd->history &&
+		    (((tail = rec_ring_tail(rd)) > e->dict_off) || (tail > e->offset)))
+			/* Group of samples dropped since the index was built */
+			return 0;
+		if (rec_get_record(rd, e->dict_off, &p, &len, &next) != REC_DICT)
+			return 0;
+		if (!(rd->fh.flags & REC_F_COMPRESSED)) {
+			p += RECORD_HEADER_SIZE;
+			len -= RECORD_HEADER_SIZE;
+		}
+		if (len % IO_HDR_STATS_SIZE)
+			return 0;
+		rec_read_dict(cur, p, len / IO_HDR_STATS_SIZE);
+		if (rd->history && (rec_ring_tail(rd) > e->dict_off))
+			/* Dictionary dropped while it was being read */
+			return 0;
+	}
+
+	for (j = 0; j < 2; j++) {
+		memset(cur->smp.cpu[j], 0, STATS_CPU_SIZE * rd->fh.cpu_nr);
+		memset(cur->smp.iodev[j], 0, IO_STATS_SIZE * cur->smp.iodev_nr);
+		cur->smp.uptime[j] = cur->smp.uptime0[j] = cur->smp.ts[j] = 0;
+	}
+	cur->off = e->offset;
+	cur->nr = 0;
+
+	return 1;
+}
+
+/*
+ * Read next sample, if its record starts at or before offset end.
+ * It becomes the current snapshot of the sample of the cursor, and the
+ * sample read before becomes the previous one.
+ * Return 1 if a sample has been read, 0 at the end of the records.
+ */
+int rec_read_sample(struct rec_cursor *cur, unsigned long long end)
+{
+	struct rec_reader *rd = cur->rd;
+	struct stats_sample *smp = &cur->smp;
+	struct record_header rh;
+	unsigned long long len, next;
+	unsigned char *p;
+	size_t size;
+	time_t t;
+	int type, read = FALSE;
+
+	for (; !read && (cur->off <= end); cur->off = next) {
+		if ((type = rec_get_record(rd, cur->off, &p, &len, &next)) < 0)
+			return 0;
+
+		switch (type) {
+
+		case REC_DICT:
+			if (!(rd->fh.flags & REC_F_COMPRESSED)) {
+				p += RECORD_HEADER_SIZE;
+				len -= RECORD_HEADER_SIZE;
+			}
+			if (len % IO_HDR_STATS_SIZE)
+				return 0;
+			rec_read_dict(cur, p, len / IO_HDR_STATS_SIZE);
+			break;
+
+		case REC_SAMPLE:
+			size = STATS_CPU_SIZE * rd->fh.cpu_nr + IO_STATS_SIZE * smp->iodev_nr;
+			if (len != RECORD_HEADER_SIZE + size)
+				return 0;
+			smp->curr ^= 1;
+			memcpy(&rh, p, RECORD_HEADER_SIZE);
+			p += RECORD_HEADER_SIZE;
+			memcpy(smp->cpu[smp->curr], p, STATS_CPU_SIZE * rd->fh.cpu_nr);
+			p += STATS_CPU_SIZE * rd->fh.cpu_nr;
+			memcpy(smp->iodev[smp->curr], p, IO_STATS_SIZE * smp->iodev_nr);
+			smp->realtime = rh.realtime;
+			smp->ts[smp->curr] = rh.mono;
+			smp->uptime[smp->curr] = rh.uptime;
+			smp->uptime0[smp->curr] = rh.uptime0;
+			read = TRUE;
+			break;
+
+		case REC_KEYFRAME:
+			if (!cur->val)
+				/* No dictionary read yet */
+				return 0;
+			memset(cur->val, 0, sizeof(unsigned long long) * cur->val_nr);
+			/* Fall through */
+		case REC_DELTA:
+			if (!cur->val || !rec_decode_sample(cur, p, p + len))
+				return 0;
+			smp->curr ^= 1;
+			rec_set_values(cur, cur->val);
+			read = TRUE;
+			break;
+
+		case REC_INDEX:
+			return 0;
+		}
+
+		if (rd->history && (rec_ring_tail(rd) > cur->off))
+			/*
+			 * Record has been dropped by the writer while it was
+			 * being decoded: What was read may be overwritten data.
+			 */
+			return 0;
+	}
+	if (!read)
+		return 0;
+
+	cur->nr++;
+	t = smp->realtime / 1000000000ULL;
+	localtime_r(&t, &smp->rectime);
+
+	return 1;
+}
@@ -0,0 +1,322 @@
+/*
+ * record.h: Binary files of raw stats recorded by SimpleStat
+ */
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <pthread.h>
+
+#include "iostat.h"
+#include "rd_stats.h"
+
+/*
+ * A file of raw stats starts with a file header, followed by the device
+ * dictionary (the io_hdr_stats structures of all the slots of the device
+ * tables, used or not).
+ * Then each interval is appended as a sample record: A record header,
+ * the stats_cpu structures of CPU "all" and of every CPU, and the
+ * io_stats structures of every slot of the dictionary, in the same order.
+ * When the list of devices changes, a dictionary record containing the
+ * new dictionary is appended before the next sample record.
+ * When the file is closed, an index record listing the timestamp and
+ * offset of every sample record, and the offset of the dictionary in
+ * effect for it, is appended, followed by the file trailer.
+ * A file without a trailer (e.g. recording was interrupted) can still be
+ * read sequentially.
+ * Structures are written as they are in memory: Sizes saved in the file
+ * header tell whether a file can be read on a given machine.
+ *
+ * In a compressed file (REC_F_COMPRESSED set in the file header), each
+ * record following the dictionary is a one-byte type and its length
+ * (varint), followed by its data. Samples are saved as keyframes or
+ * deltas. Values of a sample are split into entities: the record header
+ * fields, each stats_cpu structure and each io_stats structure. Each
+ * entity is encoded as:
+ * - a varint mask of the fields that differ from the previous sample.
+ *   If bit REC_WRAP_BIT(nr_fields) is set, a varint mask of the fields
+ *   that have wrapped around 32 bits follows;
+ * - for each field of the mask: a varint containing the difference with
+ *   the previous value, modulo 2^32 for fields that have wrapped, else
+ *   zigzag encoded.
+ * A keyframe is encoded the same way against a previous sample of zeros.
+ * Keyframes are saved every REC_KEYFRAME_INTERVAL samples and after
+ * each dictionary record: Only keyframes are listed in the index.
+ *
+ * A history file (REC_F_HISTORY) has a fixed size and keeps only the
+ * most recent samples. It starts with a ring header, and records of a
+ * compressed file are written in a circular data area beginning at
+ * RING_DATA_OFF. Offsets in the ring header always increase: Their value
+ * modulo the size of the data area is the position in the data area.
+ * Each group of samples (a keyframe and following deltas) starts with a
+ * dictionary record, so that the oldest group can be dropped to make
+ * room for new samples, and reading can start at any group.
+ * A record never wraps around the end of the data area: A REC_PAD type
+ * byte marks the end of the area as unused when the next record
+ * doesn't fit in it. There is no index: Readers rebuild it from the
+ * records (as they do for a file without a trailer).
+ * The file may be read while it is written: The tail is moved past a
+ * group before the group is overwritten, and readers load it again after
+ * each record, to drop records older than the tail.
+ */
+
+#define REC_MAGIC	0x53535246	/* "SSRF" */
+#define REC_VERSION	2
+
+/* Record types */
+#define REC_SAMPLE	1
+#define REC_DICT	2
+#define REC_INDEX	3
+#define REC_KEYFRAME	4	/* Compressed files only */
+#define REC_DELTA	5	/* Compressed files only */
+#define REC_PAD		6	/* History files only */
+
+/* File header flags */
+#define REC_F_COMPRESSED	0x01
+#define REC_F_HISTORY		0x02
+
+/* Number of fields of each entity of a compressed sample */
+#define REC_NR_HDR_FIELDS	4
+#define REC_NR_CPU_FIELDS	10
+#define REC_NR_IO_FIELDS	11
+
+#define REC_WRAP_BIT(nr)	(1U << (nr))
+
+/* Number of samples between two keyframes */
+#define REC_KEYFRAME_INTERVAL	60
+
+/* Maximum size of a varint (64-bit value) */
+#define VARINT_MAX	10
+
+/* Map signed differences to unsigned values, small in absolute value */
+#define ZIGZAG(v)	(((unsigned long long) (v) << 1) ^ \
+			 (unsigned long long) ((long long) (v) >> 63))
+#define UNZIGZAG(v)	(((v) >> 1) ^ (0ULL - ((v) & 1)))
+
+struct file_header {
+	unsigned int magic;
+	unsigned int version;
+	/* Size of the structures saved in the file */
+	unsigned int rec_hdr_size;
+	unsigned int cpu_size;
+	unsigned int io_size;
+	unsigned int io_hdr_size;
+	/* Number of stats_cpu structures in a sample (CPU "all" included) */
+	unsigned int cpu_nr;
+	/* Number of io_hdr_stats structures following this header */
+	unsigned int dev_nr;
+	/* Number of ticks per second */
+	unsigned int hz;
+	unsigned int flags;
+	/* Time at which the file was created (ns since the Epoch) */
+	unsigned long long start;
+};
+
+#define FILE_HEADER_SIZE	(sizeof(struct file_header))
+
+struct record_header {
+	unsigned int type;
+	/* Number of bytes following the header */
+	unsigned int len;
+	/* Time at which the snapshot was taken (ns since the Epoch) */
+	unsigned long long realtime;
+	/* Same time on CLOCK_MONOTONIC_RAW (ns) */
+	unsigned long long mono;
+	/* Uptime (in jiffies), total and for one processor */
+	unsigned long long uptime;
+	unsigned long long uptime0;
+};
+
+#define RECORD_HEADER_SIZE	(sizeof(struct record_header))
+
+/* Entry of the index record */
+struct rec_index {
+	unsigned long long realtime;
+	unsigned long long offset;
+	/*
+	 * Offset of the dictionary record in effect for this sample
+	 * (0: the dictionary following the file header)
+	 */
+	unsigned long long dict_off;
+};
+
+#define REC_INDEX_SIZE	(sizeof(struct rec_index))
+
+struct file_trailer {
+	/* Offset of the index record */
+	unsigned long long index_off;
+	unsigned int index_nr;
+	unsigned int magic;
+};
+
+#define FILE_TRAILER_SIZE	(sizeof(struct file_trailer))
+
+/* Header of a history file */
+struct ring_header {
+	struct file_header fh;
+	/* Offset and size of the data area in the file */
+	unsigned long long data_off;
+	unsigned long long data_size;
+	/* Offset at which next record will be written */
+	unsigned long long head;
+	/* Offset of the oldest record (a dictionary record) */
+	unsigned long long tail;
+	/* Offset of the last sample record */
+	unsigned long long last;
+};
+
+#define RING_HEADER_SIZE	(sizeof(struct ring_header))
+
+#define RING_DATA_OFF	4096
+#define RING_MIN_SIZE	(1024 * 1024)
+/* Size of a group of samples is kept below data area size / RING_GROUP_RATIO */
+#define RING_GROUP_RATIO	4
+
+/* A file being recorded */
+struct rec_file {
+	int fd;
+	/* Records to be appended with next write() */
+	struct out_buf buf;
+	/* Offset at which next write() will take place */
+	unsigned long long off;
+	/* Number of stats_cpu structures in a sample */
+	unsigned int cpu_nr;
+	/* Number of devices in the dictionary in effect */
+	int dev_nr;
+	/* Offset of the dictionary in effect (see struct rec_index) */
+	unsigned long long dict_off;
+	/* Generation of the dictionary in effect (see struct stats_sample) */
+	unsigned int dict_gen;
+	/* Set when the file header has been written */
+	int started;
+	/* Set when samples are delta encoded (REC_F_COMPRESSED) */
+	int compress;
+	/* Values of current and previous samples (compressed files) */
+	unsigned long long *val[2];
+	size_t val_nr;
+	int val_curr;
+	/* Number of samples since last keyframe (-1: next one is a keyframe) */
+	int since_key;
+	/* Buffer in which a compressed sample is encoded */
+	struct out_buf enc;
+	/* Offset of the sample record in the buffer of records */
+	size_t last_rec;
+	/* History file mapping (NULL if not a history file) */
+	char *map;
+	size_t map_size;
+	struct ring_header *rh;
+	/* Offset of the current group of samples */
+	unsigned long long group;
+	/* Set when the buffer of records starts a new group */
+	int new_group;
+	/* Index of the sample records */
+	struct rec_index *idx;
+	unsigned int idx_nr;
+	unsigned int idx_size;
+};
+
+#define REC_INDEX_INIT	1024
+
+/* A file of raw stats being read */
+struct rec_reader {
+	int fd;
+	/* The whole file is mapped read-only */
+	char *map;
+	size_t map_size;
+	struct file_header fh;
+	/* History file: Copy of the ring header, and the data area */
+	int history;
+	struct ring_header rh;
+	char *data;
+	/* Offsets of the first record and of the end of the records */
+	unsigned long long begin;
+	unsigned long long end;
+	/*
+	 * Records decoding may start at: Every sample of a file that is
+	 * not compressed, else every keyframe.
+	 */
+	struct rec_index *idx;
+	unsigned int idx_nr;
+	unsigned int idx_size;
+};
+
+/*
+ * Position in a file being read. Cursors are independent of each other:
+ * Several threads may read the same file with their own cursor.
+ */
+struct rec_cursor {
+	struct rec_reader *rd;
+	/* Offset of next record */
+	unsigned long long off;
+	/* Values of last sample decoded (compressed files) */
+	unsigned long long *val;
+	size_t val_nr;
+	/* Last sample and the one before (both owned by the cursor) */
+	struct stats_sample smp;
+	/* Number of samples read since last seek */
+	unsigned long long nr;
+};
+
+/* Reports of a chunk of samples being replayed */
+struct replay_slot {
+	struct out_buf out;
+	/* Set when the chunk has been displayed into out */
+	int done;
+};
+
+/*
+ * Replay of a recorded file. Samples are split into chunks of step
+ * index entries, which are decoded and displayed by several threads.
+ * The reports of a chunk are kept in a slot until those of every chunk
+ * before it have been written, so that they come out in order. There
+ * are slot_nr slots: A thread doesn't start a chunk more than slot_nr
+ * chunks ahead of the one to be written next.
+ */
+struct replay {
+	struct rec_reader rd;
+	/* Index entries to replay: [first, last[ */
+	unsigned int first;
+	unsigned int last;
+	unsigned int step;
+	unsigned int chunk_nr;
+	/* Next chunk to be decoded, and number of chunks written so far */
+	unsigned int next;
+	unsigned int written;
+	struct replay_slot *slot;
+	unsigned int slot_nr;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+#define REPLAY_SLOTS_PER_JOB	2
+
+/*
+ ***************************************************************************
+ * Functions prototypes
+ ***************************************************************************
+ */
+
+extern void
+	rec_close(struct rec_file *);
+extern void
+	rec_open(struct rec_file *, char *, int, int);
+extern void
+	rec_open_history(struct rec_file *, char *, int, unsigned long long);
+extern void
+	rec_write_sample(struct rec_file *, struct stats_sample *);
+extern void
+	rec_open_read(struct rec_reader *, char *);
+extern void
+	rec_close_read(struct rec_reader *);
+extern unsigned int
+	rec_find_index(struct rec_reader *, unsigned long long);
+extern void
+	rec_init_cursor(struct rec_cursor *, struct rec_reader *);
+extern void
+	rec_free_cursor(struct rec_cursor *);
+extern int
+	rec_seek(struct rec_cursor *, unsigned int);
+extern int
+	rec_read_sample(struct rec_cursor *, unsigned long long);
+
+#endif  /* _RECORD_H */
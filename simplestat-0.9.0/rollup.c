@@ -0,0 +1,362 @@
+/*
+ * rollup.c: Summarize stats over minutes and hours while recording (see rollup.h)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "iostat.h"
+#include "common.h"
+#include "query.h"
+#include "rollup.h"
+
+/* Time span of the buckets of each level (in seconds) */
+static const unsigned int ru_span[NR_RU_LEVELS] = {60, 3600};
+static char *ru_suffix[NR_RU_LEVELS] = {RU_SUFFIX_MIN, RU_SUFFIX_HOUR};
+
+/*
+ * Append data to the buffer of records of a level.
+ */
+void ru_append(struct ru_level *rl, void *data, size_t len)
+{
+	size_t size;
+
+	if (rl->buf.len + len > rl->buf.size) {
+		size = rl->buf.size ? rl->buf.size : OUT_BUF_SIZE;
+		while (size < rl->buf.len + len) {
+			size <<= 1;
+		}
+		SREALLOC(rl->buf.buf, char, size);
+		rl->buf.size = size;
+	}
+	memcpy(rl->buf.buf + rl->buf.len, data, len);
+	rl->buf.len += len;
+}
+
+/*
+ * Write the buffer of records of a level at the end of its file.
+ * Rollups of the level stop if the file cannot be written.
+ */
+void ru_flush(struct ru_level *rl)
+{
+	char *p = rl->buf.buf;
+	size_t len = rl->buf.len;
+	ssize_t n;
+
+	rl->buf.len = 0;
+	if (rl->fd < 0)
+		return;
+
+	while (len > 0) {
+		if ((n = write(rl->fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Cannot write rollup: %s\n", strerror(errno));
+			close(rl->fd);
+			rl->fd = -1;
+			return;
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+/*
+ * Create the rollup files of a recorded file.
+ */
+void ru_open(struct rollup *ru, char *filename, int cpu_nr)
+{
+	struct ru_level *rl;
+	struct ru_header rh;
+	char name[MAX_FILE_LEN];
+	int l;
+
+	memset(ru, 0, sizeof(struct rollup));
+	ru->cpu_nr = cpu_nr;
+
+	for (l = 0, rl = ru->lvl; l < NR_RU_LEVELS; l++, rl++) {
+		snprintf(name, sizeof(name), "%s%s", filename, ru_suffix[l]);
+		if ((rl->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+			fprintf(stderr, "Cannot open %s: %s\n", name, strerror(errno));
+			exit(2);
+		}
+		if ((rl->cpu = (struct ru_cpu *) calloc(cpu_nr, RU_CPU_SIZE)) == NULL) {
+			perror("malloc");
+			exit(4);
+		}
+		rl->span = (unsigned long long) ru_span[l] * NSEC_PER_SEC;
+
+		memset(&rh, 0, RU_HEADER_SIZE);
+		rh.magic = RU_MAGIC;
+		rh.version = RU_VERSION;
+		rh.span = ru_span[l];
+		rh.cpu_nr = cpu_nr;
+		rh.cpu_metric_nr = NR_CPU_PCT;
+		rh.metric_nr = NR_XR_COLS;
+		ru_append(rl, &rh, RU_HEADER_SIZE);
+		ru_flush(rl);
+	}
+}
+
+/*
+ * Make room in the bucket of a level for every device name known so far.
+ */
+void ru_reserve_dev(struct rollup *ru, struct ru_level *rl)
+{
+	size_t size;
+
+	if (rl->dev_size >= ru->names.name_size)
+		return;
+
+	size = QIX_DEV_SIZE * ru->names.name_size;
+	SREALLOC(rl->dev, struct qix_dev, size);
+	size = sizeof(int) * ru->names.name_size;
+	SREALLOC(rl->touched, int, size);
+	for (; rl->dev_size < ru->names.name_size; rl->dev_size++) {
+		rl->dev[rl->dev_size].count = 0;
+	}
+}
+
+/*
+ * Return the summary of device name n in the bucket of a level,
+ * adding the device to the bucket if it isn't there yet.
+ */
+struct qix_dev *ru_get_dev(struct ru_level *rl, int n)
+{
+	struct qix_dev *qd = rl->dev + n;
+	int c;
+
+	if (!qd->count) {
+		for (c = 0; c < NR_XR_COLS; c++) {
+			qd->sum[c] = 0;
+		}
+		qd->name = n;
+		rl->touched[rl->bkt.dev_nr++] = n;
+	}
+
+	return qd;
+}
+
+/*
+ * Add the utilization of a CPU during a sample to its summary.
+ */
+void ru_add_cpu(struct ru_cpu *rc, double *v)
+{
+	int c;
+
+	for (c = 0; c < NR_CPU_PCT; c++) {
+		if (!rc->count || (v[c] < rc->min[c])) {
+			rc->min[c] = v[c];
+		}
+		if (!rc->count || (v[c] > rc->max[c])) {
+			rc->max[c] = v[c];
+		}
+		rc->sum[c] += v[c];
+	}
+	rc->count++;
+}
+
+/*
+ * Add a CPU summary to another one.
+ */
+void ru_add_cpu_summary(struct ru_cpu *rc, struct ru_cpu *rs)
+{
+	int c;
+
+	if (!rs->count)
+		return;
+
+	for (c = 0; c < NR_CPU_PCT; c++) {
+		if (!rc->count || (rs->min[c] < rc->min[c])) {
+			rc->min[c] = rs->min[c];
+		}
+		if (!rc->count || (rs->max[c] > rc->max[c])) {
+			rc->max[c] = rs->max[c];
+		}
+		rc->sum[c] += rs->sum[c];
+	}
+	rc->count += rs->count;
+}
+
+/*
+ * Add the bucket of a level to the bucket of the level above.
+ */
+void ru_merge_bucket(struct rollup *ru, struct ru_level *up, struct ru_level *rl)
+{
+	unsigned int i;
+	int n;
+
+	if (!up->bkt.sample_nr) {
+		up->bkt.first = rl->bkt.first;
+	}
+	up->bkt.last = rl->bkt.last;
+	up->bkt.sample_nr += rl->bkt.sample_nr;
+
+	for (i = 0; i < ru->cpu_nr; i++) {
+		ru_add_cpu_summary(up->cpu + i, rl->cpu + i);
+	}
+
+	ru_reserve_dev(ru, up);
+	for (i = 0; i < rl->bkt.dev_nr; i++) {
+		n = rl->touched[i];
+		qix_add_summary(ru_get_dev(up, n), rl->dev + n);
+	}
+}
+
+/*
+ * Append the bucket of a level to its file, and start a new one.
+ */
+void ru_write_bucket(struct rollup *ru, struct ru_level *rl)
+{
+	struct ru_record rr;
+	unsigned int i;
+
+	if (ru->names.hdr.name_nr > rl->name_nr) {
+		/* Devices seen for the first time since last bucket */
+		rr.type = RU_NAMES;
+		rr.len = QIX_NAME_SIZE * (ru->names.hdr.name_nr - rl->name_nr);
+		ru_append(rl, &rr, RU_RECORD_SIZE);
+		ru_append(rl, ru->names.name + rl->name_nr, rr.len);
+		rl->name_nr = ru->names.hdr.name_nr;
+	}
+
+	rr.type = RU_BUCKET;
+	rr.len = RU_BUCKET_SIZE + RU_CPU_SIZE * ru->cpu_nr + QIX_DEV_SIZE * rl->bkt.dev_nr;
+	ru_append(rl, &rr, RU_RECORD_SIZE);
+	ru_append(rl, &rl->bkt, RU_BUCKET_SIZE);
+	ru_append(rl, rl->cpu, RU_CPU_SIZE * ru->cpu_nr);
+
+	/* Device summaries are sorted by name number */
+	qsort(rl->touched, rl->bkt.dev_nr, sizeof(int), qix_cmp_int);
+	for (i = 0; i < rl->bkt.dev_nr; i++) {
+		ru_append(rl, rl->dev + rl->touched[i], QIX_DEV_SIZE);
+		rl->dev[rl->touched[i]].count = 0;
+	}
+	ru_flush(rl);
+
+	memset(&rl->bkt, 0, RU_BUCKET_SIZE);
+	memset(rl->cpu, 0, RU_CPU_SIZE * ru->cpu_nr);
+}
+
+/*
+ * Close the bucket of level l: Add it to the bucket of the level above
+ * (closing that one first if it belongs to another time span), then
+ * save it.
+ */
+void ru_close_bucket(struct rollup *ru, int l)
+{
+	struct ru_level *rl = ru->lvl + l, *up;
+
+	if (!rl->bkt.sample_nr)
+		return;
+
+	if (l + 1 < NR_RU_LEVELS) {
+		up = rl + 1;
+		if (up->bkt.sample_nr &&
+		    (up->bkt.first / up->span != rl->bkt.first / up->span)) {
+			ru_close_bucket(ru, l + 1);
+		}
+		ru_merge_bucket(ru, up, rl);
+	}
+	ru_write_bucket(ru, rl);
+}
+
+/*
+ * Update the name numbers of the slots of the dictionary in effect,
+ * if it has changed since last sample.
+ */
+void ru_map_slots(struct rollup *ru, struct stats_sample *smp)
+{
+	size_t size;
+	int i;
+
+	if (ru->slot_name && (ru->dict_gen == smp->dict_gen))
+		return;
+
+	size = sizeof(int) * (smp->iodev_nr + 1);
+	SREALLOC(ru->slot_name, int, size);
+	for (i = 0; i < smp->iodev_nr; i++) {
+		ru->slot_name[i] = smp->hdr[i].used ? qix_name(&ru->names, smp->hdr[i].name, TRUE) : -1;
+	}
+	ru->dict_gen = smp->dict_gen;
+}
+
+/*
+ * Add the stats of a sample to the minute bucket.
+ * Extended stats of the devices must have been computed into st_xrates
+ * (see compute_sample_ext_rates()).
+ */
+void ru_add_sample(struct rollup *ru, struct stats_sample *smp)
+{
+	struct ru_level *rl = ru->lvl + RU_MIN;
+	unsigned long long itv;
+	double v[NR_CPU_PCT];
+	unsigned int cpu;
+	int curr = smp->curr, slot, n;
+
+	if (!smp->uptime[!curr])
+		/* Stats since boot: Not an interval */
+		return;
+
+	if (rl->bkt.sample_nr &&
+	    (rl->bkt.first / rl->span != smp->realtime / rl->span)) {
+		ru_close_bucket(ru, RU_MIN);
+	}
+	if (!rl->bkt.sample_nr) {
+		rl->bkt.first = smp->realtime;
+	}
+	rl->bkt.last = smp->realtime;
+	rl->bkt.sample_nr++;
+
+	/* CPU "all", as in write_cpu_stat() */
+	itv = get_interval(smp->uptime[!curr], smp->uptime[curr]);
+	compute_cpu_pct(smp->cpu[!curr], smp->cpu[curr], itv, v);
+	ru_add_cpu(rl->cpu, v);
+
+	/* Every CPU online, as in write_per_cpu_stat() */
+	for (cpu = 1; cpu < ru->cpu_nr; cpu++) {
+		if (compute_per_cpu_pct(smp, cpu, v)) {
+			ru_add_cpu(rl->cpu + cpu, v);
+		}
+	}
+
+	/* Devices active during the sample */
+	ru_map_slots(ru, smp);
+	ru_reserve_dev(ru, rl);
+	for (slot = 0; slot < smp->iodev_nr; slot++) {
+		if (((n = ru->slot_name[slot]) < 0) || !qix_active(slot))
+			continue;
+		qix_add_sample(ru_get_dev(rl, n), slot);
+	}
+}
+
+/*
+ * Save the buckets being filled and close the rollup files.
+ */
+void ru_close(struct rollup *ru)
+{
+	struct ru_level *rl;
+	int l;
+
+	for (l = 0; l < NR_RU_LEVELS; l++) {
+		ru_close_bucket(ru, l);
+	}
+
+	for (l = 0, rl = ru->lvl; l < NR_RU_LEVELS; l++, rl++) {
+		if (rl->fd >= 0) {
+			close(rl->fd);
+		}
+		free(rl->buf.buf);
+		free(rl->cpu);
+		free(rl->dev);
+		free(rl->touched);
+	}
+	free(ru->slot_name);
+	free(ru->names.name);
+	free(ru->names.hash);
+	memset(ru, 0, sizeof(struct rollup));
+}
@@ -0,0 +1,140 @@
+/*
+ * rollup.h: Stats of recorded files summarized over minutes and hours
+ */
+
+#ifndef _ROLLUP_H
+#define _ROLLUP_H
+
+#include "iostat.h"
+#include "query.h"
+
+/*
+ * While stats are recorded, the rates displayed for every interval (see
+ * write_cpu_stat() and write_ext_stat()) are also summarized over
+ * buckets of one minute and one hour, which are saved next to the
+ * recorded file (same name with RU_SUFFIX_MIN or RU_SUFFIX_HOUR
+ * appended). Buckets are aligned on the wall clock.
+ * For each bucket, the min, max and sum of every CPU utilization of CPU
+ * "all" and of every CPU, and of every extended stat of every device
+ * active in the bucket are saved, along with the number of samples
+ * they have been computed from. A minute bucket is summarized into the
+ * hour bucket when it is closed.
+ *
+ * A rollup file starts with a header, followed by records made of a
+ * ru_record header and its data:
+ * - RU_NAMES: Device names (qix_name structures) numbered from the
+ *   number of names saved before them in the file;
+ * - RU_BUCKET: A ru_bucket structure, followed by the ru_cpu structures
+ *   of CPU "all" and of every CPU, and by the summaries (qix_dev
+ *   structures) of the devices active in the bucket, sorted by name
+ *   number.
+ * Rollup files are created along with the recorded file. The buckets
+ * being filled when recording stops (at the end of the count, or on
+ * SIGINT or SIGTERM) are saved as they are.
+ * A rollup file can be queried the same way as a recorded file (see
+ * query.h): Each bucket is then used as a block whose summaries are
+ * already known, and no sample is ever decoded.
+ */
+
+#define RU_MAGIC	0x53535255	/* "SSRU" */
+#define RU_VERSION	1
+#define RU_SUFFIX_MIN	".1m"
+#define RU_SUFFIX_HOUR	".1h"
+
+/* Levels of buckets */
+#define RU_MIN		0
+#define RU_HOUR		1
+#define NR_RU_LEVELS	2
+
+/* Record types */
+#define RU_NAMES	1
+#define RU_BUCKET	2
+
+struct ru_header {
+	unsigned int magic;
+	unsigned int version;
+	/* Time span of a bucket (in seconds) */
+	unsigned int span;
+	/* Number of ru_cpu structures in a bucket (CPU "all" included) */
+	unsigned int cpu_nr;
+	/* Number of stats summarized for each CPU and each device */
+	unsigned int cpu_metric_nr;
+	unsigned int metric_nr;
+};
+
+#define RU_HEADER_SIZE	(sizeof(struct ru_header))
+
+struct ru_record {
+	unsigned int type;
+	/* Number of bytes following the header */
+	unsigned int len;
+};
+
+#define RU_RECORD_SIZE	(sizeof(struct ru_record))
+
+struct ru_bucket {
+	/* Time of first and last samples summarized (ns since the Epoch) */
+	unsigned long long first;
+	unsigned long long last;
+	/* Number of samples summarized */
+	unsigned int sample_nr;
+	/* Number of device summaries following the CPU ones */
+	unsigned int dev_nr;
+};
+
+#define RU_BUCKET_SIZE	(sizeof(struct ru_bucket))
+
+/* CPU utilization over the samples in which the CPU was online */
+struct ru_cpu {
+	unsigned int count;
+	double min[NR_CPU_PCT];
+	double max[NR_CPU_PCT];
+	double sum[NR_CPU_PCT];
+};
+
+#define RU_CPU_SIZE	(sizeof(struct ru_cpu))
+
+/* Bucket being filled for one level */
+struct ru_level {
+	int fd;
+	/* Records to be appended with next write() */
+	struct out_buf buf;
+	/* Time span of a bucket (ns) */
+	unsigned long long span;
+	struct ru_bucket bkt;
+	struct ru_cpu *cpu;
+	/* Device summaries, indexed by name number */
+	struct qix_dev *dev;
+	unsigned int dev_size;
+	/* Name numbers of the devices active in the bucket */
+	int *touched;
+	/* Number of names saved in the file so far */
+	unsigned int name_nr;
+};
+
+/* Rollups of a recorded file */
+struct rollup {
+	/* Device names and their numbers */
+	struct qix names;
+	/* Number of the name of each slot of the dictionary in effect */
+	int *slot_name;
+	unsigned int dict_gen;
+	/* Number of ru_cpu structures in a bucket */
+	unsigned int cpu_nr;
+	struct ru_level lvl[NR_RU_LEVELS];
+};
+
+/*
+ ***************************************************************************
+ * Functions prototypes
+ ***************************************************************************
+ */
+
+extern void
+	ru_add_sample(struct rollup *, struct stats_sample *);
+extern void
+	ru_close(struct rollup *);
+extern void
+	ru_open(struct rollup *, char *, int);
+
+#endif  /* _ROLLUP_H */
@@ -0,0 +1,167 @@
+/*
+ * shm.c: Publish the latest stats in shared memory (see shmread.h)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "iostat.h"
+#include "common.h"
+#include "shm.h"
+
+extern __thread struct io_ext_rates st_xrates;
+
+/* Structures are aligned on cache lines */
+#define SHM_ALIGN(n)	(((n) + 63) & ~63ULL)
+
+/*
+ * Size the shared memory object for dev_max devices, and map it.
+ */
+void shm_resize(struct shm_file *sf, unsigned int dev_max)
+{
+	struct shm_header *hdr;
+	unsigned long long cpu_off, dev_off, size;
+	char *map;
+
+	cpu_off = SHM_ALIGN(sizeof(struct shm_header));
+	dev_off = SHM_ALIGN(cpu_off + sizeof(struct shm_cpu) * (unsigned long long) sf->cpu_nr);
+	size = dev_off + sizeof(struct shm_dev) * (unsigned long long) dev_max;
+
+	/* Readers keep on using their own mapping until they see the new size */
+	if ((ftruncate(sf->fd, size) < 0) ||
+	    ((map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 sf->fd, 0)) == MAP_FAILED)) {
+		fprintf(stderr, "Cannot size shared memory %s: %s\n", sf->name, strerror(errno));
+		exit(2);
+	}
+	if (sf->map) {
+		munmap(sf->map, sf->map_size);
+	}
+	sf->map = map;
+	sf->map_size = size;
+	sf->hdr = hdr = (struct shm_header *) map;
+
+	hdr->cpu_nr = sf->cpu_nr;
+	hdr->cpu_off = cpu_off;
+	hdr->dev_off = dev_off;
+	hdr->dev_max = dev_max;
+	__atomic_store_n(&hdr->size, size, __ATOMIC_RELEASE);
+}
+
+/*
+ * Create the shared memory object stats will be published into, with
+ * room for cpu_nr CPU structures (CPU "all" included) and dev_nr
+ * devices to start with.
+ */
+void shm_create(struct shm_file *sf, char *name, int cpu_nr, int dev_nr)
+{
+	memset(sf, 0, sizeof(struct shm_file));
+	sf->name = name;
+	sf->cpu_nr = cpu_nr;
+
+	if ((sf->fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		fprintf(stderr, "Cannot open shared memory %s: %s\n", name, strerror(errno));
+		exit(2);
+	}
+
+	shm_resize(sf, dev_nr + SHM_DEV_SPARE);
+	sf->hdr->version = SHM_VERSION;
+	/* Readers check the magic number last */
+	__atomic_store_n(&sf->hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+/*
+ * Publish the stats of a sample (as they are displayed).
+ * Extended stats of the devices must have been computed into st_xrates
+ * (see compute_sample_ext_rates()).
+ */
+void shm_publish(struct shm_file *sf, struct stats_sample *smp)
+{
+	struct shm_header *hdr = sf->hdr;
+	struct shm_cpu *sc;
+	struct shm_dev *sd;
+	unsigned long long itv;
+	unsigned int seq, i, n;
+	int curr = smp->curr, new_dict, c;
+
+	new_dict = !sf->started || (sf->dict_gen != smp->dict_gen);
+	if (new_dict) {
+		for (i = n = 0; i < (unsigned int) smp->iodev_nr; i++) {
+			if (smp->hdr[i].used) {
+				n++;
+			}
+		}
+		if (n > hdr->dev_max) {
+			shm_resize(sf, n + SHM_DEV_SPARE);
+			hdr = sf->hdr;
+		}
+	}
+
+	/* Stats are inconsistent from now on */
+	seq = hdr->seq;
+	__atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	hdr->realtime = smp->realtime;
+	hdr->interval = smp->ts[!curr] ? smp->ts[curr] - smp->ts[!curr] : 0;
+	hdr->count++;
+
+	/* CPU "all", then every CPU, as in write_cpu_stat() and write_per_cpu_stat() */
+	sc = (struct shm_cpu *) (sf->map + hdr->cpu_off);
+	itv = get_interval(smp->uptime[!curr], smp->uptime[curr]);
+	compute_cpu_pct(smp->cpu[!curr], smp->cpu[curr], itv, sc->pct);
+	sc->online = TRUE;
+	for (i = 1; i < hdr->cpu_nr; i++) {
+		sc[i].online = compute_per_cpu_pct(smp, i, sc[i].pct);
+	}
+
+	/* Devices in use, in the order of the dictionary */
+	sd = (struct shm_dev *) (sf->map + hdr->dev_off);
+	if (new_dict) {
+		for (i = 0, n = 0; i < (unsigned int) smp->iodev_nr; i++) {
+			if (smp->hdr[i].used) {
+				strncpy(sd[n++].name, smp->hdr[i].name, SHM_NAME_LEN);
+			}
+		}
+		hdr->dev_nr = n;
+		hdr->dev_gen++;
+		sf->dict_gen = smp->dict_gen;
+		sf->started = TRUE;
+	}
+	for (i = 0; i < (unsigned int) smp->iodev_nr; i++) {
+		if (!smp->hdr[i].used)
+			continue;
+		for (c = 0; c < NR_XR_COLS; c++) {
+			sd->xr[c] = st_xrates.col[c][i];
+		}
+		/* As in write_ext_stat() */
+		sd->xr[XR_UTIL] /= (double) smp->hdr[i].used;
+		sd++;
+	}
+
+	/* Stats are consistent again */
+	__atomic_store_n(&hdr->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Remove the shared memory object.
+ */
+void shm_close(struct shm_file *sf)
+{
+	if (sf->map) {
+		munmap(sf->map, sf->map_size);
+	}
+	if (sf->fd >= 0) {
+		close(sf->fd);
+	}
+	shm_unlink(sf->name);
+	memset(sf, 0, sizeof(struct shm_file));
+	sf->fd = -1;
+}
@@ -0,0 +1,46 @@
+/*
+ * shm.h: Publish the latest stats in shared memory (see shmread.h)
+ */
+
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "iostat.h"
+#include "shmread.h"
+
+#if (SHM_NR_CPU_PCT != NR_CPU_PCT) || (SHM_NR_XR_COLS != NR_XR_COLS) || \
+    (SHM_NAME_LEN != MAX_NAME_LEN)
+#error "shmread.h doesn't match SimpleStat structures"
+#endif
+
+/* Room left for new devices when the object is created or enlarged */
+#define SHM_DEV_SPARE	64
+
+/* Shared memory object stats are published into */
+struct shm_file {
+	char *name;
+	int fd;
+	char *map;
+	size_t map_size;
+	struct shm_header *hdr;
+	/* Number of CPU structures (CPU "all" included) */
+	unsigned int cpu_nr;
+	/* Generation of the dictionary whose names are published */
+	unsigned int dict_gen;
+	int started;
+};
+
+/*
+ ***************************************************************************
+ * Functions prototypes
+ ***************************************************************************
+ */
+
+extern void
+	shm_close(struct shm_file *);
+extern void
+	shm_create(struct shm_file *, char *, int, int);
+extern void
+	shm_publish(struct shm_file *, struct stats_sample *);
+
+#endif  /* _SHM_H */
@@ -0,0 +1,116 @@
+/*
+ * shmbench.c: Measure the cost of reading the stats published by
+ * SimpleStat with --shm, and check that every read is consistent.
+ *
+ * Usage: shmbench /<name> [ <reads> ]
+ *
+ * Each read takes the utilization of every CPU and the %util of every
+ * device in place, between shm_read_begin() and shm_read_retry(), as a
+ * monitoring agent would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "shmread.h"
+
+#define DEFAULT_READS	10000000
+
+/*
+ * Tell whether the utilization of a CPU is consistent: Its percentages
+ * sum up to 100, or are all zero (offline CPU, or CPU "all" when no
+ * tick has elapsed during the interval).
+ */
+int cpu_pct_ok(struct shm_cpu *sc)
+{
+	double pct = 0;
+	int j;
+
+	for (j = 0; j < SHM_NR_CPU_PCT; j++) {
+		pct += sc->pct[j];
+	}
+
+	return (pct == 0.0) || ((pct > 99.0) && (pct < 101.0));
+}
+
+/*
+ * Get monotonic time in ns.
+ */
+unsigned long long get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	struct shm_reader r;
+	struct shm_cpu *sc;
+	struct shm_dev *sd;
+	unsigned long long reads = DEFAULT_READS, i, t0, t1;
+	unsigned long long count, last = 0, retries = 0, bad = 0, seen = 0;
+	unsigned int seq, c, d, dev_nr = 0;
+	double util = 0;
+	int ok;
+
+	if ((argc < 2) || (argc > 3)) {
+		fprintf(stderr, "Usage: %s /<name> [ <reads> ]\n", argv[0]);
+		exit(1);
+	}
+	if ((argc == 3) && ((reads = strtoull(argv[2], NULL, 10)) == 0)) {
+		fprintf(stderr, "Invalid number of reads: %s\n", argv[2]);
+		exit(1);
+	}
+
+	if (shm_attach(&r, argv[1]) < 0) {
+		fprintf(stderr, "Cannot attach to %s: %s\n", argv[1], strerror(errno));
+		exit(2);
+	}
+
+	t0 = get_time_ns();
+	for (i = 0; i < reads; i++) {
+		for (;;) {
+			if (shm_read_begin(&r, &seq) < 0) {
+				fprintf(stderr, "Cannot read %s: %s\n", argv[1], strerror(errno));
+				exit(2);
+			}
+			count = r.hdr->count;
+			ok = 1;
+			for (c = 0; (sc = shm_cpu(&r, c)) != NULL; c++) {
+				ok &= cpu_pct_ok(sc);
+			}
+			for (d = 0; (sd = shm_dev(&r, d)) != NULL; d++) {
+				util += sd->xr[SHM_NR_XR_COLS - 1];
+			}
+			dev_nr = d;
+			if (!shm_read_retry(&r, seq))
+				break;
+			retries++;
+		}
+
+		/* The count of intervals published never goes backwards */
+		if ((count < last) || !ok) {
+			bad++;
+		}
+		if (count != last) {
+			seen++;
+		}
+		last = count;
+	}
+	t1 = get_time_ns();
+
+	printf("%llu reads: %.1f ns per read, %llu retries, %llu inconsistent\n",
+	       reads, (double) (t1 - t0) / reads, retries, bad);
+	printf("%llu intervals published while reading, %u CPU, %u devices (%%util sum %.0f)\n",
+	       seen, r.hdr->cpu_nr, dev_nr, util);
+
+	shm_detach(&r);
+
+	return bad ? 3 : 0;
+}
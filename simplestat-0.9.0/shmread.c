@@ -0,0 +1,215 @@
+/*
+ * shmread.c: Read the latest stats published by SimpleStat (see shmread.h)
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "shmread.h"
+
+/* Let the other hardware thread run while spinning */
+#if defined(__i386__) || defined(__x86_64__)
+#define SHM_PAUSE()	__builtin_ia32_pause()
+#else
+#define SHM_PAUSE()	__asm__ __volatile__("" ::: "memory")
+#endif
+
+/*
+ * Map the whole shared memory object, whose size may have changed.
+ * Return 0 on success, else -1 (errno is set).
+ */
+int shm_map(struct shm_reader *r)
+{
+	struct stat st;
+	char *map;
+
+	if (fstat(r->fd, &st) < 0)
+		return -1;
+	if ((size_t) st.st_size < sizeof(struct shm_header)) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, r->fd, 0)) == MAP_FAILED)
+		return -1;
+	if (r->map) {
+		munmap(r->map, r->map_size);
+	}
+	r->map = map;
+	r->map_size = st.st_size;
+	r->hdr = (struct shm_header *) map;
+
+	return 0;
+}
+
+/*
+ * Open the shared memory object in which SimpleStat publishes its stats.
+ * Return 0 on success, else -1 (errno is set).
+ */
+int shm_attach(struct shm_reader *r, const char *name)
+{
+	memset(r, 0, sizeof(struct shm_reader));
+
+	if ((r->fd = shm_open(name, O_RDONLY, 0)) < 0)
+		return -1;
+
+	if (shm_map(r) < 0)
+		goto fail;
+
+	if ((r->hdr->magic != SHM_MAGIC) || (r->hdr->version != SHM_VERSION) ||
+	    (r->hdr->cpu_off < sizeof(struct shm_header))) {
+		errno = EPROTO;
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	shm_detach(r);
+	return -1;
+}
+
+/*
+ * Close the shared memory object.
+ */
+void shm_detach(struct shm_reader *r)
+{
+	int err = errno;
+
+	if (r->map) {
+		munmap(r->map, r->map_size);
+	}
+	if (r->fd >= 0) {
+		close(r->fd);
+	}
+	memset(r, 0, sizeof(struct shm_reader));
+	r->fd = -1;
+	errno = err;
+}
+
+/*
+ * Start reading the stats: Wait until they are consistent, and save in
+ * seq the sequence number to be passed to shm_read_retry().
+ * Structures returned by shm_cpu() and shm_dev() may then be read in
+ * place. They remain mapped until next call to shm_read_begin().
+ * Return 0 on success, else -1 (errno is set): EAGAIN if the stats are
+ * still being published after SHM_READ_MAX_TRIES tries (e.g. SimpleStat
+ * has been killed while publishing them).
+ */
+int shm_read_begin(struct shm_reader *r, unsigned int *seq)
+{
+	unsigned int tries;
+
+	for (tries = 0; tries < SHM_READ_MAX_TRIES; tries++) {
+		*seq = __atomic_load_n(&r->hdr->seq, __ATOMIC_ACQUIRE);
+		if (*seq & 1) {
+			/* Stats are being published */
+			SHM_PAUSE();
+			continue;
+		}
+		if (__atomic_load_n(&r->hdr->size, __ATOMIC_RELAXED) > r->map_size) {
+			/* More devices than there was room for: Map them too */
+			if (shm_map(r) < 0) {
+				if (errno != EAGAIN)
+					return -1;
+				SHM_PAUSE();
+			}
+			continue;
+		}
+		return 0;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+/*
+ * Tell whether the stats read since shm_read_begin() returned seq may
+ * be inconsistent, i.e. whether they must be read again.
+ */
+int shm_read_retry(struct shm_reader *r, unsigned int seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&r->hdr->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/*
+ * Return the utilization of CPU number i (0: CPU "all"), or NULL.
+ */
+struct shm_cpu *shm_cpu(struct shm_reader *r, unsigned int i)
+{
+	struct shm_header *hdr = r->hdr;
+
+	if ((i >= hdr->cpu_nr) ||
+	    (hdr->cpu_off + sizeof(struct shm_cpu) * (i + 1) > r->map_size))
+		return NULL;
+
+	return (struct shm_cpu *) (r->map + hdr->cpu_off) + i;
+}
+
+/*
+ * Return the stats of device number i, or NULL.
+ */
+struct shm_dev *shm_dev(struct shm_reader *r, unsigned int i)
+{
+	struct shm_header *hdr = r->hdr;
+
+	if ((i >= hdr->dev_nr) ||
+	    (hdr->dev_off + sizeof(struct shm_dev) * (i + 1) > r->map_size))
+		return NULL;
+
+	return (struct shm_dev *) (r->map + hdr->dev_off) + i;
+}
+
+/*
+ * Return the number of a device, or -1 if it isn't published.
+ * Must be called between shm_read_begin() and shm_read_retry().
+ * The number of a device doesn't change as long as dev_gen stays the
+ * same in the header: Callers may keep it until then.
+ */
+int shm_find_dev(struct shm_reader *r, const char *name)
+{
+	struct shm_dev *sd;
+	unsigned int i;
+
+	for (i = 0; (sd = shm_dev(r, i)) != NULL; i++) {
+		if (!strncmp(sd->name, name, SHM_NAME_LEN))
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Copy the stats of a device. Return 0 on success, else -1 (errno is
+ * set): ENOENT if the device isn't published, or an error from
+ * shm_read_begin().
+ */
+int shm_read_dev(struct shm_reader *r, const char *name, struct shm_dev *out)
+{
+	struct shm_dev *sd;
+	unsigned int seq;
+	int i;
+
+	do {
+		if (shm_read_begin(r, &seq) < 0)
+			return -1;
+		if (((i = shm_find_dev(r, name)) < 0) || !(sd = shm_dev(r, i))) {
+			if (!shm_read_retry(r, seq)) {
+				errno = ENOENT;
+				return -1;
+			}
+			continue;
+		}
+		memcpy(out, sd, sizeof(struct shm_dev));
+	}
+	while (shm_read_retry(r, seq));
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * shmread.h: Latest stats published by SimpleStat in shared memory
+ *
+ * This file only depends on the C library: Programs reading the shared
+ * memory segment include it and link with shmread.c.
+ */
+
+#ifndef _SHMREAD_H
+#define _SHMREAD_H
+
+#include <stddef.h>
+
+/*
+ * With option --shm <name>, SimpleStat publishes the stats it has just
+ * computed (the CPU utilization of CPU "all" and of every CPU, and the
+ * extended stats of every device) into the POSIX shared memory object
+ * <name> after each interval.
+ * The object starts with a shm_header, followed by cpu_nr shm_cpu
+ * structures (CPU "all" first) at offset cpu_off, and by dev_nr shm_dev
+ * structures at offset dev_off.
+ *
+ * The object is protected by a sequence lock: seq is odd while stats are
+ * being published, and is incremented again once they are consistent.
+ * A reader takes seq (waiting while it is odd), reads what it needs in
+ * place, then checks that seq hasn't changed, else reads again (see
+ * shm_read_begin() and shm_read_retry()). The writer never waits for
+ * readers, and readers make no system calls. Readers give up waiting
+ * after SHM_READ_MAX_TRIES tries, so that they don't spin forever if
+ * SimpleStat dies while seq is odd.
+ * The object only grows: When more devices are published than there is
+ * room for, it is enlarged and size is updated. Readers then map it
+ * again.
+ */
+
+#define SHM_MAGIC	0x53535348	/* "SSSH" */
+#define SHM_VERSION	1
+
+/* Same values as in SimpleStat */
+#define SHM_NR_CPU_PCT	6	/* NR_CPU_PCT */
+#define SHM_NR_XR_COLS	13	/* NR_XR_COLS */
+#define SHM_NAME_LEN	72	/* MAX_NAME_LEN */
+
+/* Number of times seq is read before shm_read_begin() fails (tens of ms) */
+#ifndef SHM_READ_MAX_TRIES
+#define SHM_READ_MAX_TRIES	(1 << 20)
+#endif
+
+struct shm_header {
+	unsigned int magic;
+	unsigned int version;
+	/* Sequence number (odd while stats are being published) */
+	unsigned int seq;
+	/* Incremented each time the list of devices changes */
+	unsigned int dev_gen;
+	/* Size of the object */
+	unsigned long long size;
+	/* Number of CPU structures (CPU "all" included), and their offset */
+	unsigned int cpu_nr;
+	unsigned int cpu_off;
+	/* Number of devices, room for devices, and their offset */
+	unsigned int dev_nr;
+	unsigned int dev_max;
+	unsigned long long dev_off;
+	/* Time at which the stats were taken (ns since the Epoch) */
+	unsigned long long realtime;
+	/* Interval they have been computed over (ns) */
+	unsigned long long interval;
+	/* Number of intervals published so far */
+	unsigned long long count;
+};
+
+/* CPU utilization (in percent) */
+struct shm_cpu {
+	/* Set if the CPU was online during the interval */
+	unsigned int online;
+	unsigned int pad;
+	/* %user, %nice, %kernel, %iowait, %steal, %idle */
+	double pct[SHM_NR_CPU_PCT];
+};
+
+/* Extended stats of a device */
+struct shm_dev {
+	char name[SHM_NAME_LEN];
+	/*
+	 * rrqm/s, wrqm/s, r/s, w/s, rsec/s, wsec/s, avgrq-sz, avgqu-sz,
+	 * await, r_await, w_await, svctm, %util (sectors are 512 bytes)
+	 */
+	double xr[SHM_NR_XR_COLS];
+};
+
+/* Shared memory object being read */
+struct shm_reader {
+	int fd;
+	char *map;
+	size_t map_size;
+	struct shm_header *hdr;
+};
+
+/*
+ ***************************************************************************
+ * Functions prototypes
+ ***************************************************************************
+ */
+
+extern int
+	shm_attach(struct shm_reader *, const char *);
+extern void
+	shm_detach(struct shm_reader *);
+extern int
+	shm_read_begin(struct shm_reader *, unsigned int *);
+extern int
+	shm_read_retry(struct shm_reader *, unsigned int);
+extern struct shm_cpu *
+	shm_cpu(struct shm_reader *, unsigned int);
+extern struct shm_dev *
+	shm_dev(struct shm_reader *, unsigned int);
+extern int
+	shm_find_dev(struct shm_reader *, const char *);
+extern int
+	shm_read_dev(struct shm_reader *, const char *, struct shm_dev *);
+
+#endif  /* _SHMREAD_H */
@@ -7,6 +7,9 @@
  * The goal of this program is to demonstrate the ability to provide statistics on any and all processors in the system as well as other devices. It is also possible to log the statistics to a file according to the date and time the log was written.
  */
 
+/* For pthread_timedjoin_np() */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -14,13 +17,15 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <time.h>
-#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
-#include <mxml.h>
 
 #include "version.h"
 #include "iostat.h"
@@ -28,6 +33,14 @@
 #include "ioconf.h"
 #include "rd_stats.h"
 #include "count.h"
+#include "record.h"
+#include "query.h"
+#include "rollup.h"
+#include "shm.h"
+#include "prom.h"
+#include "push.h"
+#include "net.h"
+#include "irq.h"
 
 /* GLOBALS */
 struct stats_cpu *st_cpu[2];
@@ -38,1079 +51,3012 @@ struct io_hdr_stats *st_hdr_iodev;
 struct io_dlist *st_dev_list;
 char group_name[MAX_NAME_LEN];
 
+/*
+ * Hash index from device name to its slot in st_hdr_iodev/st_iodev.
+ * Only slots in use are indexed. Empty buckets contain -1.
+ */
+int *iodev_hash;
+unsigned int iodev_hash_mask;
+/* Stack of unused slots */
+int *iodev_free;
+int iodev_free_nr = 0;
+/* Generation of the device list, incremented when devices are added or removed */
+unsigned int dict_gen = 0;
+
+/*
+ * Structure-of-arrays snapshots and extended stats computed from them.
+ * Like the report being formatted, they belong to the thread displaying
+ * stats: Recorded files are replayed by several threads.
+ */
+__thread struct io_stats_soa st_iosoa[2];
+__thread struct io_ext_rates st_xrates;
+__thread int iosoa_nr = 0;	/* Number of slots allocated in the SoA columns */
+
+/* /proc files kept open between intervals */
+/* /proc/diskstats is generated a page at a time (one device per record) */
+struct proc_file pf_diskstats = {-1, NULL, 0, 0, TRUE};
+struct proc_file pf_stat      = {-1, NULL, 0, 0, FALSE};
+struct proc_file pf_meminfo   = {-1, NULL, 0, 0, FALSE};
+
+/* Memory stats (gauges: Only the latest ones are kept) */
+struct stats_memory st_mem;
+struct stats_huge st_huge;
+
+/* Network interfaces */
+struct net_table st_net;
+
+/* Interrupts of every IRQ and softirqs of every type, on every CPU */
+struct irq_matrix st_irq;
+struct irq_matrix st_softirq;
+unsigned int actflags = 0;	/* Per-processor activities (M_D_* flags, see mpstat.h) */
+int irq_top_nr = 0;		/* Number of IRQs displayed with --irq */
+
+/* Fields of /proc/meminfo, in the order of the MI_* indexes */
+char *meminfo_key[NR_MEMINFO] = {
+	"MemTotal", "MemFree", "Buffers", "Cached", "SwapCached", "Active",
+	"Inactive", "SwapTotal", "SwapFree", "Dirty", "AnonPages", "Slab",
+	"KernelStack", "PageTables", "Committed_AS", "VmallocUsed",
+	"HugePages_Total", "HugePages_Free", "Hugepagesize"
+};
+/* Slot MEMINFO_HASH() of a field name holds its index plus one (0: none) */
+unsigned char meminfo_slot[MEMINFO_HASH_SIZE];
+
+/* Report being formatted */
+__thread struct out_buf st_out = {NULL, 0, 0};
+/* Set when reports are kept in st_out instead of being written to stdout */
+__thread int out_keep = FALSE;
+
 int iodev_nr = 0;	/* Number of devices and partitions found. Includes nb of device groups */
 int group_nr = 0;	/* Number of device groups */
-int cpu_nr = 0;		/* Number of processors on the machine */
+int cpu_nr = 0;		/* Highest processor number on the machine + 1 */
 int dlist_idx = 0;	/* Number of devices entered on the command line */
 int flags = 0;		/* Flag for common options and system state */
 unsigned int dm_major;	/* Device-mapper major number */
 
 long interval = 0;
-char timestamp[64];
-
-double user_data = 0;
-double nice_data = 0;
-double kernel_data = 0;
-double io_data = 0;
-double steal_data = 0;
-double idle_data = 0;
-
-
-/*
- * Ask user before writing/creating an XML log of current system data.
- */
-void write_log(void)
-{
-//	mxml_node_t *xml;    /* <?xml ... ?> */
-//	mxml_node_t *stats;   /* <stats> */
-//	mxml_node_t *cpu;   /* <cpu> */
-//	mxml_node_t *user;  /* <user> */
-//	mxml_node_t *nice;  /* <nice> */
-//	mxml_node_t *kernel;  /* <kernel> */
-//	mxml_node_t *io;  /* <io> */
-//	mxml_node_t *steal;  /* <steal> */
-//	mxml_node_t *idle;  /* <idle> */
-
-/*	char *user_text = "%d", user_data;
-	char *nice_text = "%d", nice_data;
-	char *kernel_text = "%d", kernel_data;
-	char *io_text = "%d", io_data;
-	char *steal_text = "%d", steal_data;
-	char *idle_text = "%d", idle_data;
-*/
-	char c;
-	printf("Save CPU stats to file? (y or n): ");
-
-    	while (1)
-	{
-		int valid = 0;
-	        scanf("%c", &c);
-		c = tolower(c);
-		if(c == 'y' || c == 'n')
-		{
-			valid = 1;
-		}
-		else
-		{
-			// Do nothing.
-		}
-	        if (c == EOF && valid == 1) break; // end of file
-       	        if (!isspace(c) && valid == 1)
-		{
-             		ungetc(c, stdin);
-          		break;
-        	}
-    	}
-	if(c == 'y')
-	{
-		/*xml = mxmlNewXML("1.0");
-		stats = mxmlNewElement(xml, "stats");
-		cpu = mxmlNewElement(stats, "cpu");
-		user = mxmlNewElement(cpu, "user");
-        	mxmlNewText(user, 0, user_text);
-		nice = mxmlNewElement(cpu, "nice");
-        	mxmlNewText(nice, 0, nice_text);
-		kernel = mxmlNewElement(cpu, "kernel");
-        	mxmlNewText(kernel, 0, kernel_text);
-		io = mxmlNewElement(cpu, "io");
-        	mxmlNewText(io, 0, io_text);
-		steal = mxmlNewElement(cpu, "steal");
-        	mxmlNewText(steal, 0, steal_text);
-		idle = mxmlNewElement(cpu, "idle");
-        	mxmlNewText(idle, 0, idle_text);*/
-		printf("You chose Yes (%c).\n", c);
-	}
-	else
-	{
-		printf("You chose No (%c).\n", c);
+unsigned long long interval_ns = 0;	/* Interval in nanoseconds (0: no interval) */
+__thread char timestamp[64];
+
+/* Time at which each snapshot was taken (ns, CLOCK_MONOTONIC_RAW) */
+unsigned long long snap_ns[2] = {0, 0};
+/* Time at which current snapshot was taken (ns since the Epoch) */
+unsigned long long snap_real = 0;
+
+/*
+ * Interval scheduler: Samples are taken at absolute deadlines on
+ * CLOCK_MONOTONIC so that time spent collecting and printing stats
+ * doesn't make them drift.
+ */
+unsigned long long next_deadline = 0;	/* Next deadline (ns, CLOCK_MONOTONIC) */
+unsigned long long sched_missed = 0;	/* Number of intervals missed so far */
+long long sched_jitter = 0;		/* Wakeup delay at last interval (ns) */
+
+/* Ring of samples between sampler and writer threads (size 0: no threads) */
+struct sample_ring st_ring;
+int ring_size = 0;
+int ring_policy = RING_DROP_OLDEST;
+
+/* Set when SIGINT or SIGTERM is received: Stop sampling and close files */
+volatile sig_atomic_t sig_stop = 0;
+
+__thread double user_data = 0;
+__thread double nice_data = 0;
+__thread double kernel_data = 0;
+__thread double io_data = 0;
+__thread double steal_data = 0;
+__thread double idle_data = 0;
+
+/* XML log file (NULL: no log) */
+FILE *log_fp = NULL;
+
+/* Binary file of raw stats (NULL: stats are not recorded) */
+struct rec_file st_rec;
+struct rec_file *rec_out = NULL;
+char *rec_filename = NULL;
+int rec_compress = FALSE;
+
+/* Rollups saved along with the recorded file (NULL: no rollups) */
+struct rollup st_rollup;
+struct rollup *ru_out = NULL;
+int rec_rollup = FALSE;
+
+/* Shared memory the latest stats are published into (NULL: none) */
+struct shm_file st_shm;
+struct shm_file *shm_out = NULL;
+char *shm_name = NULL;
+
+/* Server of the latest stats in Prometheus format (NULL: none) */
+struct prom_server st_prom;
+struct prom_server *prom_out = NULL;
+char *prom_path = NULL;
+int prom_port = 0;
+
+/* Collector the latest stats are pushed to over UDP (NULL: none) */
+struct push_sink st_push;
+struct push_sink *push_out = NULL;
+char *push_dest = NULL;
+int push_format = -1;
+
+/* History file holding the most recent samples (NULL: no history) */
+struct rec_file st_hist;
+struct rec_file *hist_out = NULL;
+char *hist_filename = NULL;
+unsigned long long hist_size = HIST_DEF_SIZE;
+
+/* Recorded file to display instead of live stats (NULL: live stats) */
+char *replay_filename = NULL;
+/* Range of time to display (ns since the Epoch) */
+unsigned long long replay_from = 0;
+unsigned long long replay_to = ~0ULL;
+/* Number of threads decoding the file (0: one per processor) */
+int replay_jobs = 0;
+
+/* Recorded file to query (NULL: no query) */
+char *query_filename = NULL;
+/* Device whose stats are displayed, or number of devices to rank */
+char *query_dev = NULL;
+int query_top_nr = 0;
+char *query_metric = "%util";
+
+
+/*
+ * Open the XML log file.
+ * Each interval is appended to it as a single-line <sample> element as
+ * soon as it has been displayed, so that nothing is kept in memory and
+ * the file may be followed while it grows. Samples are not enclosed in
+ * a root element: Successive runs append to the same log, and a run that
+ * is killed doesn't leave an unterminated document behind.
+ */
+void open_log(char *filename)
+{
+	if ((log_fp = fopen(filename, "a")) == NULL) {
+		fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+		exit(2);
 	}
+	/* A sample is written in one go when the buffer is flushed */
+	setvbuf(log_fp, NULL, _IOFBF, LOG_BUF_SIZE);
 }
 
 /*
- * Save stats for current device.
+ * Start logging a sample.
  */
-void save_stats(char *name, int curr, void *st_io, int iodev_nr,
-		struct io_hdr_stats *st_hdr_iodev)
+void write_log_begin(struct stats_sample *smp)
 {
-	int i;
-	struct io_hdr_stats *st_hdr_iodev_i;
-	struct io_stats *st_iodev_i;
+	char ts[64];
 
-	/* Look for device in data table */
-	for (i = 0; i < iodev_nr; i++) {
-		st_hdr_iodev_i = st_hdr_iodev + i;
-		if (!strcmp(st_hdr_iodev_i->name, name)) {
-			break;
-		}
-	}
-
-	if (i == iodev_nr) {
-		/*
-		 * This is a new device: Look for an unused entry to store it.
-		 * Thus we are able to handle dynamically registered devices.
-		 */
-		for (i = 0; i < iodev_nr; i++) {
-			st_hdr_iodev_i = st_hdr_iodev + i;
-			if (!st_hdr_iodev_i->used) {
-				/* Unused entry found... */
-				st_hdr_iodev_i->used = TRUE; /* Indicate it is now used */
-				strcpy(st_hdr_iodev_i->name, name);
-				st_iodev_i = st_iodev[!curr] + i;
-				memset(st_iodev_i, 0, IO_STATS_SIZE);
-				break;
-			}
-		}
-	}
-	if (i < iodev_nr) {
-		st_hdr_iodev_i = st_hdr_iodev + i;
-		if (st_hdr_iodev_i->status == DISK_UNREGISTERED) {
-			st_hdr_iodev_i->status = DISK_REGISTERED;
-		}
-		st_iodev_i = st_iodev[curr] + i;
-		*st_iodev_i = *((struct io_stats *) st_io);
-	}
-	/*
-	 * else it was a new device
-	 * but there was no free structure to store it.
-	 */
+	strftime(ts, sizeof(ts), "%FT%T%z", &smp->rectime);
+	fprintf(log_fp, "<sample time=\"%s\">", ts);
 }
 
 /*
- * Display CPU stats.
+ * Log CPU utilization computed by write_cpu_stat().
  */
-void write_cpu_stat(int curr, unsigned long long itv)
+void write_log_cpu(void)
 {
-	user_data = ll_sp_value(st_cpu[!curr]->cpu_user,   st_cpu[curr]->cpu_user,   itv);
-	nice_data = ll_sp_value(st_cpu[!curr]->cpu_nice,   st_cpu[curr]->cpu_nice,   itv);
-	kernel_data = ll_sp_value(st_cpu[!curr]->cpu_sys + st_cpu[!curr]->cpu_softirq +
-		   st_cpu[!curr]->cpu_hardirq,
-		   st_cpu[curr]->cpu_sys + st_cpu[curr]->cpu_softirq +
-		   st_cpu[curr]->cpu_hardirq, itv);
-	io_data = ll_sp_value(st_cpu[!curr]->cpu_iowait, st_cpu[curr]->cpu_iowait, itv);
-	steal_data = ll_sp_value(st_cpu[!curr]->cpu_steal,  st_cpu[curr]->cpu_steal,  itv);
-	idle_data = (st_cpu[curr]->cpu_idle < st_cpu[!curr]->cpu_idle) ?
-       		0.0 :
-       		ll_sp_value(st_cpu[!curr]->cpu_idle,   st_cpu[curr]->cpu_idle,   itv);
+	fprintf(log_fp, "<cpu><user>%.2f</user><nice>%.2f</nice><kernel>%.2f</kernel>"
+			"<io>%.2f</io><steal>%.2f</steal><idle>%.2f</idle></cpu>",
+		user_data, nice_data, kernel_data, io_data, steal_data, idle_data);
+}
 
-	printf("\nCPU Usage");
-	printf("\nIn user space:			%6.2f%%", user_data);
-	printf("\nIn 'nice' (or, niceness):	%6.2f%%", nice_data);
-	printf("\nIn kernel space:		%6.2f%%", kernel_data);
-	printf("\nIn outstanding I/O requests:	%6.2f%%", io_data);
-	printf("\nIn time stolen from hypervisor:	%6.2f%%", steal_data);
-	printf("\nIdle time:			 %6.2f%%", idle_data);
+/*
+ * Log stats for a device. Rates are always in kB/s.
+ * Device names come from the kernel and need no escaping.
+ */
+void write_log_disk(double rdiv, double rmul, struct io_hdr_stats *shi,
+		    struct io_stats *ioi, struct io_stats *ioj)
+{
+	fprintf(log_fp, "<disk name=\"%s\"><tps>%.2f</tps><read_kb>%.2f</read_kb>"
+			"<written_kb>%.2f</written_kb></disk>",
+		shi->name,
+		R_VALUE(ioj->rd_ios + ioj->wr_ios, ioi->rd_ios + ioi->wr_ios, rdiv, rmul),
+		R_VALUE(ioj->rd_sectors, ioi->rd_sectors, rdiv, rmul) / 2,
+		R_VALUE(ioj->wr_sectors, ioi->wr_sectors, rdiv, rmul) / 2);
 }
 
 /*
- * Show disk stat header.
+ * Terminate the sample and write it to the log file.
+ * Logging stops if the file cannot be written.
  */
-void write_disk_stat_header(int *fctr)
+void write_log_end(void)
 {
-	if (DISPLAY_EXTENDED(flags)) {
-		/* Extended stats */
-		printf("Device:         rrqm/s   wrqm/s     r/s     w/s");
-		if (DISPLAY_MEGABYTES(flags)) {
-			printf("    rMB/s    wMB/s");
-			*fctr = 2048;
-		}
-		else if (DISPLAY_KILOBYTES(flags)) {
-			printf("    rkB/s    wkB/s");
-			*fctr = 2;
-		}
-		else {
-			printf("   rsec/s   wsec/s");
-		}
-		printf(" avgrq-sz avgqu-sz   await r_await w_await  svctm  %%util\n");
+	fputs("</sample>\n", log_fp);
+
+	if (fflush(log_fp) == EOF) {
+		fprintf(stderr, "Cannot write log: %s\n", strerror(errno));
+		fclose(log_fp);
+		log_fp = NULL;
 	}
-	else {
-		/* Basic stats */
-		printf("\n\nDevice:            I/O Requests per Second");
-		if (DISPLAY_KILOBYTES(flags)) {
-			printf("    kB read/s    kB written/s    total kB read    total kB written\n");
-			*fctr = 2;
-		}
-		else if (DISPLAY_MEGABYTES(flags)) {
-			printf("    MB read/s    MB written/s    total MB read    total MB written\n");
-			*fctr = 2048;
-		}
-		else {
-			printf("   Blk_read/s   Blk_wrtn/s   Blk_read   Blk_wrtn\n");
-		}
+}
+
+/*
+ * Close the XML log file.
+ */
+void close_log(void)
+{
+	if (log_fp) {
+		fclose(log_fp);
+		log_fp = NULL;
 	}
 }
 
 /*
- * Display extended stats, read from partition.
+ * Hash function used for device names (FNV-1a).
  */
-void write_ext_stat(int curr, unsigned long long itv, int fctr,
-		    struct io_hdr_stats *shi, struct io_stats *ioi,
-		    struct io_stats *ioj)
+unsigned int hash_dev_name(char *name)
 {
-	curr = curr;
-	char *devname = NULL;
-	struct stats_disk sdc, sdp;
-	struct ext_disk_stats xds;
-	double r_await, w_await;
+	unsigned int h = 2166136261U;
 
-	/*
-	 * Counters overflows are possible, but don't need to be handled in
-	 * a special way: The difference is still properly calculated if the
-	 * result is of the same type as the two values.
-	 * Exception is field rq_ticks which is incremented by the number of
-	 * I/O in progress times the number of milliseconds spent doing I/O.
-	 * But the number of I/O in progress (field ios_pgr) happens to be
-	 * sometimes negative...
-	 */
-	sdc.nr_ios    = ioi->rd_ios + ioi->wr_ios;
-	sdp.nr_ios    = ioj->rd_ios + ioj->wr_ios;
+	while (*name) {
+		h ^= (unsigned char) *name++;
+		h *= 16777619U;
+	}
 
-	sdc.tot_ticks = ioi->tot_ticks;
-	sdp.tot_ticks = ioj->tot_ticks;
+	return h;
+}
 
-	sdc.rd_ticks  = ioi->rd_ticks;
-	sdp.rd_ticks  = ioj->rd_ticks;
-	sdc.wr_ticks  = ioi->wr_ticks;
-	sdp.wr_ticks  = ioj->wr_ticks;
+/*
+ * Look for a device in the hash index.
+ * Return its slot number, or -1 if the device is not in use.
+ */
+int lookup_dev_slot(char *name)
+{
+	unsigned int b = hash_dev_name(name) & iodev_hash_mask;
 
-	sdc.rd_sect   = ioi->rd_sectors;
-	sdp.rd_sect   = ioj->rd_sectors;
-	sdc.wr_sect   = ioi->wr_sectors;
-	sdp.wr_sect   = ioj->wr_sectors;
+	while (iodev_hash[b] >= 0) {
+		if (!strcmp(st_hdr_iodev[iodev_hash[b]].name, name))
+			return iodev_hash[b];
+		b = (b + 1) & iodev_hash_mask;
+	}
 
-	compute_ext_disk_stats(&sdc, &sdp, itv, &xds);
+	return -1;
+}
 
-	r_await = (ioi->rd_ios - ioj->rd_ios) ?
-		  (ioi->rd_ticks - ioj->rd_ticks) /
-		  ((double) (ioi->rd_ios - ioj->rd_ios)) : 0.0;
-	w_await = (ioi->wr_ios - ioj->wr_ios) ?
-		  (ioi->wr_ticks - ioj->wr_ticks) /
-		  ((double) (ioi->wr_ios - ioj->wr_ios)) : 0.0;
+/*
+ * Add a slot in use to the hash index.
+ */
+void insert_dev_slot(int slot)
+{
+	unsigned int b = hash_dev_name(st_hdr_iodev[slot].name) & iodev_hash_mask;
 
-	/* Print device name */
-	if (DISPLAY_PERSIST_NAME_I(flags)) {
-		devname = get_persistent_name_from_pretty(shi->name);
-	}
-	if (!devname) {
-		devname = shi->name;
+	while (iodev_hash[b] >= 0) {
+		b = (b + 1) & iodev_hash_mask;
 	}
-	if (DISPLAY_HUMAN_READ(flags)) {
-		printf("%s\n%13s", devname, "");
-	}
-	else {
-		printf("%-13s", devname);
-	}
-
-	/*       rrq/s wrq/s   r/s   w/s  rsec  wsec  rqsz  qusz await r_await w_await svctm %util */
-	printf(" %8.2f %8.2f %7.2f %7.2f %8.2f %8.2f %8.2f %8.2f %7.2f %7.2f %7.2f %6.2f %6.2f\n",
-	       S_VALUE(ioj->rd_merges, ioi->rd_merges, itv),
-	       S_VALUE(ioj->wr_merges, ioi->wr_merges, itv),
-	       S_VALUE(ioj->rd_ios, ioi->rd_ios, itv),
-	       S_VALUE(ioj->wr_ios, ioi->wr_ios, itv),
-	       S_VALUE(ioj->rd_sectors, ioi->rd_sectors, itv) / fctr,
-	       S_VALUE(ioj->wr_sectors, ioi->wr_sectors, itv) / fctr,
-	       xds.arqsz,
-	       S_VALUE(ioj->rq_ticks, ioi->rq_ticks, itv) / 1000.0,
-	       xds.await,
-	       r_await,
-	       w_await,
-	       /* The ticks output is biased to output 1000 ticks per second */
-	       xds.svctm,
-	       /*
-	        * Again: Ticks in milliseconds.
-		* In the case of a device group (option -g), shi->used is the number of
-		* devices in the group. Else shi->used equals 1.
-		*/
-	       shi->used ? xds.util / 10.0 / (double) shi->used
-	                 : xds.util / 10.0);	/* shi->used should never be null here */
+	iodev_hash[b] = slot;
 }
 
 /*
- * Write basic stats, read from filesystem.
+ * Remove a slot from the hash index. Entries that follow it in the
+ * same cluster are shifted back so that no lookup chain is broken.
  */
-void write_basic_stat(int curr, unsigned long long itv, int fctr,
-		      struct io_hdr_stats *shi, struct io_stats *ioi,
-		      struct io_stats *ioj)
+void remove_dev_slot(int slot)
 {
-	curr = curr;
-	char *devname = NULL;
-	unsigned long long rd_sec, wr_sec;
-
-	/* Print device name */
-	if (DISPLAY_PERSIST_NAME_I(flags)) {
-		devname = get_persistent_name_from_pretty(shi->name);
-	}
-	if (!devname) {
-		devname = shi->name;
-	}
-	if (DISPLAY_HUMAN_READ(flags)) {
-		printf("%s\n%13s", devname, "");
-	}
-	else {
-		printf("%-13s", devname);
+	unsigned int i, j, k;
+
+	i = hash_dev_name(st_hdr_iodev[slot].name) & iodev_hash_mask;
+	while (iodev_hash[i] != slot) {
+		if (iodev_hash[i] < 0)
+			/* Not indexed */
+			return;
+		i = (i + 1) & iodev_hash_mask;
 	}
 
-	/* Print stats coming from /sys or /proc/diskstats */
-	rd_sec = ioi->rd_sectors - ioj->rd_sectors;
-	if ((ioi->rd_sectors < ioj->rd_sectors) && (ioj->rd_sectors <= 0xffffffff)) {
-		rd_sec &= 0xffffffff;
-	}
-	wr_sec = ioi->wr_sectors - ioj->wr_sectors;
-	if ((ioi->wr_sectors < ioj->wr_sectors) && (ioj->wr_sectors <= 0xffffffff)) {
-		wr_sec &= 0xffffffff;
+	j = i;
+	while (1) {
+		j = (j + 1) & iodev_hash_mask;
+		if (iodev_hash[j] < 0)
+			break;
+		k = hash_dev_name(st_hdr_iodev[iodev_hash[j]].name) & iodev_hash_mask;
+		/* Entry stays where it is if its home bucket is in ]i, j] */
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+			continue;
+		iodev_hash[i] = iodev_hash[j];
+		i = j;
 	}
-
-	printf(" 		%8.2f 	%12.2f 	%12.2f 	%10llu 	%10llu\n",
-	       S_VALUE(ioj->rd_ios + ioj->wr_ios, ioi->rd_ios + ioi->wr_ios, itv),
-	       S_VALUE(ioj->rd_sectors, ioi->rd_sectors, itv) / fctr,
-	       S_VALUE(ioj->wr_sectors, ioi->wr_sectors, itv) / fctr,
-	       (unsigned long long) rd_sec / fctr,
-	       (unsigned long long) wr_sec / fctr);
+	iodev_hash[i] = -1;
 }
 
 /*
- * Initialize stat structures.
+ * (Re)build the device name hash index with a size suited to the
+ * current number of slots, and index every slot in use.
  */
-void init_stats(void)
+void build_dev_hash(void)
 {
+	unsigned int size = NR_DEV_HASH_MIN;
 	int i;
 
-	/* Allocate structures for CPUs "all" and 0 */
-	for (i = 0; i < 2; i++) {
-		if ((st_cpu[i] = (struct stats_cpu *) malloc(STATS_CPU_SIZE * 2)) == NULL) {
+	/* Keep the load factor of the index below 1/2 */
+	while (size < 2 * (unsigned int) iodev_nr) {
+		size <<= 1;
+	}
+
+	if (!iodev_hash || (size != iodev_hash_mask + 1)) {
+		free(iodev_hash);
+		if ((iodev_hash = (int *) malloc(sizeof(int) * size)) == NULL) {
 			perror("malloc");
 			exit(4);
 		}
-		memset(st_cpu[i], 0, STATS_CPU_SIZE * 2);
+		iodev_hash_mask = size - 1;
+	}
+	memset(iodev_hash, 0xff, sizeof(int) * size);
+
+	for (i = 0; i < iodev_nr; i++) {
+		if (st_hdr_iodev[i].used) {
+			insert_dev_slot(i);
+		}
 	}
 }
 
 /*
- * Allocate and initialize structures for I/O devices.
+ * Build the device name hash index and the list of unused slots
+ * from the contents of st_hdr_iodev.
  */
-void salloc_device(int dev_nr)
+void init_dev_index(void)
 {
 	int i;
 
-	for (i = 0; i < 2; i++) {
-		if ((st_iodev[i] =
-		     (struct io_stats *) malloc(IO_STATS_SIZE * dev_nr)) == NULL) {
-			perror("malloc");
-			exit(4);
-		}
-		memset(st_iodev[i], 0, IO_STATS_SIZE * dev_nr);
-	}
-
-	if ((st_hdr_iodev =
-	     (struct io_hdr_stats *) malloc(IO_HDR_STATS_SIZE * dev_nr)) == NULL) {
+	if ((iodev_free = (int *) malloc(sizeof(int) * iodev_nr)) == NULL) {
 		perror("malloc");
 		exit(4);
 	}
-	memset(st_hdr_iodev, 0, IO_HDR_STATS_SIZE * dev_nr);
+
+	/* Push unused slots in reverse order so that lowest ones are used first */
+	iodev_free_nr = 0;
+	for (i = iodev_nr - 1; i >= 0; i--) {
+		if (!st_hdr_iodev[i].used) {
+			iodev_free[iodev_free_nr++] = i;
+		}
+	}
+
+	build_dev_hash();
 }
 
 /*
- * Look for the specified device in the device list.
+ * Double the size of the device tables when no unused slot is left,
+ * so that devices registered dynamically are never lost.
+ * Slots keep their numbers, and the stats saved at previous and current
+ * intervals stay paired since both st_iodev tables are resized together.
  */
-int update_dev_list(int *dlist_idx, char *device_name)
+void grow_device_tables(void)
 {
-	int i;
-	struct io_dlist *sdli = st_dev_list;
+	int i, new_nr = iodev_nr * 2, last = iodev_nr - 1;
+	size_t io_size = IO_STATS_SIZE * new_nr;
+	size_t hdr_size = IO_HDR_STATS_SIZE * new_nr;
+	size_t free_size = sizeof(int) * new_nr;
 
-	for (i = 0; i < *dlist_idx; i++, sdli++) {
-		if (!strcmp(sdli->dev_name, device_name))
-			break;
+	for (i = 0; i < 2; i++) {
+		SREALLOC(st_iodev[i], struct io_stats, io_size);
+		memset(st_iodev[i] + iodev_nr, 0, IO_STATS_SIZE * (new_nr - iodev_nr));
 	}
+	SREALLOC(st_hdr_iodev, struct io_hdr_stats, hdr_size);
+	memset(st_hdr_iodev + iodev_nr, 0, IO_HDR_STATS_SIZE * (new_nr - iodev_nr));
+	SREALLOC(iodev_free, int, free_size);
 
-	if (i == *dlist_idx) {
+	if (!dlist_idx && (st_hdr_iodev[last].status == DISK_GROUP)) {
 		/*
-		 * Device not found: Store it.
-		 * Group names will be distinguished from real device names
-		 * thanks to their names which begin with a space.
+		 * The group entered without a list of devices has to stay
+		 * at the end of the table so that it includes every device
+		 * (see presave_device_list()): Move it to the new last slot.
 		 */
-		(*dlist_idx)++;
-		strncpy(sdli->dev_name, device_name, MAX_NAME_LEN - 1);
+		st_hdr_iodev[new_nr - 1] = st_hdr_iodev[last];
+		memset(st_hdr_iodev + last, 0, IO_HDR_STATS_SIZE);
+		for (i = 0; i < 2; i++) {
+			st_iodev[i][new_nr - 1] = st_iodev[i][last];
+			memset(st_iodev[i] + last, 0, IO_STATS_SIZE);
+		}
+		for (i = new_nr - 2; i >= last; i--) {
+			iodev_free[iodev_free_nr++] = i;
+		}
+	}
+	else {
+		for (i = new_nr - 1; i > last; i--) {
+			iodev_free[iodev_free_nr++] = i;
+		}
 	}
 
-	return i;
+	iodev_nr = new_nr;
+	build_dev_hash();
+	dict_gen++;
 }
 
 /*
- * Compute device group stats.
+ * Save stats for current device.
  */
-void compute_device_groups_stats(int curr)
+void save_stats(char *name, int curr, void *st_io)
 {
-	struct io_stats gdev, *ioi;
-	struct io_hdr_stats *shi = st_hdr_iodev;
-	int i, nr_disks;
-
-	memset(&gdev, 0, IO_STATS_SIZE);
-	nr_disks = 0;
-
-	for (i = 0; i < iodev_nr; i++, shi++) {
-		if (shi->used && (shi->status == DISK_REGISTERED)) {
-			ioi = st_iodev[curr] + i;
+	int i;
+	struct io_hdr_stats *st_hdr_iodev_i;
+	struct io_stats *st_iodev_i;
 
-			if (!DISPLAY_UNFILTERED(flags)) {
-				if (!ioi->rd_ios && !ioi->wr_ios)
-					continue;
-			}
+	/* Look for device in data table */
+	i = lookup_dev_slot(name);
 
-			gdev.rd_ios     += ioi->rd_ios;
-			gdev.rd_merges  += ioi->rd_merges;
-			gdev.rd_sectors += ioi->rd_sectors;
-			gdev.rd_ticks   += ioi->rd_ticks;
-			gdev.wr_ios     += ioi->wr_ios;
-			gdev.wr_merges  += ioi->wr_merges;
-			gdev.wr_sectors += ioi->wr_sectors;
-			gdev.wr_ticks   += ioi->wr_ticks;
-			gdev.ios_pgr    += ioi->ios_pgr;
-			gdev.tot_ticks  += ioi->tot_ticks;
-			gdev.rq_ticks   += ioi->rq_ticks;
-			nr_disks++;
-		}
-		else if (shi->status == DISK_GROUP) {
-			save_stats(shi->name, curr, &gdev, iodev_nr, st_hdr_iodev);
-			shi->used = nr_disks;
-			nr_disks = 0;
-			memset(&gdev, 0, IO_STATS_SIZE);
-		}
+	if ((i < 0) && !iodev_free_nr) {
+		/* No unused entry left: Make room for new devices */
+		grow_device_tables();
+	}
+	if (i < 0) {
+		/*
+		 * This is a new device: Use an unused entry to store it.
+		 * Thus we are able to handle dynamically registered devices.
+		 */
+		i = iodev_free[--iodev_free_nr];
+		st_hdr_iodev_i = st_hdr_iodev + i;
+		st_hdr_iodev_i->used = TRUE; /* Indicate it is now used */
+		strncpy(st_hdr_iodev_i->name, name, MAX_NAME_LEN - 1);
+		st_hdr_iodev_i->name[MAX_NAME_LEN - 1] = '\0';
+		insert_dev_slot(i);
+		st_iodev_i = st_iodev[!curr] + i;
+		memset(st_iodev_i, 0, IO_STATS_SIZE);
+		dict_gen++;
+	}
+	st_hdr_iodev_i = st_hdr_iodev + i;
+	if (st_hdr_iodev_i->status == DISK_UNREGISTERED) {
+		st_hdr_iodev_i->status = DISK_REGISTERED;
 	}
+	st_iodev_i = st_iodev[curr] + i;
+	*st_iodev_i = *((struct io_stats *) st_io);
 }
 
 /*
- * Print all stats and uptime.
+ * Make room for at least len more bytes in the output buffer.
  */
-void write_stats(int curr, struct tm *rectime)
+void out_reserve(size_t len)
 {
-	int dev, i, fctr = 1;
-	unsigned long long itv;
-	struct io_hdr_stats *shi;
-	struct io_dlist *st_dev_list_i;
+	size_t size;
 
-	/* Test stdout */
-	TEST_STDOUT(STDOUT_FILENO);
+	if (st_out.len + len < st_out.size)
+		return;
 
-	/* Print time stamp */
-	if (DISPLAY_TIMESTAMP(flags)) {
-		if (DISPLAY_ISO(flags)) {
-			strftime(timestamp, sizeof(timestamp), "%FT%T%z", rectime);
-		}
-		else {
-			strftime(timestamp, sizeof(timestamp), "%x %X", rectime);
-		}
-		printf("%s\n", timestamp);
-#ifdef DEBUG
-		if (DISPLAY_DEBUG(flags)) {
-			fprintf(stderr, "%s\n", timestamp);
-		}
-#endif
+	size = st_out.size ? st_out.size : OUT_BUF_SIZE;
+	while (size <= st_out.len + len) {
+		size <<= 1;
 	}
+	SREALLOC(st_out.buf, char, size);
+	st_out.size = size;
+}
 
-	/* Interval is multiplied by the number of processors */
-	itv = get_interval(uptime[!curr], uptime[curr]);
+/*
+ * Append formatted text to the report being built.
+ */
+__attribute__ ((format (printf, 1, 2)))
+void out_printf(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
 
-	if (DISPLAY_CPU(flags)) {
-#ifdef DEBUG
-		if (DISPLAY_DEBUG(flags)) {
-			/* Debug output */
-			fprintf(stderr, "itv=%llu st_cpu[curr]{ cpu_user=%llu cpu_nice=%llu "
-					"cpu_sys=%llu cpu_idle=%llu cpu_iowait=%llu cpu_steal=%llu "
-					"cpu_hardirq=%llu cpu_softirq=%llu cpu_guest=%llu "
-					"cpu_guest_nice=%llu }\n",
-				itv,
-				st_cpu[curr]->cpu_user,
-				st_cpu[curr]->cpu_nice,
-				st_cpu[curr]->cpu_sys,
-				st_cpu[curr]->cpu_idle,
-				st_cpu[curr]->cpu_iowait,
-				st_cpu[curr]->cpu_steal,
-				st_cpu[curr]->cpu_hardirq,
-				st_cpu[curr]->cpu_softirq,
-				st_cpu[curr]->cpu_guest,
-				st_cpu[curr]->cpu_guest_nice);
-		}
-#endif
+	out_reserve(OUT_BUF_SLACK);
 
-		/* Display CPU utilization */
-		write_cpu_stat(curr, itv);
-	}
+	va_start(ap, fmt);
+	n = vsnprintf(st_out.buf + st_out.len, st_out.size - st_out.len, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+
+	if ((size_t) n >= st_out.size - st_out.len) {
+		/* Line was truncated: Format it again */
+		out_reserve(n);
+		va_start(ap, fmt);
+		vsnprintf(st_out.buf + st_out.len, st_out.size - st_out.len, fmt, ap);
+		va_end(ap);
+	}
+	st_out.len += n;
+}
+
+/*
+ * Append n characters from s, right-aligned in a field of width characters.
+ */
+void out_field(const char *s, int n, int width)
+{
+	char *d;
+
+	out_reserve(n + width);
+	d = st_out.buf + st_out.len;
+	for (; width > n; width--) {
+		*d++ = ' ';
+	}
+	memcpy(d, s, n);
+	st_out.len = d + n - st_out.buf;
+}
+
+/*
+ * Append a string, left-aligned in a field of width characters ("%-*s").
+ */
+void out_str(const char *s, int width)
+{
+	int n = strlen(s);
+	char *d;
+
+	out_reserve(n + width);
+	d = st_out.buf + st_out.len;
+	memcpy(d, s, n);
+	for (d += n; width > n; width--) {
+		*d++ = ' ';
+	}
+	st_out.len = d - st_out.buf;
+}
+
+/*
+ * Append a single character.
+ */
+void out_char(char c)
+{
+	out_reserve(1);
+	st_out.buf[st_out.len++] = c;
+}
+
+/*
+ * Append an unsigned integer, right-aligned in a field of width
+ * characters ("%*llu").
+ */
+void out_ull(unsigned long long v, int width)
+{
+	char tmp[24], *p = tmp + sizeof(tmp);
+
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	}
+	while (v);
+
+	out_field(p, tmp + sizeof(tmp) - p, width);
+}
+
+/*
+ * Append a number with two decimals, right-aligned in a field of width
+ * characters. Same output as "%*.2f" but without going through printf(),
+ * which is locale-aware and much slower. As with printf(), a value
+ * exactly halfway between two hundredths is rounded to the even one.
+ */
+void out_fixed2(double v, int width)
+{
+	char tmp[32], *p = tmp + sizeof(tmp);
+	unsigned long long u;
+	double scaled, frac, hi, err;
+	int neg = 0;
+
+	if (!((v > -FIXED2_MAX) && (v < FIXED2_MAX))) {
+		out_printf("%*.2f", width, v);
+		return;
+	}
+	if (signbit(v)) {
+		/* Including -0.0, which printf() displays as "-0.00" */
+		neg = 1;
+		v = -v;
+	}
+
+	scaled = v * 100.0;
+	/*
+	 * The product is rounded: Compute its rounding error (Dekker's
+	 * algorithm) so that values close to halfway between two hundredths
+	 * are rounded on the same side as printf() does.
+	 */
+	hi = v * 134217729.0;
+	hi = hi - (hi - v);
+	err = (hi * 100.0 - scaled) + (v - hi) * 100.0;
+
+	u = (unsigned long long) scaled;
+	frac = scaled - (double) u;
+	if ((frac > 0.5) ||
+	    ((frac == 0.5) && ((err > 0) || ((err == 0) && (u & 1))))) {
+		u++;
+	}
+
+	*--p = '0' + u % 10;
+	u /= 10;
+	*--p = '0' + u % 10;
+	u /= 10;
+	*--p = '.';
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	}
+	while (u);
+	if (neg) {
+		*--p = '-';
+	}
+
+	out_field(p, tmp + sizeof(tmp) - p, width);
+}
+
+/*
+ * Write the report built so far to stdout and empty the buffer.
+ * The whole report goes out in one write(), so that it reaches a pipe
+ * at once instead of field by field.
+ */
+void out_flush(void)
+{
+	char *p = st_out.buf;
+	ssize_t n;
+
+	if (out_keep)
+		/* Report will be written by the caller */
+		return;
+
+	/* Anything left in stdio buffers goes first */
+	fflush(stdout);
+
+	while (st_out.len > 0) {
+		if ((n = write(STDOUT_FILENO, p, st_out.len)) < 0) {
+			if ((errno == EINTR) && !sig_stop)
+				continue;
+			/* Report is lost, as with printf() */
+			break;
+		}
+		p += n;
+		st_out.len -= n;
+	}
+	st_out.len = 0;
+}
+
+/*
+ * Compute CPU utilization (in percent) of a processor between two
+ * snapshots, itv being the interval (in jiffies) between them.
+ */
+void compute_cpu_pct(struct stats_cpu *scp, struct stats_cpu *scc,
+		     unsigned long long itv, double *v)
+{
+	v[CPU_PCT_USER] = ll_sp_value(scp->cpu_user, scc->cpu_user, itv);
+	v[CPU_PCT_NICE] = ll_sp_value(scp->cpu_nice, scc->cpu_nice, itv);
+	v[CPU_PCT_KERNEL] = ll_sp_value(scp->cpu_sys + scp->cpu_softirq + scp->cpu_hardirq,
+					scc->cpu_sys + scc->cpu_softirq + scc->cpu_hardirq,
+					itv);
+	v[CPU_PCT_IOWAIT] = ll_sp_value(scp->cpu_iowait, scc->cpu_iowait, itv);
+	v[CPU_PCT_STEAL] = ll_sp_value(scp->cpu_steal, scc->cpu_steal, itv);
+	v[CPU_PCT_IDLE] = (scc->cpu_idle < scp->cpu_idle) ?
+			  0.0 :
+			  ll_sp_value(scp->cpu_idle, scc->cpu_idle, itv);
+}
+
+/*
+ * Compute CPU utilization of processor number cpu (1 for the first one)
+ * of a sample. Return FALSE if the processor is offline.
+ */
+int compute_per_cpu_pct(struct stats_sample *smp, int cpu, double *v)
+{
+	struct stats_cpu *scc = smp->cpu[smp->curr] + cpu;
+	struct stats_cpu *scp = smp->cpu[!smp->curr] + cpu;
+	unsigned long long pc_itv;
+	int i;
+
+	if (!(scc->cpu_user + scc->cpu_nice + scc->cpu_sys +
+	      scc->cpu_iowait + scc->cpu_idle + scc->cpu_steal +
+	      scc->cpu_hardirq + scc->cpu_softirq))
+		return FALSE;
+
+	/* Recalculate itv for current proc */
+	if ((pc_itv = get_per_cpu_interval(scc, scp)) != 0) {
+		compute_cpu_pct(scp, scc, pc_itv, v);
+		return TRUE;
+	}
+
+	/*
+	 * If the CPU is tickless then there is no change in CPU values
+	 * but the sum of values is not zero.
+	 */
+	for (i = 0; i < NR_CPU_PCT; i++) {
+		v[i] = 0.0;
+	}
+	v[CPU_PCT_IDLE] = 100.0;
+
+	return TRUE;
+}
+
+/*
+ * Display CPU stats.
+ */
+void write_cpu_stat(struct stats_sample *smp, unsigned long long itv)
+{
+	int curr = smp->curr;
+	double v[NR_CPU_PCT];
+
+	compute_cpu_pct(smp->cpu[!curr], smp->cpu[curr], itv, v);
+	user_data   = v[CPU_PCT_USER];
+	nice_data   = v[CPU_PCT_NICE];
+	kernel_data = v[CPU_PCT_KERNEL];
+	io_data     = v[CPU_PCT_IOWAIT];
+	steal_data  = v[CPU_PCT_STEAL];
+	idle_data   = v[CPU_PCT_IDLE];
+
+	out_printf("\nCPU Usage");
+	out_printf("\nIn user space:			%6.2f%%", user_data);
+	out_printf("\nIn 'nice' (or, niceness):	%6.2f%%", nice_data);
+	out_printf("\nIn kernel space:		%6.2f%%", kernel_data);
+	out_printf("\nIn outstanding I/O requests:	%6.2f%%", io_data);
+	out_printf("\nIn time stolen from hypervisor:	%6.2f%%", steal_data);
+	out_printf("\nIdle time:			 %6.2f%%", idle_data);
+}
+
+/*
+ * Display memory stats.
+ */
+void write_mem_stat(struct stats_sample *smp)
+{
+	struct stats_memory *sm = &smp->mem;
+	struct stats_huge *sh = &smp->huge;
+
+	out_printf("\n\nMemory Usage");
+	out_printf("\nFree:				%10lu kB of %lu kB", sm->frmkb, sm->tlmkb);
+	out_printf("\nBuffers:			%10lu kB", sm->bufkb);
+	out_printf("\nCached:				%10lu kB", sm->camkb);
+	out_printf("\nDirty:				%10lu kB", sm->dirtykb);
+	out_printf("\nSlab:				%10lu kB", sm->slabkb);
+	/* As %commit in sar: Committed memory against RAM plus swap */
+	out_printf("\nCommitted:			%10lu kB (%.2f%%)", sm->comkb,
+		   (sm->tlmkb + sm->tlskb) ?
+		   (double) sm->comkb * 100.0 / (double) (sm->tlmkb + sm->tlskb) : 0.0);
+	out_printf("\nSwap used:			%10lu kB of %lu kB (%lu kB cached)",
+		   sm->tlskb - sm->frskb, sm->tlskb, sm->caskb);
+	out_printf("\nHuge pages free:		%10lu kB of %lu kB\n", sh->frhkb, sh->tlhkb);
+}
+
+/*
+ * Display CPU stats for each individual processor.
+ */
+void write_per_cpu_stat(struct stats_sample *smp)
+{
+	double v[NR_CPU_PCT];
+	int cpu, i;
+
+	out_printf("\n\nCPU       %%user   %%nice %%kernel %%iowait  %%steal   %%idle\n");
+
+	for (cpu = 1; cpu <= cpu_nr; cpu++) {
+		if (!compute_per_cpu_pct(smp, cpu, v))
+			/* CPU is offline: Ignore it */
+			continue;
+
+		out_printf("%-7d", cpu - 1);
+
+		/* %user %nice %kernel %iowait %steal %idle */
+		for (i = 0; i < NR_CPU_PCT; i++) {
+			out_char(' ');
+			out_fixed2(v[i], 7);
+		}
+		out_char('\n');
+	}
+}
+
+/*
+ * Show disk stat header.
+ */
+void write_disk_stat_header(int *fctr)
+{
+	if (DISPLAY_EXTENDED(flags)) {
+		/* Extended stats */
+		out_printf("Device:         rrqm/s   wrqm/s     r/s     w/s");
+		if (DISPLAY_MEGABYTES(flags)) {
+			out_printf("    rMB/s    wMB/s");
+			*fctr = 2048;
+		}
+		else if (DISPLAY_KILOBYTES(flags)) {
+			out_printf("    rkB/s    wkB/s");
+			*fctr = 2;
+		}
+		else {
+			out_printf("   rsec/s   wsec/s");
+		}
+		out_printf(" avgrq-sz avgqu-sz   await r_await w_await  svctm  %%util\n");
+	}
+	else {
+		/* Basic stats */
+		out_printf("\n\nDevice:            I/O Requests per Second");
+		if (DISPLAY_KILOBYTES(flags)) {
+			out_printf("    kB read/s    kB written/s    total kB read    total kB written\n");
+			*fctr = 2;
+		}
+		else if (DISPLAY_MEGABYTES(flags)) {
+			out_printf("    MB read/s    MB written/s    total MB read    total MB written\n");
+			*fctr = 2048;
+		}
+		else {
+			out_printf("   Blk_read/s   Blk_wrtn/s   Blk_read   Blk_wrtn\n");
+		}
+	}
+}
+
+/*
+ * Allocate (or enlarge) the structure-of-arrays snapshots and the
+ * extended stats columns so that they can hold dev_nr device slots.
+ */
+void salloc_io_soa(int dev_nr)
+{
+	int i, j;
+	size_t size;
+
+	/* Round up to a whole number of vectors */
+	dev_nr = (dev_nr + NR_SOA_LANES - 1) & ~(NR_SOA_LANES - 1);
+	if (dev_nr <= iosoa_nr)
+		return;
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < NR_SOA_COLS; j++) {
+			free(st_iosoa[i].col[j]);
+			size = sizeof(unsigned long long) * dev_nr;
+			if (posix_memalign((void **) &st_iosoa[i].col[j], SOA_ALIGN, size)) {
+				perror("posix_memalign");
+				exit(4);
+			}
+			memset(st_iosoa[i].col[j], 0, size);
+		}
+		st_iosoa[i].ts = 0;
+	}
+	for (j = 0; j < NR_XR_COLS; j++) {
+		free(st_xrates.col[j]);
+		size = sizeof(double) * dev_nr;
+		if (posix_memalign((void **) &st_xrates.col[j], SOA_ALIGN, size)) {
+			perror("posix_memalign");
+			exit(4);
+		}
+		memset(st_xrates.col[j], 0, size);
+	}
+	iosoa_nr = dev_nr;
+}
+
+/*
+ * Free structure-of-arrays snapshots.
+ */
+void sfree_io_soa(void)
+{
+	int i, j;
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < NR_SOA_COLS; j++) {
+			free(st_iosoa[i].col[j]);
+			st_iosoa[i].col[j] = NULL;
+		}
+		st_iosoa[i].ts = 0;
+	}
+	for (j = 0; j < NR_XR_COLS; j++) {
+		free(st_xrates.col[j]);
+		st_xrates.col[j] = NULL;
+	}
+	iosoa_nr = 0;
+}
+
+/*
+ * Copy the first dev_nr entries of an io_stats table into a
+ * structure-of-arrays snapshot.
+ */
+void fill_io_soa(struct io_stats_soa *soa, struct io_stats *st_io, int dev_nr)
+{
+	unsigned long long **c = soa->col;
+	int i;
+
+	for (i = 0; i < dev_nr; i++, st_io++) {
+		c[SOA_RD_SECTORS][i] = st_io->rd_sectors;
+		c[SOA_WR_SECTORS][i] = st_io->wr_sectors;
+		c[SOA_RD_IOS][i]     = st_io->rd_ios;
+		c[SOA_RD_MERGES][i]  = st_io->rd_merges;
+		c[SOA_WR_IOS][i]     = st_io->wr_ios;
+		c[SOA_WR_MERGES][i]  = st_io->wr_merges;
+		c[SOA_RD_TICKS][i]   = st_io->rd_ticks;
+		c[SOA_WR_TICKS][i]   = st_io->wr_ticks;
+		c[SOA_TOT_TICKS][i]  = st_io->tot_ticks;
+		c[SOA_RQ_TICKS][i]   = st_io->rq_ticks;
+	}
+}
+
+/*
+ * Compute extended stats for devices [from, to[, one device at a time.
+ * This is the reference implementation of the batch kernel below:
+ * Same formulas as compute_ext_disk_stats() and S_VALUE().
+ * Rates are computed as R_VALUE() does: Difference / rdiv * rmul.
+ * Differences are computed with the width of the kernel counters
+ * (unsigned long for I/Os and sectors, unsigned int for ticks) so that
+ * overflows are handled the same way.
+ */
+void compute_ext_rates_scalar(struct io_stats_soa *sc, struct io_stats_soa *sp,
+			      struct io_ext_rates *xr, double rdiv, double rmul,
+			      int from, int to)
+{
+	unsigned long long **c = sc->col, **p = sp->col;
+	double **x = xr->col;
+	double util;
+	unsigned long rd_ios, wr_ios, nr_ios;
+	unsigned int rd_ticks, wr_ticks;
+	int i;
+
+#define DELTA_UL(f)	((unsigned long) (c[f][i] - p[f][i]))
+#define DELTA_UI(f)	((unsigned int) (c[f][i] - p[f][i]))
+
+	for (i = from; i < to; i++) {
+		rd_ios   = DELTA_UL(SOA_RD_IOS);
+		wr_ios   = DELTA_UL(SOA_WR_IOS);
+		nr_ios   = rd_ios + wr_ios;
+		rd_ticks = DELTA_UI(SOA_RD_TICKS);
+		wr_ticks = DELTA_UI(SOA_WR_TICKS);
+
+		x[XR_RRQM][i]  = (double) DELTA_UL(SOA_RD_MERGES) / rdiv * rmul;
+		x[XR_WRQM][i]  = (double) DELTA_UL(SOA_WR_MERGES) / rdiv * rmul;
+		x[XR_RIO][i]   = (double) rd_ios / rdiv * rmul;
+		x[XR_WIO][i]   = (double) wr_ios / rdiv * rmul;
+		x[XR_RSEC][i]  = (double) DELTA_UL(SOA_RD_SECTORS) / rdiv * rmul;
+		x[XR_WSEC][i]  = (double) DELTA_UL(SOA_WR_SECTORS) / rdiv * rmul;
+		x[XR_AQUSZ][i] = (double) DELTA_UI(SOA_RQ_TICKS) / rdiv * rmul / 1000.0;
+
+		util = (double) DELTA_UI(SOA_TOT_TICKS) / rdiv * rmul;
+		x[XR_UTIL][i]  = util / 10.0;
+
+		x[XR_ARQSZ][i] = nr_ios ?
+				 (DELTA_UL(SOA_RD_SECTORS) + DELTA_UL(SOA_WR_SECTORS)) /
+				 (double) nr_ios : 0.0;
+		x[XR_AWAIT][i] = nr_ios ?
+				 (unsigned int) (rd_ticks + wr_ticks) / (double) nr_ios : 0.0;
+		x[XR_SVCTM][i] = nr_ios ?
+				 util / ((double) nr_ios * rmul / rdiv) : 0.0;
+		x[XR_R_AWAIT][i] = rd_ios ? rd_ticks / (double) rd_ios : 0.0;
+		x[XR_W_AWAIT][i] = wr_ios ? wr_ticks / (double) wr_ios : 0.0;
+	}
+
+#undef DELTA_UL
+#undef DELTA_UI
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+/*
+ * Batch kernel computing extended stats for NR_SOA_LANES devices at a
+ * time, written with GCC vector extensions. The same body is compiled
+ * twice: For AVX2 (one 256-bit register per vector) and for the SSE2
+ * baseline of x86-64 (two 128-bit registers per vector). The right one
+ * is selected at run time by compute_ext_rates().
+ */
+typedef unsigned long long v4du __attribute__ ((vector_size (32)));
+typedef long long          v4di __attribute__ ((vector_size (32)));
+typedef double             v4df __attribute__ ((vector_size (32)));
+
+/* Exact conversion of four 64-bit unsigned integers to doubles */
+#define V4DU_TO_DF(v)	((((v4df) (((v) >> 32) | 0x4530000000000000ULL)) -	\
+			  19342813118337666422669312.0 /* 2^84 + 2^52 */) +	\
+			 (v4df) (((v) & 0xffffffffULL) | 0x4330000000000000ULL))
+
+/* a / b where b != 0, else 0.0 */
+#define V4DF_DIV0(a, b, nz)	((v4df) ((v4di) ((a) / (b)) & (nz)))
+
+#define EXT_RATES_KERNEL(name, isa)						\
+static void name(struct io_stats_soa *sc, struct io_stats_soa *sp,		\
+		 struct io_ext_rates *xr, double rdiv, double rmul, int nr)	\
+		 __attribute__ ((target (isa)));				\
+static void name(struct io_stats_soa *sc, struct io_stats_soa *sp,		\
+		 struct io_ext_rates *xr, double rdiv, double rmul, int nr)	\
+{										\
+	unsigned long long **c = sc->col, **p = sp->col;			\
+	double **x = xr->col;							\
+	const v4du m_ul = (v4du) {0, 0, 0, 0} + (unsigned long) ~0UL;		\
+	const v4du m_ui = (v4du) {0, 0, 0, 0} + (unsigned int) ~0U;		\
+	const v4df vdiv = (v4df) {0, 0, 0, 0} + rdiv;				\
+	const v4df vmul = (v4df) {0, 0, 0, 0} + rmul;				\
+	v4du rd_ios, wr_ios, nr_ios, rd_ticks, wr_ticks;			\
+	v4di nz, rd_nz, wr_nz;							\
+	v4df util, d_nr_ios;							\
+	int i;									\
+										\
+	for (i = 0; i < nr; i += NR_SOA_LANES) {				\
+		rd_ios   = (*(v4du *) (c[SOA_RD_IOS] + i) - *(v4du *) (p[SOA_RD_IOS] + i)) & m_ul;	\
+		wr_ios   = (*(v4du *) (c[SOA_WR_IOS] + i) - *(v4du *) (p[SOA_WR_IOS] + i)) & m_ul;	\
+		nr_ios   = (rd_ios + wr_ios) & m_ul;				\
+		rd_ticks = (*(v4du *) (c[SOA_RD_TICKS] + i) - *(v4du *) (p[SOA_RD_TICKS] + i)) & m_ui;	\
+		wr_ticks = (*(v4du *) (c[SOA_WR_TICKS] + i) - *(v4du *) (p[SOA_WR_TICKS] + i)) & m_ui;	\
+		nz       = (v4di) (nr_ios != 0);				\
+		rd_nz    = (v4di) (rd_ios != 0);				\
+		wr_nz    = (v4di) (wr_ios != 0);				\
+		d_nr_ios = V4DU_TO_DF(nr_ios);					\
+										\
+		*(v4df *) (x[XR_RRQM] + i) = V4DU_TO_DF((*(v4du *) (c[SOA_RD_MERGES] + i) -	\
+			*(v4du *) (p[SOA_RD_MERGES] + i)) & m_ul) / vdiv * vmul;	\
+		*(v4df *) (x[XR_WRQM] + i) = V4DU_TO_DF((*(v4du *) (c[SOA_WR_MERGES] + i) -	\
+			*(v4du *) (p[SOA_WR_MERGES] + i)) & m_ul) / vdiv * vmul;	\
+		*(v4df *) (x[XR_RIO] + i)  = V4DU_TO_DF(rd_ios) / vdiv * vmul;	\
+		*(v4df *) (x[XR_WIO] + i)  = V4DU_TO_DF(wr_ios) / vdiv * vmul;	\
+		*(v4df *) (x[XR_RSEC] + i) = V4DU_TO_DF((*(v4du *) (c[SOA_RD_SECTORS] + i) -	\
+			*(v4du *) (p[SOA_RD_SECTORS] + i)) & m_ul) / vdiv * vmul;	\
+		*(v4df *) (x[XR_WSEC] + i) = V4DU_TO_DF((*(v4du *) (c[SOA_WR_SECTORS] + i) -	\
+			*(v4du *) (p[SOA_WR_SECTORS] + i)) & m_ul) / vdiv * vmul;	\
+		*(v4df *) (x[XR_AQUSZ] + i) = V4DU_TO_DF((*(v4du *) (c[SOA_RQ_TICKS] + i) -	\
+			*(v4du *) (p[SOA_RQ_TICKS] + i)) & m_ui) / vdiv * vmul / 1000.0;	\
+										\
+		util = V4DU_TO_DF((*(v4du *) (c[SOA_TOT_TICKS] + i) -		\
+			*(v4du *) (p[SOA_TOT_TICKS] + i)) & m_ui) / vdiv * vmul;	\
+		*(v4df *) (x[XR_UTIL] + i) = util / 10.0;			\
+										\
+		*(v4df *) (x[XR_ARQSZ] + i) = V4DF_DIV0(V4DU_TO_DF(		\
+			(((*(v4du *) (c[SOA_RD_SECTORS] + i) - *(v4du *) (p[SOA_RD_SECTORS] + i)) & m_ul) +	\
+			 ((*(v4du *) (c[SOA_WR_SECTORS] + i) - *(v4du *) (p[SOA_WR_SECTORS] + i)) & m_ul)) & m_ul),	\
+			d_nr_ios, nz);						\
+		*(v4df *) (x[XR_AWAIT] + i) = V4DF_DIV0(V4DU_TO_DF((rd_ticks + wr_ticks) & m_ui),	\
+			d_nr_ios, nz);						\
+		*(v4df *) (x[XR_SVCTM] + i) = V4DF_DIV0(util, d_nr_ios * vmul / vdiv, nz);	\
+		*(v4df *) (x[XR_R_AWAIT] + i) = V4DF_DIV0(V4DU_TO_DF(rd_ticks),	\
+			V4DU_TO_DF(rd_ios), rd_nz);				\
+		*(v4df *) (x[XR_W_AWAIT] + i) = V4DF_DIV0(V4DU_TO_DF(wr_ticks),	\
+			V4DU_TO_DF(wr_ios), wr_nz);				\
+	}									\
+}
+
+EXT_RATES_KERNEL(compute_ext_rates_avx2, "avx2")
+EXT_RATES_KERNEL(compute_ext_rates_sse2, "sse2")
+#endif
+
+/*
+ * Compute extended stats for the first dev_nr device slots, using the
+ * structure-of-arrays snapshots of current and previous intervals.
+ * rdiv and rmul give the interval: See R_VALUE().
+ */
+void compute_ext_rates(struct io_stats_soa *sc, struct io_stats_soa *sp,
+		       struct io_ext_rates *xr, double rdiv, double rmul, int dev_nr)
+{
+	/* Columns are padded: Process whole vectors */
+	dev_nr = (dev_nr + NR_SOA_LANES - 1) & ~(NR_SOA_LANES - 1);
+
+#if defined(__x86_64__) && defined(__GNUC__)
+	if (__builtin_cpu_supports("avx2")) {
+		compute_ext_rates_avx2(sc, sp, xr, rdiv, rmul, dev_nr);
+	}
+	else {
+		compute_ext_rates_sse2(sc, sp, xr, rdiv, rmul, dev_nr);
+	}
+#else
+	compute_ext_rates_scalar(sc, sp, xr, rdiv, rmul, 0, dev_nr);
+#endif
+}
+
+/*
+ * Display extended stats, read from partition.
+ * Values have been computed for every device by compute_ext_rates():
+ * i is the slot number of the device.
+ */
+void write_ext_stat(int i, int fctr, struct io_hdr_stats *shi,
+		    struct io_ext_rates *xr)
+{
+	/* Width of each column, as in the header */
+	static const int xr_width[NR_XR_COLS] = {8, 8, 7, 7, 8, 8, 8, 8, 7, 7, 7, 6, 6};
+	char *devname = NULL;
+	double **x = xr->col;
+	double v[NR_XR_COLS];
+	int c;
+
+	/* Print device name */
+	if (DISPLAY_PERSIST_NAME_I(flags)) {
+		devname = get_persistent_name_from_pretty(shi->name);
+	}
+	if (!devname) {
+		devname = shi->name;
+	}
+	if (DISPLAY_HUMAN_READ(flags)) {
+		out_str(devname, 0);
+		out_char('\n');
+		out_str("", 13);
+	}
+	else {
+		out_str(devname, 13);
+	}
+
+	for (c = 0; c < NR_XR_COLS; c++) {
+		v[c] = x[c][i];
+	}
+	v[XR_RSEC] /= fctr;
+	v[XR_WSEC] /= fctr;
+	/*
+	 * The ticks output is biased to output 1000 ticks per second.
+	 * Again: Ticks in milliseconds.
+	 * In the case of a device group (option -g), shi->used is the number of
+	 * devices in the group. Else shi->used equals 1.
+	 */
+	if (shi->used) {
+		/* shi->used should never be null here */
+		v[XR_UTIL] /= (double) shi->used;
+	}
+
+	/*     rrq/s wrq/s   r/s   w/s  rsec  wsec  rqsz  qusz await r_await w_await svctm %util */
+	for (c = 0; c < NR_XR_COLS; c++) {
+		out_char(' ');
+		out_fixed2(v[c], xr_width[c]);
+	}
+	out_char('\n');
+}
+
+/*
+ * Write basic stats, read from filesystem.
+ */
+void write_basic_stat(double rdiv, double rmul, int fctr,
+		      struct io_hdr_stats *shi, struct io_stats *ioi,
+		      struct io_stats *ioj)
+{
+	char *devname = NULL;
+	unsigned long long rd_sec, wr_sec;
+
+	/* Print device name */
+	if (DISPLAY_PERSIST_NAME_I(flags)) {
+		devname = get_persistent_name_from_pretty(shi->name);
+	}
+	if (!devname) {
+		devname = shi->name;
+	}
+	if (DISPLAY_HUMAN_READ(flags)) {
+		out_str(devname, 0);
+		out_char('\n');
+		out_str("", 13);
+	}
+	else {
+		out_str(devname, 13);
+	}
+
+	/* Print stats coming from /sys or /proc/diskstats */
+	rd_sec = ioi->rd_sectors - ioj->rd_sectors;
+	if ((ioi->rd_sectors < ioj->rd_sectors) && (ioj->rd_sectors <= 0xffffffff)) {
+		rd_sec &= 0xffffffff;
+	}
+	wr_sec = ioi->wr_sectors - ioj->wr_sectors;
+	if ((ioi->wr_sectors < ioj->wr_sectors) && (ioj->wr_sectors <= 0xffffffff)) {
+		wr_sec &= 0xffffffff;
+	}
+
+	out_str(" \t\t", 0);
+	out_fixed2(R_VALUE(ioj->rd_ios + ioj->wr_ios, ioi->rd_ios + ioi->wr_ios, rdiv, rmul), 8);
+	out_str(" \t", 0);
+	out_fixed2(R_VALUE(ioj->rd_sectors, ioi->rd_sectors, rdiv, rmul) / fctr, 12);
+	out_str(" \t", 0);
+	out_fixed2(R_VALUE(ioj->wr_sectors, ioi->wr_sectors, rdiv, rmul) / fctr, 12);
+	out_str(" \t", 0);
+	out_ull((unsigned long long) rd_sec / fctr, 10);
+	out_str(" \t", 0);
+	out_ull((unsigned long long) wr_sec / fctr, 10);
+	out_char('\n');
+}
+
+/*
+ * Open a /proc file once and allocate the buffer used to read it.
+ * Return 1 on success, 0 if the file could not be opened.
+ */
+int open_proc_file(struct proc_file *pf, char *filename)
+{
+	if ((pf->fd = open(filename, O_RDONLY)) < 0)
+		return 0;
+
+	if ((pf->buf = (char *) malloc(PROC_BUF_SIZE)) == NULL) {
+		perror("malloc");
+		exit(4);
+	}
+	pf->size = PROC_BUF_SIZE;
+	pf->len = 0;
+
+	return 1;
+}
+
+/*
+ * Read again the whole contents of an open /proc file.
+ * A single pread() from offset 0 is usually enough, except for files
+ * generated a page at a time (until_eof set), which are read until
+ * pread() returns 0. The buffer is only enlarged when the file no
+ * longer fits in it.
+ * Return the number of bytes read, or -1 on error.
+ */
+ssize_t read_proc_file(struct proc_file *pf)
+{
+	ssize_t n;
+
+	pf->len = 0;
+	while (1) {
+		n = pread(pf->fd, pf->buf + pf->len, pf->size - pf->len - 1, pf->len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		pf->len += n;
+		if (!n)
+			break;
+		if (pf->size - pf->len > PROC_BUF_SLACK) {
+			if (!pf->until_eof)
+				/*
+				 * Short read that left room for at least
+				 * one more line: We have everything.
+				 */
+				break;
+			continue;
+		}
+
+		/* Buffer too small: Double its size and read remaining data */
+		pf->size *= 2;
+		SREALLOC(pf->buf, char, pf->size);
+	}
+	pf->buf[pf->len] = '\0';
+
+	return pf->len;
+}
+
+/*
+ * Close a /proc file and free its buffer.
+ */
+void close_proc_file(struct proc_file *pf)
+{
+	if (pf->fd >= 0) {
+		close(pf->fd);
+		pf->fd = -1;
+	}
+	free(pf->buf);
+	pf->buf = NULL;
+	pf->size = pf->len = 0;
+}
+
+/*
+ * Get next line from a buffer filled by read_proc_file().
+ * The line is NUL terminated in place and *pos is moved to the next one.
+ * Return NULL when the end of the buffer has been reached.
+ */
+char *next_proc_line(struct proc_file *pf, char **pos)
+{
+	char *line = *pos, *eol;
+
+	if (line >= pf->buf + pf->len)
+		return NULL;
+
+	if ((eol = memchr(line, '\n', pf->buf + pf->len - line)) != NULL) {
+		*eol = '\0';
+		*pos = eol + 1;
+	}
+	else {
+		*pos = pf->buf + pf->len;
+	}
+
+	return line;
+}
+
+/*
+ * Convert the blank separated decimal fields found at *p, in place and
+ * in a single pass. Conversion stops at the first character that is
+ * neither a blank nor a digit, or when nr fields have been read.
+ * *p is moved past the last field converted.
+ * Return the number of fields converted.
+ */
+int parse_dec_fields(char **p, unsigned long long *val, int nr)
+{
+	char *c = *p;
+	unsigned long long v;
+	int i = 0;
+
+	while (i < nr) {
+		while ((*c == ' ') || (*c == '\t')) {
+			c++;
+		}
+		if ((*c < '0') || (*c > '9'))
+			break;
+
+		v = 0;
+		do {
+			v = v * 10 + (*c++ - '0');
+		}
+		while ((*c >= '0') && (*c <= '9'));
+		val[i++] = v;
+	}
+	*p = c;
+
+	return i;
+}
+
+/*
+ * Copy the blank terminated word found at *p into name (truncated to
+ * len - 1 characters) and move *p past it.
+ * Return the length of the word, or 0 if there was none.
+ */
+int parse_name_field(char **p, char *name, int len)
+{
+	char *c = *p;
+	int i = 0;
+
+	while ((*c == ' ') || (*c == '\t')) {
+		c++;
+	}
+	while (*c && (*c != ' ') && (*c != '\t') && (*c != '\n')) {
+		if (i < len - 1) {
+			name[i++] = *c;
+		}
+		c++;
+	}
+	name[i] = '\0';
+	*p = c;
+
+	return i;
+}
+
+/*
+ * Fill a stats_cpu structure with the fields of a cpu line of /proc/stat.
+ * All the fields don't necessarily exist, depending on the kernel version
+ * used: Missing ones are set to 0.
+ */
+void set_stats_cpu(struct stats_cpu *st_cpu, unsigned long long *v, int nr)
+{
+	unsigned long long *fld[] = {
+		&st_cpu->cpu_user, &st_cpu->cpu_nice, &st_cpu->cpu_sys,
+		&st_cpu->cpu_idle, &st_cpu->cpu_iowait, &st_cpu->cpu_hardirq,
+		&st_cpu->cpu_softirq, &st_cpu->cpu_steal, &st_cpu->cpu_guest,
+		&st_cpu->cpu_guest_nice
+	};
+	int i;
+
+	memset(st_cpu, 0, STATS_CPU_SIZE);
+	for (i = 0; (i < nr) && (i < 10); i++) {
+		*fld[i] = v[i];
+	}
+}
+
+/*
+ * Fill an io_stats structure with the counters read for a device
+ * from /proc/diskstats or /sys. nr is the number of counters found.
+ * Counters added by recent kernels (discard and flush stats) are accepted
+ * but not used. Any other number of counters is an unknown layout.
+ * Return 1 if the counters were recognized, 0 otherwise.
+ */
+int set_io_stats(struct io_stats *sdev, unsigned long long *v, int nr)
+{
+	if ((nr == NR_DISK_FIELDS) || (nr == NR_DISK_FIELDS_DISCARD) ||
+	    (nr == NR_DISK_FIELDS_FLUSH)) {
+		/* Device or partition */
+		sdev->rd_ios     = v[0];
+		sdev->rd_merges  = v[1];
+		sdev->rd_sectors = v[2];
+		sdev->rd_ticks   = (unsigned int) v[3];
+		sdev->wr_ios     = v[4];
+		sdev->wr_merges  = v[5];
+		sdev->wr_sectors = v[6];
+		sdev->wr_ticks   = (unsigned int) v[7];
+		sdev->ios_pgr    = (unsigned int) v[8];
+		sdev->tot_ticks  = (unsigned int) v[9];
+		sdev->rq_ticks   = (unsigned int) v[10];
+		return 1;
+	}
+	if (nr == NR_PART_FIELDS) {
+		/* Partition without extended statistics */
+		memset(sdev, 0, IO_STATS_SIZE);
+		sdev->rd_ios     = v[0];
+		sdev->rd_sectors = v[1];
+		sdev->wr_ios     = v[2];
+		sdev->wr_sectors = v[3];
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Read CPU stats from the buffered contents of /proc/stat.
+ * Same as read_stat_cpu() but uses the file descriptor opened in
+ * io_sys_init() instead of opening the file again.
+ */
+void read_stat_cpu_buf(struct stats_cpu *st_cpu, int nbr,
+		       unsigned long long *uptime, unsigned long long *uptime0)
+{
+	struct stats_cpu *st_cpu_i;
+	struct stats_cpu sc_cpu;
+	unsigned long long v[11];
+	char *line, *pos, *p;
+	int proc_nb, nr;
+
+	if (read_proc_file(&pf_stat) < 0) {
+		fprintf(stderr, "Cannot read %s: %s\n", STAT, strerror(errno));
+		exit(2);
+	}
+
+	/*
+	 * Offline CPUs have no line in /proc/stat:
+	 * Their stats are left to 0 so that they can be detected.
+	 */
+	if (nbr > 1) {
+		memset(st_cpu + 1, 0, STATS_CPU_SIZE * (nbr - 1));
+	}
+
+	pos = pf_stat.buf;
+	while ((line = next_proc_line(&pf_stat, &pos)) != NULL) {
+
+		if (!strncmp(line, "cpu ", 4)) {
+			p = line + 4;
+			nr = parse_dec_fields(&p, v, 10);
+			set_stats_cpu(st_cpu, v, nr);
+
+			/*
+			 * Compute the uptime of the system in jiffies (1/100ths of a second
+			 * if HZ=100).
+			 * Machine uptime is multiplied by the number of processors here.
+			 */
+			if (uptime != NULL) {
+				*uptime = st_cpu->cpu_user + st_cpu->cpu_nice    +
+					  st_cpu->cpu_sys  + st_cpu->cpu_idle    +
+					  st_cpu->cpu_iowait + st_cpu->cpu_steal +
+					  st_cpu->cpu_hardirq + st_cpu->cpu_softirq;
+			}
+		}
+		else if (!strncmp(line, "cpu", 3)) {
+			if (nbr > 1) {
+				/*
+				 * Read the number of the CPU and its stats.
+				 * Remember that this number begins with 0.
+				 */
+				p = line + 3;
+				if ((nr = parse_dec_fields(&p, v, 11)) < 1)
+					continue;
+				proc_nb = (int) v[0];
+				set_stats_cpu(&sc_cpu, v + 1, nr - 1);
+
+				if (proc_nb < (nbr - 1)) {
+					st_cpu_i = st_cpu + proc_nb + 1;
+					*st_cpu_i = sc_cpu;
+				}
+				/*
+				 * Compute uptime reduced to one proc using proc#0.
+				 * Done if /proc/uptime was unavailable.
+				 */
+				if (!proc_nb && uptime0 && !*uptime0) {
+					*uptime0 = sc_cpu.cpu_user + sc_cpu.cpu_nice   +
+						   sc_cpu.cpu_sys  + sc_cpu.cpu_idle   +
+						   sc_cpu.cpu_iowait + sc_cpu.cpu_steal +
+						   sc_cpu.cpu_hardirq + sc_cpu.cpu_softirq;
+				}
+			}
+		}
+		else
+			/* CPU lines come first: We can stop here */
+			break;
+	}
+}
+
+/*
+ * Build the perfect hash table of the fields of /proc/meminfo.
+ */
+void init_meminfo_hash(void)
+{
+	int i, h;
+
+	memset(meminfo_slot, 0, sizeof(meminfo_slot));
+	for (i = 0; i < NR_MEMINFO; i++) {
+		h = MEMINFO_HASH(meminfo_key[i], strlen(meminfo_key[i]));
+		if (meminfo_slot[h]) {
+			/* MEMINFO_HASH() must be changed */
+			fprintf(stderr, "Fields %s and %s of %s share slot %d\n",
+				meminfo_key[meminfo_slot[h] - 1], meminfo_key[i], MEMINFO, h);
+			exit(4);
+		}
+		meminfo_slot[h] = i + 1;
+	}
+}
+
+/*
+ * Read memory stats from the buffered contents of /proc/meminfo.
+ * Same as read_meminfo() and read_meminfo_huge(), but the file is kept
+ * open between intervals, and each line is matched with the fields
+ * through their perfect hash (see init_meminfo_hash()) instead of being
+ * compared with every one of them.
+ */
+void read_meminfo_buf(struct stats_memory *st_memory, struct stats_huge *st_hugepages)
+{
+	unsigned long long v[NR_MEMINFO];
+	char *line, *pos, *p;
+	int n, k;
+
+	if (read_proc_file(&pf_meminfo) < 0) {
+		fprintf(stderr, "Cannot read %s: %s\n", MEMINFO, strerror(errno));
+		exit(2);
+	}
+
+	memset(v, 0, sizeof(v));
+	pos = pf_meminfo.buf;
+	while ((line = next_proc_line(&pf_meminfo, &pos)) != NULL) {
+
+		/* "<name>:   <value> kB" */
+		if ((p = strchr(line, ':')) == NULL)
+			continue;
+		n = p - line;
+		k = meminfo_slot[MEMINFO_HASH(line, n)] - 1;
+		if ((k < 0) || strncmp(line, meminfo_key[k], n) || meminfo_key[k][n])
+			/* Not a field we read */
+			continue;
+
+		p++;
+		parse_dec_fields(&p, v + k, 1);
+	}
+
+	st_memory->tlmkb    = v[MI_MEMTOTAL];
+	st_memory->frmkb    = v[MI_MEMFREE];
+	st_memory->bufkb    = v[MI_BUFFERS];
+	st_memory->camkb    = v[MI_CACHED];
+	st_memory->caskb    = v[MI_SWAPCACHED];
+	st_memory->activekb = v[MI_ACTIVE];
+	st_memory->inactkb  = v[MI_INACTIVE];
+	st_memory->tlskb    = v[MI_SWAPTOTAL];
+	st_memory->frskb    = v[MI_SWAPFREE];
+	st_memory->dirtykb  = v[MI_DIRTY];
+	st_memory->anonpgkb = v[MI_ANONPAGES];
+	st_memory->slabkb   = v[MI_SLAB];
+	st_memory->kstackkb = v[MI_KERNELSTACK];
+	st_memory->pgtblkb  = v[MI_PAGETABLES];
+	st_memory->comkb    = v[MI_COMMITTED];
+	st_memory->vmusedkb = v[MI_VMALLOCUSED];
+
+	/* Huge pages are counted in pages */
+	st_hugepages->tlhkb = v[MI_HUGETOTAL] * v[MI_HUGESIZE];
+	st_hugepages->frhkb = v[MI_HUGEFREE] * v[MI_HUGESIZE];
+}
+
+/*
+ * Initialize stat structures.
+ */
+void init_stats(void)
+{
+	int i;
+
+	/* Allocate structures for CPU "all" and every individual CPU */
+	for (i = 0; i < 2; i++) {
+		if ((st_cpu[i] =
+		     (struct stats_cpu *) malloc(STATS_CPU_SIZE * (cpu_nr + 1))) == NULL) {
+			perror("malloc");
+			exit(4);
+		}
+		memset(st_cpu[i], 0, STATS_CPU_SIZE * (cpu_nr + 1));
+	}
+}
+
+/*
+ * Allocate and initialize structures for I/O devices.
+ */
+void salloc_device(int dev_nr)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if ((st_iodev[i] =
+		     (struct io_stats *) malloc(IO_STATS_SIZE * dev_nr)) == NULL) {
+			perror("malloc");
+			exit(4);
+		}
+		memset(st_iodev[i], 0, IO_STATS_SIZE * dev_nr);
+	}
+
+	if ((st_hdr_iodev =
+	     (struct io_hdr_stats *) malloc(IO_HDR_STATS_SIZE * dev_nr)) == NULL) {
+		perror("malloc");
+		exit(4);
+	}
+	memset(st_hdr_iodev, 0, IO_HDR_STATS_SIZE * dev_nr);
+}
+
+/*
+ * Look for the specified device in the device list.
+ */
+int update_dev_list(int *dlist_idx, char *device_name)
+{
+	int i;
+	struct io_dlist *sdli = st_dev_list;
+
+	for (i = 0; i < *dlist_idx; i++, sdli++) {
+		if (!strcmp(sdli->dev_name, device_name))
+			break;
+	}
+
+	if (i == *dlist_idx) {
+		/*
+		 * Device not found: Store it.
+		 * Group names will be distinguished from real device names
+		 * thanks to their names which begin with a space.
+		 */
+		(*dlist_idx)++;
+		strncpy(sdli->dev_name, device_name, MAX_NAME_LEN - 1);
+	}
+
+	return i;
+}
+
+/*
+ * Compute device group stats.
+ */
+void compute_device_groups_stats(int curr)
+{
+	struct io_stats gdev, *ioi;
+	struct io_hdr_stats *shi = st_hdr_iodev;
+	int i, nr_disks;
+
+	memset(&gdev, 0, IO_STATS_SIZE);
+	nr_disks = 0;
+
+	for (i = 0; i < iodev_nr; i++, shi++) {
+		if (shi->used && (shi->status == DISK_REGISTERED)) {
+			ioi = st_iodev[curr] + i;
+
+			if (!DISPLAY_UNFILTERED(flags)) {
+				if (!ioi->rd_ios && !ioi->wr_ios)
+					continue;
+			}
+
+			gdev.rd_ios     += ioi->rd_ios;
+			gdev.rd_merges  += ioi->rd_merges;
+			gdev.rd_sectors += ioi->rd_sectors;
+			gdev.rd_ticks   += ioi->rd_ticks;
+			gdev.wr_ios     += ioi->wr_ios;
+			gdev.wr_merges  += ioi->wr_merges;
+			gdev.wr_sectors += ioi->wr_sectors;
+			gdev.wr_ticks   += ioi->wr_ticks;
+			gdev.ios_pgr    += ioi->ios_pgr;
+			gdev.tot_ticks  += ioi->tot_ticks;
+			gdev.rq_ticks   += ioi->rq_ticks;
+			nr_disks++;
+		}
+		else if (shi->status == DISK_GROUP) {
+			save_stats(shi->name, curr, &gdev);
+			shi->used = nr_disks;
+			nr_disks = 0;
+			memset(&gdev, 0, IO_STATS_SIZE);
+		}
+	}
+}
+
+/*
+ * Get the interval used to compute device rates of a sample:
+ * A rate is a difference / rdiv * rmul.
+ */
+void get_device_itv(struct stats_sample *smp, double *rdiv, double *rmul)
+{
+	int curr = smp->curr;
+	unsigned long long itv;
+
+	if (USE_HIRES(flags) && smp->ts[!curr] && (smp->ts[curr] > smp->ts[!curr])) {
+		/* Device rates are computed from the nanosecond timestamps of the snapshots */
+		*rdiv = (double) (smp->ts[curr] - smp->ts[!curr]);
+		*rmul = (double) NSEC_PER_SEC;
+		return;
+	}
+
+	/* Interval in jiffies (also used for the stats since boot) */
+	if (cpu_nr > 1) {
+		/* On SMP machines, use the interval of one processor */
+		itv = get_interval(smp->uptime0[!curr], smp->uptime0[curr]);
+	}
+	else {
+		itv = get_interval(smp->uptime[!curr], smp->uptime[curr]);
+	}
+	*rdiv = (double) itv;
+	*rmul = (double) HZ;
+}
+
+/*
+ * Tell whether a structure-of-arrays snapshot holds snapshot i of a
+ * sample.
+ */
+int soa_holds(struct io_stats_soa *soa, struct stats_sample *smp, int i)
+{
+	return smp->ts[i] && (soa->ts == smp->ts[i]) &&
+	       (soa->dict_gen == smp->dict_gen) && (soa->dev_nr == smp->iodev_nr);
+}
+
+/*
+ * Copy snapshot i of a sample into a structure-of-arrays snapshot.
+ */
+void set_io_soa(struct io_stats_soa *soa, struct stats_sample *smp, int i)
+{
+	fill_io_soa(soa, smp->iodev[i], smp->iodev_nr);
+	soa->ts = smp->ts[i];
+	soa->dict_gen = smp->dict_gen;
+	soa->dev_nr = smp->iodev_nr;
+}
+
+/*
+ * Compute extended stats of all the devices of a sample at once.
+ * They are saved in st_xrates, indexed by device slot.
+ * The previous snapshot of the sample is usually the current snapshot of
+ * the sample the stats were computed for last time: Its structure-of-
+ * arrays copy is kept, and only the current snapshot is transposed into
+ * the other one. Both are transposed when samples don't follow each
+ * other (e.g. first sample of a chunk being replayed) or when the list
+ * of devices has changed.
+ */
+void compute_sample_ext_rates(struct stats_sample *smp, double rdiv, double rmul)
+{
+	int curr = smp->curr;
+	struct io_stats_soa *sc, *sp;
+
+	salloc_io_soa(smp->iodev_nr);
+
+	if (soa_holds(&st_iosoa[0], smp, !curr)) {
+		sp = &st_iosoa[0];
+		sc = &st_iosoa[1];
+	}
+	else {
+		sp = &st_iosoa[1];
+		sc = &st_iosoa[0];
+		if (!soa_holds(sp, smp, !curr)) {
+			set_io_soa(sp, smp, !curr);
+		}
+	}
+	if (!soa_holds(sc, smp, curr)) {
+		set_io_soa(sc, smp, curr);
+	}
+
+	compute_ext_rates(sc, sp, &st_xrates, rdiv, rmul, smp->iodev_nr);
+}
+
+/*
+ * Print all stats and uptime.
+ */
+void write_stats(struct stats_sample *smp)
+{
+	int curr = smp->curr;
+	int dev, i, fctr = 1;
+	unsigned long long itv;
+	double rdiv, rmul;
+	struct io_hdr_stats *shi;
+	struct io_dlist *st_dev_list_i;
+
+	/* Test stdout */
+	TEST_STDOUT(STDOUT_FILENO);
+
+	/* Print time stamp */
+	if (DISPLAY_TIMESTAMP(flags)) {
+		if (DISPLAY_ISO(flags)) {
+			strftime(timestamp, sizeof(timestamp), "%FT%T%z", &smp->rectime);
+		}
+		else {
+			strftime(timestamp, sizeof(timestamp), "%x %X", &smp->rectime);
+		}
+		out_printf("%s\n", timestamp);
+#ifdef DEBUG
+		if (DISPLAY_DEBUG(flags)) {
+			fprintf(stderr, "%s\n", timestamp);
+		}
+#endif
+	}
+
+	if (interval_ns > 0) {
+		/* Report how late this sample was taken and intervals missed so far */
+		out_printf("Scheduling jitter: %.3f ms, missed intervals: %llu",
+		           (double) smp->jitter / 1000000.0, smp->missed);
+		if (ring_size > 0) {
+			/* Samples dropped because the writer couldn't keep up */
+			out_printf(", dropped samples: %llu", smp->dropped);
+		}
+		out_printf("\n");
+	}
+
+	if (log_fp) {
+		write_log_begin(smp);
+	}
+
+	/* Interval is multiplied by the number of processors */
+	itv = get_interval(smp->uptime[!curr], smp->uptime[curr]);
+
+	if (DISPLAY_CPU(flags)) {
+#ifdef DEBUG
+		if (DISPLAY_DEBUG(flags)) {
+			/* Debug output */
+			fprintf(stderr, "itv=%llu st_cpu[curr]{ cpu_user=%llu cpu_nice=%llu "
+					"cpu_sys=%llu cpu_idle=%llu cpu_iowait=%llu cpu_steal=%llu "
+					"cpu_hardirq=%llu cpu_softirq=%llu cpu_guest=%llu "
+					"cpu_guest_nice=%llu }\n",
+				itv,
+				smp->cpu[curr]->cpu_user,
+				smp->cpu[curr]->cpu_nice,
+				smp->cpu[curr]->cpu_sys,
+				smp->cpu[curr]->cpu_idle,
+				smp->cpu[curr]->cpu_iowait,
+				smp->cpu[curr]->cpu_steal,
+				smp->cpu[curr]->cpu_hardirq,
+				smp->cpu[curr]->cpu_softirq,
+				smp->cpu[curr]->cpu_guest,
+				smp->cpu[curr]->cpu_guest_nice);
+		}
+#endif
+
+		/* Display CPU utilization */
+		write_cpu_stat(smp, itv);
+		if (log_fp) {
+			write_log_cpu();
+		}
+
+		if (DISPLAY_PER_CPU(flags)) {
+			/* Display utilization of each individual CPU */
+			write_per_cpu_stat(smp);
+		}
+	}
+
+	if (smp->has_memory) {
+		/* Display memory usage */
+		write_mem_stat(smp);
+	}
 
 	if (cpu_nr > 1) {
 		/* On SMP machines, reduce itv to one processor (see note above) */
-		itv = get_interval(uptime0[!curr], uptime0[curr]);
+		itv = get_interval(smp->uptime0[!curr], smp->uptime0[curr]);
+	}
+
+	get_device_itv(smp, &rdiv, &rmul);
+
+	if (DISPLAY_DISK(flags)) {
+		struct io_stats *ioi, *ioj;
+
+		shi = smp->hdr;
+
+		/* Display disk stats header */
+		write_disk_stat_header(&fctr);
+
+		if (DISPLAY_EXTENDED(flags)) {
+			compute_sample_ext_rates(smp, rdiv, rmul);
+		}
+
+		for (i = 0; i < smp->iodev_nr; i++, shi++) {
+			if (shi->used) {
+
+				if (dlist_idx && !HAS_SYSFS(flags)) {
+					/*
+					 * With /proc/diskstats, stats for every device
+					 * are read even if we have entered a list on devices
+					 * on the command line. Thus we need to check
+					 * if stats for current device are to be displayed.
+					 */
+					for (dev = 0; dev < dlist_idx; dev++) {
+						st_dev_list_i = st_dev_list + dev;
+						if (!strcmp(shi->name, st_dev_list_i->dev_name))
+							break;
+					}
+					if (dev == dlist_idx)
+						/* Device not found in list: Don't display it */
+						continue;
+				}
+
+				ioi = smp->iodev[curr] + i;
+				ioj = smp->iodev[!curr] + i;
+
+				if (!DISPLAY_UNFILTERED(flags)) {
+					if (!ioi->rd_ios && !ioi->wr_ios)
+						continue;
+				}
+
+				if (DISPLAY_ZERO_OMIT(flags)) {
+					if ((ioi->rd_ios == ioj->rd_ios) &&
+						(ioi->wr_ios == ioj->wr_ios))
+						/* No activity: Ignore it */
+						continue;
+				}
+
+				if (DISPLAY_GROUP_TOTAL_ONLY(flags)) {
+					if (shi->status != DISK_GROUP)
+						continue;
+				}
+#ifdef DEBUG
+				if (DISPLAY_DEBUG(flags)) {
+					/* Debug output */
+					fprintf(stderr, "name=%s itv=%llu fctr=%d ioi{ rd_sectors=%lu "
+							"wr_sectors=%lu rd_ios=%lu rd_merges=%lu rd_ticks=%u "
+							"wr_ios=%lu wr_merges=%lu wr_ticks=%u ios_pgr=%u tot_ticks=%u "
+							"rq_ticks=%u }\n",
+						shi->name,
+						itv,
+						fctr,
+						ioi->rd_sectors,
+						ioi->wr_sectors,
+						ioi->rd_ios,
+						ioi->rd_merges,
+						ioi->rd_ticks,
+						ioi->wr_ios,
+						ioi->wr_merges,
+						ioi->wr_ticks,
+						ioi->ios_pgr,
+						ioi->tot_ticks,
+						ioi->rq_ticks
+						);
+				}
+#endif
+
+				if (DISPLAY_EXTENDED(flags)) {
+					write_ext_stat(i, fctr, shi, &st_xrates);
+				}
+				else {
+					write_basic_stat(rdiv, rmul, fctr, shi, ioi, ioj);
+				}
+
+				if (log_fp) {
+					write_log_disk(rdiv, rmul, shi, ioi, ioj);
+				}
+			}
+		}
+		out_printf("\n");
+	}
+
+	if (smp->has_net) {
+		/* Display network interface stats */
+		write_net_stat(smp, rdiv, rmul);
+	}
+
+	if (smp->has_irq) {
+		/* Display top interrupt sources */
+		write_irq_top(smp->irq, curr, irq_top_nr, rdiv, rmul);
+	}
+
+	if (smp->has_softirq) {
+		/* Display softirqs served by every CPU */
+		write_softirq_stat(smp->softirq, curr, rdiv, rmul);
+	}
+
+	/* Write the whole report at once */
+	out_flush();
+
+	if (log_fp) {
+		write_log_end();
+	}
+}
+
+/*
+ * Save and publish the stats of a sample (sampler side).
+ * This is done before the sample is queued to be displayed: A slow or
+ * blocked output never delays recorded files, rollups and publishers,
+ * and samples dropped from the ring are still recorded.
+ */
+void export_stats(struct stats_sample *smp)
+{
+	double rdiv, rmul;
+
+	if (rec_out) {
+		/* Save raw stats */
+		rec_write_sample(rec_out, smp);
+	}
+
+	if (hist_out) {
+		/* Keep raw stats in the history file */
+		rec_write_sample(hist_out, smp);
+	}
+
+	if (!ru_out && !shm_out && !prom_out && !push_out)
+		return;
+
+	/* Extended stats of the devices, as they are displayed */
+	get_device_itv(smp, &rdiv, &rmul);
+	compute_sample_ext_rates(smp, rdiv, rmul);
+
+	if (ru_out) {
+		/* Summarize stats over minutes and hours */
+		ru_add_sample(ru_out, smp);
+	}
+
+	if (shm_out) {
+		/* Let local readers get the stats without reading /proc */
+		shm_publish(shm_out, smp);
+	}
+
+	if (prom_out) {
+		/* Scrapes are served from this page until next interval */
+		prom_render(prom_out, smp);
+	}
+
+	if (push_out) {
+		/* Whole interval in as few datagrams as possible */
+		push_send(push_out, smp);
+	}
+}
+
+/*
+ * Allocate structures for all CPU and I/O devices.
+ */
+void salloc_dev_list(int list_len)
+{
+	if ((st_dev_list = (struct io_dlist *) malloc(IO_DLIST_SIZE * list_len)) == NULL) {
+		perror("malloc");
+		exit(4);
+	}
+	memset(st_dev_list, 0, IO_DLIST_SIZE * list_len);
+}
+
+/*
+ * Set the output unit for disks.
+ */
+void set_disk_output_unit(void)
+{
+	char *e;
+
+	if (DISPLAY_KILOBYTES(flags) || DISPLAY_MEGABYTES(flags))
+		return;
+
+	/* Check POSIXLY_CORRECT environment variable */
+	if ((e = getenv(ENV_POSIXLY_CORRECT)) == NULL) {
+		/* Variable not set: Unit is kB/s and not blocks/s */
+		flags |= I_D_KILOBYTES;
+	}
+}
+
+/*
+ * Allocate and initialize structures.
+ */
+void io_sys_init(void)
+{
+	/*
+	 * Highest processor number plus one (as in mpstat), so that CPUs
+	 * that are not numbered consecutively all have a row in per-CPU tables.
+	 */
+	cpu_nr = get_cpu_nr(~0, TRUE);
+
+	/* Allocate and init stat common counters */
+	init_stats();
+
+	/*
+	 * Open /proc/stat once for all. If it cannot be opened,
+	 * read_stat_cpu() will be used instead at each interval.
+	 */
+	open_proc_file(&pf_stat, STAT);
+
+	if (DISPLAY_MEMORY(flags)) {
+		/*
+		 * Keep /proc/meminfo open too. If it cannot be opened,
+		 * read_meminfo() will be used instead at each interval.
+		 */
+		init_meminfo_hash();
+		open_proc_file(&pf_meminfo, MEMINFO);
+	}
+
+	if (DISPLAY_NET(flags)) {
+		/* Keep /proc/net/dev open, and size the interface tables */
+		net_open(&st_net);
+	}
+
+	if (DISPLAY_IRQ_CPU(actflags)) {
+		/* Keep /proc/interrupts open, and size the IRQ x CPU matrices */
+		irq_open(&st_irq, INTERRUPTS, cpu_nr);
+	}
+
+	if (DISPLAY_SOFTIRQS(actflags)) {
+		/* Same for /proc/softirqs */
+		irq_open(&st_softirq, SOFTIRQS, cpu_nr);
+	}
+
+	/* Get number of block devices and partitions in /proc/diskstats. */
+	if ((iodev_nr = get_diskstats_dev_nr(CNT_PART, CNT_ALL_DEV)) > 0)
+        {
+		flags |= I_F_HAS_DISKSTATS;
+		iodev_nr += NR_DEV_PREALLOC;
+
+		/* Keep /proc/diskstats open between intervals */
+		open_proc_file(&pf_diskstats, DISKSTATS);
+	}
+
+	if (!HAS_DISKSTATS(flags) ||
+	    (DISPLAY_PARTITIONS(flags) && !DISPLAY_PART_ALL(flags)))
+        {
+		/*
+		 * If /proc/diskstats exists but we also want stats for the partitions
+		 * of a particular device, stats will have to be found in /sys.
+		 * So we need to know if /sys is mounted or not, and set flags accordingly.
+		 */
+
+		/* Get number of block devices (and partitions) in sysfs. */
+		if ((iodev_nr = get_sysfs_dev_nr(DISPLAY_PARTITIONS(flags))) > 0) {
+			flags |= I_F_HAS_SYSFS;
+			iodev_nr += NR_DEV_PREALLOC;
+		}
+		else {
+			fprintf(stderr, "Cannot find disk data\n");
+			exit(2);
+		}
+	}
+
+	/* Also allocate stat structures for "group" devices */
+	iodev_nr += group_nr;
+
+	/*
+	 * Allocate structures for number of disks found, but also
+	 * for groups of devices if option -g has been entered on the command line.
+	 * iodev_nr must be <> 0.
+	 */
+	salloc_device(iodev_nr);
+}
+
+/*
+ * Save the devices and group names when the stats are about to be displayed.
+ */
+void presave_device_list(void)
+{
+	int i;
+	struct io_hdr_stats *shi = st_hdr_iodev;
+	struct io_dlist *sdli = st_dev_list;
+
+	if (dlist_idx>0)
+        {
+		/* First, save the last group name entered on the command line in the list */
+		update_dev_list(&dlist_idx, group_name);
+
+		/* Now save devices and group names in the io_hdr_stats structures */
+		for (i = 0; (i < dlist_idx) && (i < iodev_nr); i++, shi++, sdli++)
+                {
+			strcpy(shi->name, sdli->dev_name);
+			shi->used = TRUE;
+			if (shi->name[0] == ' ')
+                        {
+				/* Current device name is in fact the name of a group */
+				shi->status = DISK_GROUP;
+			}
+			else
+                        {
+				shi->status = DISK_REGISTERED;
+			}
+		}
+	}
+	else
+        {
+		/*
+		 * No device names have been entered on the command line but
+		 * the name of a group. Save that name at the end of the
+		 * data table so that all devices that will be read will be
+		 * included in that group.
+		 */
+		shi += iodev_nr - 1;
+		strcpy(shi->name, group_name);
+		shi->used = TRUE;
+		shi->status = DISK_GROUP;
+	}
+}
+
+/*
+ * Read stats for current block device.
+ */
+int read_sysfs_file_stat(int curr, char *filename, char *dev_name)
+{
+	int fd, nr;
+	ssize_t n;
+	char buf[512], *p = buf;
+	struct io_stats sdev;
+	unsigned long long v[NR_DISK_FIELDS_PARSED];
+
+	/* Try to read given stat file */
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return 0;
+
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n < 0)
+		return 0;
+	buf[n] = '\0';
+
+	nr = parse_dec_fields(&p, v, NR_DISK_FIELDS_PARSED);
+
+	if (set_io_stats(&sdev, v, nr) &&
+	    ((nr >= NR_DISK_FIELDS) || !DISPLAY_EXTENDED(flags))) {
+		/*
+		 * In fact, we _don't_ save stats if it's a partition without
+		 * extended stats and yet we want to display ext stats.
+		 */
+		save_stats(dev_name, curr, &sdev);
+	}
+
+	return 1;
+}
+
+/*
+ * Read stats for all partitions of a given device.
+ */
+void read_sysfs_dlist_part_stat(int curr, char *dev_name)
+{
+	DIR *dir;
+	struct dirent *drd;
+	char dfile[MAX_PF_NAME], filename[MAX_PF_NAME];
+
+	snprintf(dfile, MAX_PF_NAME, "%s/%s", SYSFS_BLOCK, dev_name);
+	dfile[MAX_PF_NAME - 1] = '\0';
+
+	/* Open current device directory in /sys/block */
+	if ((dir = opendir(dfile)) == NULL)
+		return;
+
+	/* Get current entry */
+	while ((drd = readdir(dir)) != NULL) {
+		if (!strcmp(drd->d_name, ".") || !strcmp(drd->d_name, ".."))
+			continue;
+		snprintf(filename, MAX_PF_NAME, "%s/%s/%s", dfile, drd->d_name, S_STAT);
+		filename[MAX_PF_NAME - 1] = '\0';
+
+		/* Read current partition stats */
+		read_sysfs_file_stat(curr, filename, drd->d_name);
+	}
+
+	/* Close device directory */
+	closedir(dir);
+}
+
+/*
+ * Free any unused (unregistered) entries.
+ */
+void free_unregistered_entries(int iodev_nr, struct io_hdr_stats *st_hdr_iodev)
+{
+	int i;
+	struct io_hdr_stats *shi = st_hdr_iodev;
+
+	for (i = 0; i < iodev_nr; i++, shi++) {
+		if ((shi->status == DISK_UNREGISTERED) && shi->used) {
+			/* Remove device from the index and make its slot available again */
+			remove_dev_slot(i);
+			shi->used = FALSE;
+			iodev_free[iodev_free_nr++] = i;
+			dict_gen++;
+		}
+	}
+}
+
+/*
+ * Set all individual device entries to "unregistered."
+ */
+void set_entries_unregistered(int iodev_nr, struct io_hdr_stats *st_hdr_iodev)
+{
+	int i;
+	struct io_hdr_stats *shi = st_hdr_iodev;
+
+	for (i = 0; i < iodev_nr; i++, shi++) {
+		if (shi->status == DISK_REGISTERED) {
+			shi->status = DISK_UNREGISTERED;
+		}
+	}
+}
+
+/*
+ * Read stats for one device from a line of /proc/diskstats.
+ */
+void read_diskstats_line(int curr, char *line)
+{
+	char dev_name[MAX_NAME_LEN];
+	char *dm_name;
+	struct io_stats sdev;
+	unsigned long long v[NR_DISK_FIELDS_PARSED];
+	int nr;
+	char *ioc_dname;
+	unsigned int major, minor;
+
+	/*
+	 * major minor name rio rmerge rsect ruse wio wmerge wsect wuse running use aveq
+	 * [dio dmerge dsect duse [fio fuse]]
+	 */
+	if (parse_dec_fields(&line, v, 2) != 2)
+		return;
+	major = (unsigned int) v[0];
+	minor = (unsigned int) v[1];
+	if (!parse_name_field(&line, dev_name, MAX_NAME_LEN))
+		return;
+	nr = parse_dec_fields(&line, v, NR_DISK_FIELDS_PARSED);
+
+	if (nr >= NR_DISK_FIELDS) {
+		/* Device or partition */
+		if (!dlist_idx && !DISPLAY_PARTITIONS(flags) &&
+		    !is_device(dev_name, ACCEPT_VIRTUAL_DEVICES))
+			return;
+	}
+	else if (nr == NR_PART_FIELDS) {
+		/* Partition without extended statistics */
+		if (DISPLAY_EXTENDED(flags) ||
+		    (!dlist_idx && !DISPLAY_PARTITIONS(flags)))
+			return;
+	}
+	if (!set_io_stats(&sdev, v, nr))
+		/* Unknown entry: Ignore it */
+		return;
+
+	if ((ioc_dname = ioc_name(major, minor)) != NULL) {
+		if (strcmp(dev_name, ioc_dname) && strcmp(ioc_dname, K_NODEV)) {
+			/*
+			 * No match: Use name generated from sysstat.ioconf data
+			 * (if different from "nodev") works around known issues
+			 * with EMC PowerPath.
+			 */
+			strncpy(dev_name, ioc_dname, MAX_NAME_LEN);
+		}
+	}
+
+	if ((DISPLAY_DEVMAP_NAME(flags)) && (major == dm_major)) {
+		/*
+		 * If the device is a device mapper device, try to get its
+		 * assigned name of its logical device.
+		 */
+		dm_name = transform_devmapname(major, minor);
+		if (dm_name) {
+			strncpy(dev_name, dm_name, MAX_NAME_LEN);
+		}
+	}
+
+	save_stats(dev_name, curr, &sdev);
+}
+
+/*
+ * Read stats from directory "/proc/diskstats."
+ */
+void read_diskstats_stat(int curr)
+{
+	FILE *fp;
+	char line[256];
+	char *l, *pos;
+
+	/* Every I/O device entry is potentially unregistered */
+	set_entries_unregistered(iodev_nr, st_hdr_iodev);
+
+	if (pf_diskstats.fd >= 0) {
+		/* File is already open: Read it again with a single pread() */
+		if (read_proc_file(&pf_diskstats) < 0)
+			return;
+
+		pos = pf_diskstats.buf;
+		while ((l = next_proc_line(&pf_diskstats, &pos)) != NULL) {
+			read_diskstats_line(curr, l);
+		}
+	}
+	else {
+		if ((fp = fopen(DISKSTATS, "r")) == NULL)
+			return;
+
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			read_diskstats_line(curr, line);
+		}
+		fclose(fp);
 	}
 
-	if (DISPLAY_DISK(flags)) {
-		struct io_stats *ioi, *ioj;
+	/* Free structures corresponding to unregistered devices */
+	free_unregistered_entries(iodev_nr, st_hdr_iodev);
+}
+
+/*
+ * Read stats for devices requested in command line parameters.
+ */
+void read_sysfs_dlist_stat(int curr)
+{
+	int dev, ok;
+	char filename[MAX_PF_NAME];
+	char *slash;
+	struct io_dlist *st_dev_list_i;
+
+	/* Every I/O device (or partition) is potentially unregistered */
+	set_entries_unregistered(iodev_nr, st_hdr_iodev);
+
+	for (dev = 0; dev < dlist_idx; dev++) {
+		st_dev_list_i = st_dev_list + dev;
+
+		/* Some devices may have a slash in their name (eg. cciss/c0d0...) */
+		while ((slash = strchr(st_dev_list_i->dev_name, '/'))) {
+			*slash = '!';
+		}
+
+		snprintf(filename, MAX_PF_NAME, "%s/%s/%s",
+			 SYSFS_BLOCK, st_dev_list_i->dev_name, S_STAT);
+		filename[MAX_PF_NAME - 1] = '\0';
 
-		shi = st_hdr_iodev;
+		/* Read device stats */
+		ok = read_sysfs_file_stat(curr, filename, st_dev_list_i->dev_name);
 
-		/* Display disk stats header */
-		write_disk_stat_header(&fctr);
+		if (ok && st_dev_list_i->disp_part) {
+			/* Also read stats for its partitions */
+			read_sysfs_dlist_part_stat(curr, st_dev_list_i->dev_name);
+		}
+	}
 
-		for (i = 0; i < iodev_nr; i++, shi++) {
-			if (shi->used) {
+	/* Free structures corresponding to unregistered devices */
+	free_unregistered_entries(iodev_nr, st_hdr_iodev);
+}
 
-				if (dlist_idx && !HAS_SYSFS(flags)) {
-					/*
-					 * With /proc/diskstats, stats for every device
-					 * are read even if we have entered a list on devices
-					 * on the command line. Thus we need to check
-					 * if stats for current device are to be displayed.
-					 */
-					for (dev = 0; dev < dlist_idx; dev++) {
-						st_dev_list_i = st_dev_list + dev;
-						if (!strcmp(shi->name, st_dev_list_i->dev_name))
-							break;
-					}
-					if (dev == dlist_idx)
-						/* Device not found in list: Don't display it */
-						continue;
-				}
+/*
+ * Read stats in the filesystem for the devices we have discovered.
+ */
+void read_sysfs_stat(int curr)
+{
+	DIR *dir;
+	struct dirent *drd;
+	char filename[MAX_PF_NAME];
+	int ok;
 
-				ioi = st_iodev[curr] + i;
-				ioj = st_iodev[!curr] + i;
+	/* Every I/O device entry is potentially unregistered */
+	set_entries_unregistered(iodev_nr, st_hdr_iodev);
 
-				if (!DISPLAY_UNFILTERED(flags)) {
-					if (!ioi->rd_ios && !ioi->wr_ios)
-						continue;
-				}
+	/* Open /sys/block directory */
+	if ((dir = opendir(SYSFS_BLOCK)) != NULL) {
 
-				if (DISPLAY_ZERO_OMIT(flags)) {
-					if ((ioi->rd_ios == ioj->rd_ios) &&
-						(ioi->wr_ios == ioj->wr_ios))
-						/* No activity: Ignore it */
-						continue;
-				}
+		/* Get current entry */
+		while ((drd = readdir(dir)) != NULL) {
+			if (!strcmp(drd->d_name, ".") || !strcmp(drd->d_name, ".."))
+				continue;
+			snprintf(filename, MAX_PF_NAME, "%s/%s/%s",
+				 SYSFS_BLOCK, drd->d_name, S_STAT);
+			filename[MAX_PF_NAME - 1] = '\0';
 
-				if (DISPLAY_GROUP_TOTAL_ONLY(flags)) {
-					if (shi->status != DISK_GROUP)
-						continue;
-				}
-#ifdef DEBUG
-				if (DISPLAY_DEBUG(flags)) {
-					/* Debug output */
-					fprintf(stderr, "name=%s itv=%llu fctr=%d ioi{ rd_sectors=%lu "
-							"wr_sectors=%lu rd_ios=%lu rd_merges=%lu rd_ticks=%u "
-							"wr_ios=%lu wr_merges=%lu wr_ticks=%u ios_pgr=%u tot_ticks=%u "
-							"rq_ticks=%u }\n",
-						shi->name,
-						itv,
-						fctr,
-						ioi->rd_sectors,
-						ioi->wr_sectors,
-						ioi->rd_ios,
-						ioi->rd_merges,
-						ioi->rd_ticks,
-						ioi->wr_ios,
-						ioi->wr_merges,
-						ioi->wr_ticks,
-						ioi->ios_pgr,
-						ioi->tot_ticks,
-						ioi->rq_ticks
-						);
-				}
-#endif
+			/* If current entry is a directory, try to read its stat file */
+			ok = read_sysfs_file_stat(curr, filename, drd->d_name);
 
-				if (DISPLAY_EXTENDED(flags)) {
-					write_ext_stat(curr, itv, fctr, shi, ioi, ioj);
-				}
-				else {
-					write_basic_stat(curr, itv, fctr, shi, ioi, ioj);
-				}
+			/*
+			 * If '-p ALL' was entered on the command line,
+			 * also try to read stats for its partitions
+			 */
+			if (ok && DISPLAY_PART_ALL(flags)) {
+				read_sysfs_dlist_part_stat(curr, drd->d_name);
 			}
 		}
-		printf("\n");
+
+		/* Close /sys/block directory */
+		closedir(dir);
 	}
+
+	/* Free structures corresponding to unregistered devices */
+	free_unregistered_entries(iodev_nr, st_hdr_iodev);
 }
 
 /*
- * Allocate structures for all CPU and I/O devices.
+ * Read a clock and return its value in nanoseconds.
  */
-void salloc_dev_list(int list_len)
+unsigned long long get_clock_ns(clockid_t clk)
 {
-	if ((st_dev_list = (struct io_dlist *) malloc(IO_DLIST_SIZE * list_len)) == NULL) {
-		perror("malloc");
-		exit(4);
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+
+	return (unsigned long long) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * SIGINT and SIGTERM handler: Sampling stops after the current interval,
+ * so that recorded files, rollups, shared memory and sockets are closed
+ * as they are at the end of a count.
+ */
+void stop_handler(int sig)
+{
+	(void) sig;
+	sig_stop = 1;
+
+	if (ring_size > 0) {
+		/* Wake the sampler up if it is waiting for the writer */
+		sem_post(&st_ring.space);
 	}
-	memset(st_dev_list, 0, IO_DLIST_SIZE * list_len);
 }
 
 /*
- * Set the output unit for disks.
+ * Block or unblock (how) SIGINT and SIGTERM in the calling thread.
+ * Threads inherit the mask of the thread creating them.
  */
-void set_disk_output_unit(void)
+void mask_stop_signals(int how)
 {
-	char *e;
+	sigset_t set;
 
-	if (DISPLAY_KILOBYTES(flags) || DISPLAY_MEGABYTES(flags))
-		return;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(how, &set, NULL);
+}
 
-	/* Check POSIXLY_CORRECT environment variable */
-	if ((e = getenv(ENV_POSIXLY_CORRECT)) == NULL) {
-		/* Variable not set: Unit is kB/s and not blocks/s */
-		flags |= I_D_KILOBYTES;
-	}
+/*
+ * Install the SIGINT and SIGTERM handler. The signals stay blocked until
+ * the sampling loop starts (see rw_io_stat_loop()): Threads created
+ * meanwhile never receive them, so that they always interrupt the
+ * sampler.
+ */
+void init_stop_handler(void)
+{
+	struct sigaction sa;
+
+	mask_stop_signals(SIG_BLOCK);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_handler;
+	sigemptyset(&sa.sa_mask);
+	/* No SA_RESTART: The wait for next interval must be interrupted */
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
 }
 
 /*
- * Allocate and initialize structures.
+ * Compute the first deadline of the interval scheduler.
+ * It is aligned on a multiple of the interval in wall clock time, so that
+ * series sampled on different hosts with synchronized clocks line up.
+ * Following deadlines are then computed on CLOCK_MONOTONIC only.
  */
-void io_sys_init(void)
+void init_interval_sched(unsigned long long itv_ns)
 {
-	/* Allocate and init stat common counters */
-	init_stats();
+	unsigned long long now, real;
 
-	/* How many processors on this machine? */
-	cpu_nr = get_cpu_nr(~0, FALSE);
+	now  = get_clock_ns(CLOCK_MONOTONIC);
+	real = get_clock_ns(CLOCK_REALTIME);
 
-	/* Get number of block devices and partitions in /proc/diskstats. */
-	if ((iodev_nr = get_diskstats_dev_nr(CNT_PART, CNT_ALL_DEV)) > 0)
-        {
-		flags |= I_F_HAS_DISKSTATS;
-		iodev_nr += NR_DEV_PREALLOC;
+	/* next_deadline is advanced by one interval before each wait */
+	next_deadline = now + (itv_ns - real % itv_ns) - itv_ns;
+	sched_missed = 0;
+	sched_jitter = 0;
+}
+
+/*
+ * Sleep until the next deadline of the interval scheduler.
+ * If collecting and displaying stats took longer than the interval,
+ * the deadlines that have already passed are counted as missed and
+ * skipped, instead of taking several samples in a row.
+ */
+void wait_next_interval(unsigned long long itv_ns)
+{
+	unsigned long long now, late;
+	struct timespec ts;
+
+	next_deadline += itv_ns;
+
+	now = get_clock_ns(CLOCK_MONOTONIC);
+	if (now > next_deadline) {
+		late = (now - next_deadline) / itv_ns + 1;
+		sched_missed += late;
+		next_deadline += late * itv_ns;
 	}
 
-	if (!HAS_DISKSTATS(flags) ||
-	    (DISPLAY_PARTITIONS(flags) && !DISPLAY_PART_ALL(flags)))
+	ts.tv_sec  = next_deadline / NSEC_PER_SEC;
+	ts.tv_nsec = next_deadline % NSEC_PER_SEC;
+	while ((clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) &&
+	       !sig_stop);
+
+	sched_jitter = (long long) (get_clock_ns(CLOCK_MONOTONIC) - next_deadline);
+}
+
+/*
+ * Read CPU and I/O stats into snapshot curr.
+ */
+void read_stats(int curr)
+{
+	/* Timestamp current snapshot */
+	snap_ns[curr] = get_clock_ns(CLOCK_MONOTONIC_RAW);
+	snap_real = get_clock_ns(CLOCK_REALTIME);
+
+	if (cpu_nr > 1)
         {
 		/*
-		 * If /proc/diskstats exists but we also want stats for the partitions
-		 * of a particular device, stats will have to be found in /sys.
-		 * So we need to know if /sys is mounted or not, and set flags accordingly.
+		 * Read system uptime (only for SMP machines).
+		 * Init uptime0. So if /proc/uptime cannot fill it,
+		 * this will be done by /proc/stat.
 		 */
+		uptime0[curr] = 0;
+		read_uptime(&(uptime0[curr]));
+	}
 
-		/* Get number of block devices (and partitions) in sysfs. */
-		if ((iodev_nr = get_sysfs_dev_nr(DISPLAY_PARTITIONS(flags))) > 0) {
-			flags |= I_F_HAS_SYSFS;
-			iodev_nr += NR_DEV_PREALLOC;
+	/*
+	 * Read stats for CPU "all" and every individual CPU in one pass.
+	 * Stats for CPU 0 also make read_stat_cpu() fill uptime0.
+	 */
+	if (pf_stat.fd >= 0) {
+		read_stat_cpu_buf(st_cpu[curr], cpu_nr + 1,
+				  &(uptime[curr]), &(uptime0[curr]));
+	}
+	else {
+		read_stat_cpu(st_cpu[curr], cpu_nr + 1,
+			      &(uptime[curr]), &(uptime0[curr]));
+	}
+
+	if (DISPLAY_MEMORY(flags)) {
+		if (pf_meminfo.fd >= 0) {
+			read_meminfo_buf(&st_mem, &st_huge);
 		}
 		else {
-			fprintf(stderr, "Cannot find disk data\n");
-			exit(2);
+			read_meminfo(&st_mem);
+			read_meminfo_huge(&st_huge);
 		}
 	}
 
-	/* Also allocate stat structures for "group" devices */
-	iodev_nr += group_nr;
+	if (DISPLAY_NET(flags)) {
+		net_read(&st_net, curr);
+	}
 
-	/*
-	 * Allocate structures for number of disks found, but also
-	 * for groups of devices if option -g has been entered on the command line.
-	 * iodev_nr must be <> 0.
-	 */
-	salloc_device(iodev_nr);
-}
+	if (DISPLAY_IRQ_CPU(actflags)) {
+		irq_read(&st_irq, curr);
+	}
 
-/*
- * Save the devices and group names when the stats are about to be displayed.
- */
-void presave_device_list(void)
-{
-	int i;
-	struct io_hdr_stats *shi = st_hdr_iodev;
-	struct io_dlist *sdli = st_dev_list;
+	if (DISPLAY_SOFTIRQS(actflags)) {
+		irq_read(&st_softirq, curr);
+	}
 
-	if (dlist_idx>0)
+	if (dlist_idx)
         {
-		/* First, save the last group name entered on the command line in the list */
-		update_dev_list(&dlist_idx, group_name);
-
-		/* Now save devices and group names in the io_hdr_stats structures */
-		for (i = 0; (i < dlist_idx) && (i < iodev_nr); i++, shi++, sdli++)
+		/*
+		 * A device or partition name was explicitly entered
+		 * on the command line, with or without -p option
+		 * (but not -p ALL).
+		 */
+		if (HAS_DISKSTATS(flags) && !DISPLAY_PARTITIONS(flags))
                 {
-			strcpy(shi->name, sdli->dev_name);
-			shi->used = TRUE;
-			if (shi->name[0] == ' ')
-                        {
-				/* Current device name is in fact the name of a group */
-				shi->status = DISK_GROUP;
-			}
-			else
-                        {
-				shi->status = DISK_REGISTERED;
-			}
+			read_diskstats_stat(curr);
+		}
+		else if (HAS_SYSFS(flags)) {
+			read_sysfs_dlist_stat(curr);
 		}
 	}
 	else
         {
 		/*
-		 * No device names have been entered on the command line but
-		 * the name of a group. Save that name at the end of the
-		 * data table so that all devices that will be read will be
-		 * included in that group.
+		 * No devices nor partitions entered on the command line
+		 * (for example if -p ALL was used).
 		 */
-		shi += iodev_nr - 1;
-		strcpy(shi->name, group_name);
-		shi->used = TRUE;
-		shi->status = DISK_GROUP;
+		if (HAS_DISKSTATS(flags))
+                {
+			read_diskstats_stat(curr);
+		}
+		else if (HAS_SYSFS(flags))
+                {
+			read_sysfs_stat(curr);
+		}
+	}
+
+	/* Compute device groups stats */
+	if (group_nr > 0)
+        {
+		compute_device_groups_stats(curr);
 	}
 }
 
 /*
- * Read stats for current block device.
+ * Make a sample refer to the global stats tables.
  */
-int read_sysfs_file_stat(int curr, char *filename, char *dev_name)
+void set_live_sample(struct stats_sample *smp, int curr, struct tm *rectime)
 {
-	FILE *fp;
-	struct io_stats sdev;
 	int i;
-	unsigned int ios_pgr, tot_ticks, rq_ticks, wr_ticks;
-	unsigned long rd_ios, rd_merges_or_rd_sec, wr_ios, wr_merges;
-	unsigned long rd_sec_or_wr_ios, wr_sec, rd_ticks_or_wr_sec;
-
-	/* Try to read given stat file */
-	if ((fp = fopen(filename, "r")) == NULL)
-		return 0;
 
-	i = fscanf(fp, "%lu %lu %lu %lu %lu %lu %lu %u %u %u %u",
-		   &rd_ios, &rd_merges_or_rd_sec, &rd_sec_or_wr_ios, &rd_ticks_or_wr_sec,
-		   &wr_ios, &wr_merges, &wr_sec, &wr_ticks, &ios_pgr, &tot_ticks, &rq_ticks);
-
-	if (i == 11) {
-		/* Device or partition */
-		sdev.rd_ios     = rd_ios;
-		sdev.rd_merges  = rd_merges_or_rd_sec;
-		sdev.rd_sectors = rd_sec_or_wr_ios;
-		sdev.rd_ticks   = (unsigned int) rd_ticks_or_wr_sec;
-		sdev.wr_ios     = wr_ios;
-		sdev.wr_merges  = wr_merges;
-		sdev.wr_sectors = wr_sec;
-		sdev.wr_ticks   = wr_ticks;
-		sdev.ios_pgr    = ios_pgr;
-		sdev.tot_ticks  = tot_ticks;
-		sdev.rq_ticks   = rq_ticks;
-	}
-	else if (i == 4) {
-		/* Partition without extended statistics */
-		sdev.rd_ios     = rd_ios;
-		sdev.rd_sectors = rd_merges_or_rd_sec;
-		sdev.wr_ios     = rd_sec_or_wr_ios;
-		sdev.wr_sectors = rd_ticks_or_wr_sec;
+	smp->curr = curr;
+	smp->iodev_nr = iodev_nr;
+	for (i = 0; i < 2; i++) {
+		smp->cpu[i]     = st_cpu[i];
+		smp->iodev[i]   = st_iodev[i];
+		smp->uptime[i]  = uptime[i];
+		smp->uptime0[i] = uptime0[i];
+		smp->ts[i]      = snap_ns[i];
 	}
+	smp->hdr = st_hdr_iodev;
+	smp->realtime = snap_real;
+	smp->dict_gen = dict_gen;
+	smp->rectime = *rectime;
+	smp->jitter  = sched_jitter;
+	smp->missed  = sched_missed;
+	smp->dropped = st_ring.dropped;
+	smp->has_memory = DISPLAY_MEMORY(flags);
+	smp->mem  = st_mem;
+	smp->huge = st_huge;
+	smp->has_net = DISPLAY_NET(flags);
+	smp->net_nr  = st_net.nr;
+	smp->net_hdr = st_net.hdr;
+	for (i = 0; i < 2; i++) {
+		smp->netdev[i]  = st_net.dev[i];
+		smp->netedev[i] = st_net.edev[i];
+	}
+	smp->has_irq = DISPLAY_IRQ_CPU(actflags);
+	smp->irq = &st_irq;
+	smp->has_softirq = DISPLAY_SOFTIRQS(actflags);
+	smp->softirq = &st_softirq;
+}
+
+/*
+ * Copy a sample into a buffer owned by the ring.
+ * Device tables of the buffer only grow when the global ones have grown.
+ */
+void copy_sample(struct stats_sample *dst, struct stats_sample *src)
+{
+	int i;
+	size_t size;
 
-	if ((i == 11) || !DISPLAY_EXTENDED(flags)) {
-		/*
-		 * In fact, we _don't_ save stats if it's a partition without
-		 * extended stats and yet we want to display ext stats.
-		 */
-		save_stats(dev_name, curr, &sdev, iodev_nr, st_hdr_iodev);
+	if (dst->iodev_alloc < src->iodev_nr) {
+		for (i = 0; i < 2; i++) {
+			size = IO_STATS_SIZE * src->iodev_nr;
+			SREALLOC(dst->iodev[i], struct io_stats, size);
+		}
+		size = IO_HDR_STATS_SIZE * src->iodev_nr;
+		SREALLOC(dst->hdr, struct io_hdr_stats, size);
+		dst->iodev_alloc = src->iodev_nr;
 	}
 
-	fclose(fp);
+	dst->curr = src->curr;
+	dst->iodev_nr = src->iodev_nr;
+	for (i = 0; i < 2; i++) {
+		memcpy(dst->cpu[i], src->cpu[i], STATS_CPU_SIZE * (cpu_nr + 1));
+		memcpy(dst->iodev[i], src->iodev[i], IO_STATS_SIZE * src->iodev_nr);
+		dst->uptime[i]  = src->uptime[i];
+		dst->uptime0[i] = src->uptime0[i];
+		dst->ts[i]      = src->ts[i];
+	}
+	memcpy(dst->hdr, src->hdr, IO_HDR_STATS_SIZE * src->iodev_nr);
+	dst->realtime = src->realtime;
+	dst->dict_gen = src->dict_gen;
+	dst->rectime = src->rectime;
+	dst->jitter  = src->jitter;
+	dst->missed  = src->missed;
+	dst->dropped = src->dropped;
+	dst->has_memory = src->has_memory;
+	dst->mem  = src->mem;
+	dst->huge = src->huge;
+
+	dst->has_irq = src->has_irq;
+	if (src->has_irq) {
+		irq_copy(&dst->irq, src->irq);
+	}
+	dst->has_softirq = src->has_softirq;
+	if (src->has_softirq) {
+		irq_copy(&dst->softirq, src->softirq);
+	}
 
-	return 1;
+	dst->has_net = src->has_net;
+	if (!src->has_net)
+		return;
+	if (dst->net_alloc < src->net_nr) {
+		/* Only when interfaces have been added */
+		for (i = 0; i < 2; i++) {
+			size = STATS_NET_DEV_SIZE * src->net_nr;
+			SREALLOC(dst->netdev[i], struct stats_net_dev, size);
+			size = STATS_NET_EDEV_SIZE * src->net_nr;
+			SREALLOC(dst->netedev[i], struct stats_net_edev, size);
+		}
+		size = NET_HDR_SIZE * src->net_nr;
+		SREALLOC(dst->net_hdr, struct net_hdr, size);
+		dst->net_alloc = src->net_nr;
+	}
+	dst->net_nr = src->net_nr;
+	for (i = 0; i < 2; i++) {
+		memcpy(dst->netdev[i], src->netdev[i], STATS_NET_DEV_SIZE * src->net_nr);
+		memcpy(dst->netedev[i], src->netedev[i], STATS_NET_EDEV_SIZE * src->net_nr);
+	}
+	memcpy(dst->net_hdr, src->net_hdr, NET_HDR_SIZE * src->net_nr);
 }
 
 /*
- * Read stats for all partitions of a given device.
+ * Allocate the ring of samples passed from the sampler to the writer.
+ * size is the number of samples that may be waiting to be displayed.
  */
-void read_sysfs_dlist_part_stat(int curr, char *dev_name)
+void init_sample_ring(struct sample_ring *rg, int size, int policy)
 {
-	DIR *dir;
-	struct dirent *drd;
-	char dfile[MAX_PF_NAME], filename[MAX_PF_NAME];
+	int i, j;
 
-	snprintf(dfile, MAX_PF_NAME, "%s/%s", SYSFS_BLOCK, dev_name);
-	dfile[MAX_PF_NAME - 1] = '\0';
-
-	/* Open current device directory in /sys/block */
-	if ((dir = opendir(dfile)) == NULL)
-		return;
+	memset(rg, 0, sizeof(struct sample_ring));
+	rg->size = size;
+	rg->policy = policy;
+	/* Plus one buffer being filled by the sampler and one being displayed */
+	rg->nbuf = size + 2;
 
-	/* Get current entry */
-	while ((drd = readdir(dir)) != NULL) {
-		if (!strcmp(drd->d_name, ".") || !strcmp(drd->d_name, ".."))
-			continue;
-		snprintf(filename, MAX_PF_NAME, "%s/%s/%s", dfile, drd->d_name, S_STAT);
-		filename[MAX_PF_NAME - 1] = '\0';
+	if (((rg->buf = (struct stats_sample *) calloc(rg->nbuf, STATS_SAMPLE_SIZE)) == NULL) ||
+	    ((rg->filled = (int *) malloc(sizeof(int) * size)) == NULL) ||
+	    ((rg->freed = (int *) malloc(sizeof(int) * rg->nbuf)) == NULL)) {
+		perror("malloc");
+		exit(4);
+	}
 
-		/* Read current partition stats */
-		read_sysfs_file_stat(curr, filename, drd->d_name);
+	for (i = 0; i < rg->nbuf; i++) {
+		for (j = 0; j < 2; j++) {
+			if ((rg->buf[i].cpu[j] =
+			     (struct stats_cpu *) malloc(STATS_CPU_SIZE * (cpu_nr + 1))) == NULL) {
+				perror("malloc");
+				exit(4);
+			}
+		}
+		/* All the buffers are free */
+		rg->freed[i] = i;
 	}
+	rg->free_head = rg->nbuf;
 
-	/* Close device directory */
-	closedir(dir);
+	sem_init(&rg->items, 0, 0);
+	sem_init(&rg->space, 0, 0);
 }
 
 /*
- * Free any unused (unregistered) entries.
+ * Free the ring of samples.
  */
-void free_unregistered_entries(int iodev_nr, struct io_hdr_stats *st_hdr_iodev)
+void free_sample_ring(struct sample_ring *rg)
 {
-	int i;
-	struct io_hdr_stats *shi = st_hdr_iodev;
-
-	for (i = 0; i < iodev_nr; i++, shi++) {
-		if (shi->status == DISK_UNREGISTERED) {
-			shi->used = FALSE;
+	int i, j;
+
+	for (i = 0; i < rg->nbuf; i++) {
+		for (j = 0; j < 2; j++) {
+			free(rg->buf[i].cpu[j]);
+			free(rg->buf[i].iodev[j]);
+			free(rg->buf[i].netdev[j]);
+			free(rg->buf[i].netedev[j]);
 		}
+		free(rg->buf[i].hdr);
+		free(rg->buf[i].net_hdr);
+		irq_free_copy(rg->buf[i].irq);
+		irq_free_copy(rg->buf[i].softirq);
 	}
+	free(rg->buf);
+	free(rg->filled);
+	free(rg->freed);
+
+	sem_destroy(&rg->items);
+	sem_destroy(&rg->space);
 }
 
 /*
- * Set all individual device entries to "unregistered."
+ * Ask the writer to post space when it gives next buffer back (sampler
+ * side). A post left over from last wait is consumed first. The ring
+ * must be checked again after this, as the writer may have given a
+ * buffer back before it could see waiting set.
  */
-void set_entries_unregistered(int iodev_nr, struct io_hdr_stats *st_hdr_iodev)
+void set_sample_waiting(struct sample_ring *rg)
 {
-	int i;
-	struct io_hdr_stats *shi = st_hdr_iodev;
+	while (!sem_trywait(&rg->space));
 
-	for (i = 0; i < iodev_nr; i++, shi++) {
-		if (shi->status == DISK_REGISTERED) {
-			shi->status = DISK_UNREGISTERED;
-		}
-	}
+	__atomic_store_n(&rg->waiting, TRUE, __ATOMIC_RELAXED);
+	/* Ordered before the ring is checked again (see release_sample_buffer()) */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 }
 
 /*
- * Read stats from directory "/proc/diskstats."
+ * Get a buffer to save next sample into (sampler side).
+ * If the writer is late and the ring is full, either the oldest sample
+ * not yet displayed is dropped and its buffer reused, or the sampler
+ * waits for the writer, depending on the overflow policy.
+ * Return the buffer index, or -1 if SIGINT or SIGTERM has been received
+ * while waiting.
  */
-void read_diskstats_stat(int curr)
+int get_sample_buffer(struct sample_ring *rg)
 {
-	FILE *fp;
-	char line[256], dev_name[MAX_NAME_LEN];
-	char *dm_name;
-	struct io_stats sdev;
-	int i;
-	unsigned int ios_pgr, tot_ticks, rq_ticks, wr_ticks;
-	unsigned long rd_ios, rd_merges_or_rd_sec, rd_ticks_or_wr_sec, wr_ios;
-	unsigned long wr_merges, rd_sec_or_wr_ios, wr_sec;
-	char *ioc_dname;
-	unsigned int major, minor;
-
-	/* Every I/O device entry is potentially unregistered */
-	set_entries_unregistered(iodev_nr, st_hdr_iodev);
-
-	if ((fp = fopen(DISKSTATS, "r")) == NULL)
-		return;
-
-	while (fgets(line, sizeof(line), fp) != NULL) {
-
-		/* major minor name rio rmerge rsect ruse wio wmerge wsect wuse running use aveq */
-		i = sscanf(line, "%u %u %s %lu %lu %lu %lu %lu %lu %lu %u %u %u %u",
-			   &major, &minor, dev_name,
-			   &rd_ios, &rd_merges_or_rd_sec, &rd_sec_or_wr_ios, &rd_ticks_or_wr_sec,
-			   &wr_ios, &wr_merges, &wr_sec, &wr_ticks, &ios_pgr, &tot_ticks, &rq_ticks);
-
-		if (i == 14) {
-			/* Device or partition */
-			if (!dlist_idx && !DISPLAY_PARTITIONS(flags) &&
-			    !is_device(dev_name, ACCEPT_VIRTUAL_DEVICES))
-				continue;
-			sdev.rd_ios     = rd_ios;
-			sdev.rd_merges  = rd_merges_or_rd_sec;
-			sdev.rd_sectors = rd_sec_or_wr_ios;
-			sdev.rd_ticks   = (unsigned int) rd_ticks_or_wr_sec;
-			sdev.wr_ios     = wr_ios;
-			sdev.wr_merges  = wr_merges;
-			sdev.wr_sectors = wr_sec;
-			sdev.wr_ticks   = wr_ticks;
-			sdev.ios_pgr    = ios_pgr;
-			sdev.tot_ticks  = tot_ticks;
-			sdev.rq_ticks   = rq_ticks;
-		}
-		else if (i == 7) {
-			/* Partition without extended statistics */
-			if (DISPLAY_EXTENDED(flags) ||
-			    (!dlist_idx && !DISPLAY_PARTITIONS(flags)))
+	unsigned long long t;
+	int idx, waiting = FALSE;
+
+	for (;;) {
+		t = __atomic_load_n(&rg->tail, __ATOMIC_ACQUIRE);
+
+		if (rg->head - t >= (unsigned long long) rg->size) {
+			if (rg->policy != RING_BLOCK) {
+				idx = __atomic_load_n(&rg->filled[t % rg->size], __ATOMIC_RELAXED);
+				if (__atomic_compare_exchange_n(&rg->tail, &t, t + 1, FALSE,
+								__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+					rg->dropped++;
+					return idx;
+				}
+				/* The writer has just taken this sample */
 				continue;
-
-			sdev.rd_ios     = rd_ios;
-			sdev.rd_sectors = rd_merges_or_rd_sec;
-			sdev.wr_ios     = rd_sec_or_wr_ios;
-			sdev.wr_sectors = rd_ticks_or_wr_sec;
-		}
-		else
-			/* Unknown entry: Ignore it */
-			continue;
-
-		if ((ioc_dname = ioc_name(major, minor)) != NULL) {
-			if (strcmp(dev_name, ioc_dname) && strcmp(ioc_dname, K_NODEV)) {
-				/*
-				 * No match: Use name generated from sysstat.ioconf data
-				 * (if different from "nodev") works around known issues
-				 * with EMC PowerPath.
-				 */
-				strncpy(dev_name, ioc_dname, MAX_NAME_LEN);
 			}
 		}
-
-		if ((DISPLAY_DEVMAP_NAME(flags)) && (major == dm_major)) {
-			/*
-			 * If the device is a device mapper device, try to get its
-			 * assigned name of its logical device.
-			 */
-			dm_name = transform_devmapname(major, minor);
-			if (dm_name) {
-				strncpy(dev_name, dm_name, MAX_NAME_LEN);
-			}
+		else if (rg->free_tail != __atomic_load_n(&rg->free_head, __ATOMIC_ACQUIRE)) {
+			idx = rg->freed[rg->free_tail % rg->nbuf];
+			__atomic_store_n(&rg->free_tail, rg->free_tail + 1, __ATOMIC_RELEASE);
+			return idx;
 		}
 
-		save_stats(dev_name, curr, &sdev, iodev_nr, st_hdr_iodev);
+		/*
+		 * Wait for the writer to give a buffer back (a buffer is always
+		 * free when the ring is not full though).
+		 */
+		if (sig_stop)
+			return -1;
+		if (!waiting) {
+			set_sample_waiting(rg);
+			waiting = TRUE;
+			continue;
+		}
+		/* Interrupted by SIGINT or SIGTERM if need be */
+		sem_wait(&rg->space);
+		waiting = FALSE;
 	}
-	fclose(fp);
+}
 
-	/* Free structures corresponding to unregistered devices */
-	free_unregistered_entries(iodev_nr, st_hdr_iodev);
+/*
+ * Queue a sample to be displayed by the writer (sampler side).
+ */
+void put_sample(struct sample_ring *rg, int idx)
+{
+	__atomic_store_n(&rg->filled[rg->head % rg->size], idx, __ATOMIC_RELAXED);
+	__atomic_store_n(&rg->head, rg->head + 1, __ATOMIC_RELEASE);
+	sem_post(&rg->items);
 }
 
 /*
- * Read stats for devices requested in command line parameters.
+ * Take the oldest sample queued (writer side).
+ * Return its buffer index, or -1 if there is none.
  */
-void read_sysfs_dlist_stat(int curr)
+int take_sample(struct sample_ring *rg)
 {
-	int dev, ok;
-	char filename[MAX_PF_NAME];
-	char *slash;
-	struct io_dlist *st_dev_list_i;
+	unsigned long long t;
+	int idx;
+
+	t = __atomic_load_n(&rg->tail, __ATOMIC_ACQUIRE);
+	while (t != __atomic_load_n(&rg->head, __ATOMIC_ACQUIRE)) {
+		idx = __atomic_load_n(&rg->filled[t % rg->size], __ATOMIC_RELAXED);
+		if (__atomic_compare_exchange_n(&rg->tail, &t, t + 1, FALSE,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return idx;
+		/* Sample dropped by the sampler meanwhile: t has been updated */
+	}
 
-	/* Every I/O device (or partition) is potentially unregistered */
-	set_entries_unregistered(iodev_nr, st_hdr_iodev);
+	return -1;
+}
 
-	for (dev = 0; dev < dlist_idx; dev++) {
-		st_dev_list_i = st_dev_list + dev;
+/*
+ * Give a buffer back to the sampler once its sample has been displayed
+ * (writer side).
+ */
+void release_sample_buffer(struct sample_ring *rg, int idx)
+{
+	rg->freed[rg->free_head % rg->nbuf] = idx;
+	__atomic_store_n(&rg->free_head, rg->free_head + 1, __ATOMIC_RELEASE);
 
-		/* Some devices may have a slash in their name (eg. cciss/c0d0...) */
-		while ((slash = strchr(st_dev_list_i->dev_name, '/'))) {
-			*slash = '!';
-		}
+	/*
+	 * Either the sampler sees the buffer when it checks the ring again
+	 * after setting waiting, or waiting is seen set here.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&rg->waiting, FALSE, __ATOMIC_RELAXED)) {
+		sem_post(&rg->space);
+	}
+}
 
-		snprintf(filename, MAX_PF_NAME, "%s/%s/%s",
-			 SYSFS_BLOCK, st_dev_list_i->dev_name, S_STAT);
-		filename[MAX_PF_NAME - 1] = '\0';
+/*
+ * Writer thread: Display samples as they are queued by the sampler,
+ * until the sampler is done and the ring is empty.
+ */
+void *write_stats_thread(void *arg)
+{
+	struct sample_ring *rg = (struct sample_ring *) arg;
+	int idx;
 
-		/* Read device stats */
-		ok = read_sysfs_file_stat(curr, filename, st_dev_list_i->dev_name);
+	for (;;) {
+		while (sem_wait(&rg->items) && (errno == EINTR));
 
-		if (ok && st_dev_list_i->disp_part) {
-			/* Also read stats for its partitions */
-			read_sysfs_dlist_part_stat(curr, st_dev_list_i->dev_name);
+		if ((idx = take_sample(rg)) >= 0) {
+			write_stats(rg->buf + idx);
+			release_sample_buffer(rg, idx);
+		}
+		else if (__atomic_load_n(&rg->done, __ATOMIC_ACQUIRE)) {
+			break;
 		}
 	}
 
-	/* Free structures corresponding to unregistered devices */
-	free_unregistered_entries(iodev_nr, st_hdr_iodev);
+	return NULL;
 }
 
 /*
- * Read stats in the filesystem for the devices we have discovered.
+ * Tell the writer thread that sampling is over, and wait for it to
+ * display the samples still queued. When stopped by SIGINT or SIGTERM,
+ * the writer is only given RING_STOP_WAIT seconds: If the output is
+ * stalled, the samples left are not displayed.
  */
-void read_sysfs_stat(int curr)
+void stop_writer(struct sample_ring *rg, pthread_t writer)
 {
-	DIR *dir;
-	struct dirent *drd;
-	char filename[MAX_PF_NAME];
-	int ok;
-
-	/* Every I/O device entry is potentially unregistered */
-	set_entries_unregistered(iodev_nr, st_hdr_iodev);
+	struct timespec ts;
 
-	/* Open /sys/block directory */
-	if ((dir = opendir(SYSFS_BLOCK)) != NULL) {
-
-		/* Get current entry */
-		while ((drd = readdir(dir)) != NULL) {
-			if (!strcmp(drd->d_name, ".") || !strcmp(drd->d_name, ".."))
-				continue;
-			snprintf(filename, MAX_PF_NAME, "%s/%s/%s",
-				 SYSFS_BLOCK, drd->d_name, S_STAT);
-			filename[MAX_PF_NAME - 1] = '\0';
-
-			/* If current entry is a directory, try to read its stat file */
-			ok = read_sysfs_file_stat(curr, filename, drd->d_name);
-
-			/*
-			 * If '-p ALL' was entered on the command line,
-			 * also try to read stats for its partitions
-			 */
-			if (ok && DISPLAY_PART_ALL(flags)) {
-				read_sysfs_dlist_part_stat(curr, drd->d_name);
-			}
-		}
+	__atomic_store_n(&rg->done, 1, __ATOMIC_RELEASE);
+	sem_post(&rg->items);
 
-		/* Close /sys/block directory */
-		closedir(dir);
+	if (sig_stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += RING_STOP_WAIT;
+		if (!pthread_timedjoin_np(writer, NULL, &ts))
+			return;
+		pthread_cancel(writer);
 	}
-
-	/* Free structures corresponding to unregistered devices */
-	free_unregistered_entries(iodev_nr, st_hdr_iodev);
+	pthread_join(writer, NULL);
 }
 
 /*
  * THIS IS THE MOST IMPORTANT LOOP.
  * Read and display I/O stats.
+ * With a ring of samples, stats are read here (sampler) and displayed
+ * by another thread (writer), so that a slow output never delays sampling.
  */
 void rw_io_stat_loop(long int count, struct tm *rectime)
 {
 	int curr = 1;
 	int skip = 0;
+	int idx, rc;
+	struct stats_sample live;
+	pthread_t writer;
 
 	/* Should we skip first report? */
-	if (DISPLAY_OMIT_SINCE_BOOT(flags) && interval > 0)
+	if (DISPLAY_OMIT_SINCE_BOOT(flags) && interval_ns > 0)
         {
 		skip = 1;
 	}
 
-	/* Don't buffer data if redirected to a pipe. */
-	setbuf(stdout, NULL);
+	/*
+	 * Reports are not written with stdio: Each one is formatted into
+	 * st_out and written at the end of write_stats(), so that a pipe
+	 * still receives it as soon as the interval is over.
+	 */
 
-	do
-        {
-		if (cpu_nr > 1)
-                {
-			/*
-			 * Read system uptime (only for SMP machines).
-			 * Init uptime0. So if /proc/uptime cannot fill it,
-			 * this will be done by /proc/stat.
-			 */
-			uptime0[curr] = 0;
-			read_uptime(&(uptime0[curr]));
+	if (ring_size > 0) {
+		/* Start the writer thread */
+		init_sample_ring(&st_ring, ring_size, ring_policy);
+		if ((rc = pthread_create(&writer, NULL, write_stats_thread, &st_ring)) != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+			exit(4);
 		}
+	}
 
-		/*
-		 * Read stats for CPU "all" and 0.
-		 * Note that stats for CPU 0 are not used per se. It only makes
-		 * read_stat_cpu() fill uptime0.
-		 */
-		read_stat_cpu(st_cpu[curr], 2, &(uptime[curr]), &(uptime0[curr]));
+	if (interval_ns > 0) {
+		/* Start the interval scheduler */
+		init_interval_sched(interval_ns);
+	}
 
-		if (dlist_idx)
-                {
-			/*
-			 * A device or partition name was explicitly entered
-			 * on the command line, with or without -p option
-			 * (but not -p ALL).
-			 */
-			if (HAS_DISKSTATS(flags) && !DISPLAY_PARTITIONS(flags))
-                        {
-				read_diskstats_stat(curr);
-			}
-			else if (HAS_SYSFS(flags)) {
-				read_sysfs_dlist_stat(curr);
-			}
-		}
-		else
-                {
-			/*
-			 * No devices nor partitions entered on the command line
-			 * (for example if -p ALL was used).
-			 */
-			if (HAS_DISKSTATS(flags))
-                        {
-				read_diskstats_stat(curr);
-			}
-			else if (HAS_SYSFS(flags))
-                        {
-				read_sysfs_stat(curr);
-			}
-		}
+	/* Only the sampler receives SIGINT and SIGTERM */
+	mask_stop_signals(SIG_UNBLOCK);
 
-		/* Compute device groups stats */
-		if (group_nr > 0)
-                {
-			compute_device_groups_stats(curr);
-		}
+	do
+        {
+		/* Read CPU and I/O stats */
+		read_stats(curr);
 
 		/* Get time */
 		get_localtime(rectime, 0);
@@ -1118,8 +3064,24 @@ void rw_io_stat_loop(long int count, struct tm *rectime)
 		/* Check whether we should skip first report */
 		if (!skip)
                 {
-			/* Print results */
-			write_stats(curr, rectime);
+			set_live_sample(&live, curr, rectime);
+
+			/* Save and publish results: Only their display may wait for the output */
+			export_stats(&live);
+
+			if (ring_size > 0) {
+				/* Queue results for the writer thread (unless stopped while waiting for it) */
+				if ((idx = get_sample_buffer(&st_ring)) >= 0) {
+					/* Including the sample that may just have been dropped */
+					live.dropped = st_ring.dropped;
+					copy_sample(st_ring.buf + idx, &live);
+					put_sample(&st_ring, idx);
+				}
+			}
+			else {
+				/* Print results */
+				write_stats(&live);
+			}
 
 			if (count > 0)
                         {
@@ -1131,13 +3093,218 @@ void rw_io_stat_loop(long int count, struct tm *rectime)
 			skip = 0;
 		}
 
-		if (count)
-                {
-			curr ^= 1;
-			pause();
+		if (count && !sig_stop)
+                {
+			curr ^= 1;
+			wait_next_interval(interval_ns);
+		}
+	}
+	while (count && !sig_stop);
+
+	if (ring_size > 0) {
+		/* The signal handler mustn't post to the ring once it is freed */
+		mask_stop_signals(SIG_BLOCK);
+		stop_writer(&st_ring, writer);
+		free_sample_ring(&st_ring);
+	}
+}
+
+/*
+ * Display the samples of a chunk of a recorded file (see struct replay).
+ * Decoding starts at the first index entry of the chunk, and goes on up
+ * to the first sample of next chunk: Samples are displayed as compared
+ * with the one before, so next chunk only uses that sample as a base.
+ */
+void replay_chunk(struct replay *rp, struct rec_cursor *cur, unsigned int c)
+{
+	struct rec_reader *rd = &rp->rd;
+	unsigned int s = rp->first + c * rp->step;
+	unsigned int e = s + rp->step;
+	unsigned long long end;
+
+	if (e > rp->last) {
+		e = rp->last;
+	}
+	end = (e < rd->idx_nr) ? rd->idx[e].offset : rd->end;
+
+	if (!rec_seek(cur, s))
+		/* Samples of the chunk have been dropped from a history file */
+		return;
+
+	while (rec_read_sample(cur, end)) {
+		if ((cur->nr == 1) && s)
+			/* Base of next sample (else stats since boot are displayed) */
+			continue;
+
+		if ((cur->smp.realtime < replay_from) || (cur->smp.realtime > replay_to))
+			continue;
+
+		write_stats(&cur->smp);
+	}
+}
+
+/*
+ * Replay thread: Display chunks of samples into the slots, until there
+ * are no chunks left.
+ */
+void *replay_thread(void *arg)
+{
+	struct replay *rp = (struct replay *) arg;
+	struct replay_slot *sl;
+	struct rec_cursor cur;
+	unsigned int c;
+
+	rec_init_cursor(&cur, &rp->rd);
+	/* Reports are written by the main thread */
+	out_keep = TRUE;
+
+	pthread_mutex_lock(&rp->lock);
+	for (;;) {
+		while ((rp->next < rp->chunk_nr) &&
+		       (rp->next >= rp->written + rp->slot_nr)) {
+			pthread_cond_wait(&rp->cond, &rp->lock);
+		}
+		if (rp->next >= rp->chunk_nr)
+			break;
+		c = rp->next++;
+		sl = rp->slot + c % rp->slot_nr;
+		pthread_mutex_unlock(&rp->lock);
+
+		st_out = sl->out;
+		replay_chunk(rp, &cur, c);
+
+		pthread_mutex_lock(&rp->lock);
+		sl->out = st_out;
+		sl->done = TRUE;
+		pthread_cond_broadcast(&rp->cond);
+	}
+	pthread_mutex_unlock(&rp->lock);
+
+	/* Output buffers belong to the slots */
+	memset(&st_out, 0, sizeof(struct out_buf));
+	sfree_io_soa();
+	rec_free_cursor(&cur);
+
+	return NULL;
+}
+
+/*
+ * Display stats recorded in a file instead of live stats.
+ * The file is decoded in parallel, and the reports are written in order.
+ */
+void replay_stats(char *filename)
+{
+	struct replay rp;
+	struct replay_slot *sl;
+	pthread_t *tid;
+	unsigned int c, i, jobs;
+	int rc;
+
+	memset(&rp, 0, sizeof(struct replay));
+	rec_open_read(&rp.rd, filename);
+
+	/* Stats are displayed as on the machine they were recorded on */
+	cpu_nr = rp.rd.fh.cpu_nr - 1;
+	hz = rp.rd.fh.hz;
+
+	if (rp.rd.idx_nr) {
+		rp.first = rec_find_index(&rp.rd, replay_from);
+		rp.last = rec_find_index(&rp.rd, replay_to) + 1;
+	}
+	/* Keyframes are indexed in a compressed file, else every sample */
+	rp.step = (rp.rd.fh.flags & REC_F_COMPRESSED) ? 1 : REC_KEYFRAME_INTERVAL;
+	if (rp.last > rp.first) {
+		rp.chunk_nr = (rp.last - rp.first + rp.step - 1) / rp.step;
+	}
+
+	jobs = replay_jobs;
+	if (!jobs) {
+		jobs = (rc = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ? rc : 1;
+	}
+	if (jobs > rp.chunk_nr) {
+		jobs = rp.chunk_nr;
+	}
+	rp.slot_nr = jobs * REPLAY_SLOTS_PER_JOB;
+
+	if (((rp.slot = (struct replay_slot *) calloc(rp.slot_nr + 1,
+						      sizeof(struct replay_slot))) == NULL) ||
+	    ((tid = (pthread_t *) malloc(sizeof(pthread_t) * (jobs + 1))) == NULL)) {
+		perror("malloc");
+		exit(4);
+	}
+	pthread_mutex_init(&rp.lock, NULL);
+	pthread_cond_init(&rp.cond, NULL);
+
+	for (i = 0; i < jobs; i++) {
+		if ((rc = pthread_create(&tid[i], NULL, replay_thread, &rp)) != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+			exit(4);
+		}
+	}
+
+	/* Write the reports of each chunk as soon as they are ready */
+	for (c = 0; c < rp.chunk_nr; c++) {
+		sl = rp.slot + c % rp.slot_nr;
+
+		pthread_mutex_lock(&rp.lock);
+		while (!sl->done) {
+			pthread_cond_wait(&rp.cond, &rp.lock);
 		}
+		pthread_mutex_unlock(&rp.lock);
+
+		st_out = sl->out;
+		out_flush();
+		sl->out = st_out;
+
+		pthread_mutex_lock(&rp.lock);
+		sl->done = FALSE;
+		rp.written++;
+		pthread_cond_broadcast(&rp.cond);
+		pthread_mutex_unlock(&rp.lock);
+	}
+	memset(&st_out, 0, sizeof(struct out_buf));
+
+	for (i = 0; i < jobs; i++) {
+		pthread_join(tid[i], NULL);
+	}
+
+	for (i = 0; i < rp.slot_nr; i++) {
+		free(rp.slot[i].out.buf);
 	}
-	while (count);
+	free(rp.slot);
+	free(tid);
+	pthread_mutex_destroy(&rp.lock);
+	pthread_cond_destroy(&rp.cond);
+	rec_close_read(&rp.rd);
+}
+
+/*
+ * Parse a time given either in seconds since the Epoch or as a local
+ * time "YYYY-MM-DD HH:MM:SS" (date and time may also be separated by a
+ * 'T'). Return it in ns since the Epoch, or 0 if it is invalid.
+ */
+unsigned long long parse_replay_time(char *s)
+{
+	struct tm tm;
+	char sep, c;
+	time_t t;
+
+	if (s[0] && (strspn(s, DIGITS) == strlen(s)))
+		return atoll(s) * NSEC_PER_SEC;
+
+	memset(&tm, 0, sizeof(struct tm));
+	if ((sscanf(s, "%d-%d-%d%c%d:%d:%d%c", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+		    &sep, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &c) != 7) ||
+	    ((sep != ' ') && (sep != 'T')))
+		return 0;
+
+	tm.tm_year -= 1900;
+	tm.tm_mon--;
+	tm.tm_isdst = -1;
+	if ((t = mktime(&tm)) == (time_t) -1)
+		return 0;
+
+	return (unsigned long long) t * NSEC_PER_SEC;
 }
 
 /*
@@ -1157,6 +3324,24 @@ void io_sys_free(void)
 	}
 
 	free(st_hdr_iodev);
+	free(iodev_hash);
+	free(iodev_free);
+	sfree_io_soa();
+	free(st_out.buf);
+
+	/* Close /proc files kept open between intervals */
+	close_proc_file(&pf_stat);
+	close_proc_file(&pf_diskstats);
+	close_proc_file(&pf_meminfo);
+	if (DISPLAY_NET(flags)) {
+		net_close(&st_net);
+	}
+	if (DISPLAY_IRQ_CPU(actflags)) {
+		irq_close(&st_irq);
+	}
+	if (DISPLAY_SOFTIRQS(actflags)) {
+		irq_close(&st_softirq);
+	}
 }
 
 /*
@@ -1168,12 +3353,77 @@ void sfree_dev_list(void)
 }
 
 
+/*
+ * Print usage and exit.
+ */
+void usage(char *progname)
+{
+	fprintf(stderr, "Usage: %s [ --interval <seconds> ] [ --buffer <samples> ]\n"
+			"       [ --overflow { drop-oldest | block } ] [ --log <file> ]\n"
+			"       [ --record <file> [ --compress ] [ --rollup ] ]\n"
+			"       [ --history <file> [ --history-size <MB> ] ] [ --shm /<name> ]\n"
+			"       [ --serve <socket> ] [ --serve-tcp <port> ]\n"
+			"       [ --push <address>:<port> [ --push-format { influx | statsd } ] ]\n"
+			"       [ --extended ] [ --memory ] [ --net ] [ --irq <N> ] [ --softirqs ]\n"
+			"       [ <interval> [ <count> ] ]\n"
+			"       %s --replay <file> [ --from <time> ] [ --to <time> ]\n"
+			"       [ --jobs <threads> ] [ --extended ]\n"
+			"       %s --query <file> { --device <name> | --top <N> [ --by <stat> ] }\n"
+			"       [ --from <time> ] [ --to <time> ]\n",
+		progname, progname, progname);
+	fprintf(stderr, "  --interval <seconds>  Sampling interval, may be less than one second.\n"
+			"                        Rates are then computed with nanosecond resolution.\n"
+			"  --buffer <samples>    Display stats from a separate thread, queuing up to\n"
+			"                        <samples> samples while output is blocked.\n"
+			"  --overflow <policy>   What to do when the queue is full: drop the oldest\n"
+			"                        sample (default) or wait for the output.\n"
+			"  --log <file>          Append stats of every interval to an XML log.\n"
+			"  --record <file>       Save raw stats of every interval to a binary file.\n"
+			"  --compress            Save differences between intervals in the file.\n"
+			"  --rollup              Also save min, max and average stats over every\n"
+			"                        minute and every hour to <file>.1m and <file>.1h.\n"
+			"  --history <file>      Keep the most recent raw stats in a file of fixed size.\n"
+			"  --history-size <MB>   Size of the history file (default: 64 MB).\n"
+			"  --shm /<name>         Publish the latest stats in POSIX shared memory.\n"
+			"  --serve <socket>      Serve the latest stats in Prometheus format over\n"
+			"                        HTTP on a unix socket.\n"
+			"  --serve-tcp <port>    Same on a TCP port of the loopback interface.\n"
+			"  --push <address>:<port>\n"
+			"                        Send the latest stats over UDP to a collector\n"
+			"                        (e.g. 127.0.0.1:8089) after every interval.\n"
+			"  --push-format <fmt>   InfluxDB line protocol (default) or statsd gauges.\n"
+			"  --extended            Display extended device stats.\n"
+			"  --memory              Display memory usage (not saved in recorded files).\n"
+			"  --net                 Display network interface stats (not saved in\n"
+			"                        recorded files).\n"
+			"  --irq <N>             Display the <N> IRQs that fired the most, with the\n"
+			"                        CPUs that served them (not saved in recorded files).\n"
+			"  --softirqs            Display the softirqs of each type served by every\n"
+			"                        CPU (not saved in recorded files).\n"
+			"  --replay <file>       Display the stats saved in a recorded or history file.\n"
+			"  --from, --to <time>   Only display stats recorded in this range of time,\n"
+			"                        given in seconds since the Epoch or as local time\n"
+			"                        \"YYYY-MM-DD HH:MM:SS\".\n"
+			"  --jobs <threads>      Number of threads decoding the file (default: one\n"
+			"                        per processor).\n"
+			"  --query <file>        Query a recorded, history or rollup file through its\n"
+			"                        index.\n"
+			"  --device <name>       Display the extended stats of a device when it was\n"
+			"                        active.\n"
+			"  --top <N>             Display the N devices with the highest average value\n"
+			"                        of a stat.\n"
+			"  --by <stat>           Stat devices are ranked by, named as in the header\n"
+			"                        of extended stats (default: %%util).\n");
+	exit(1);
+}
+
 /*
  * MAIN PROGAM
  */
 int main(int argc, char **argv)
 {
         int report_set = FALSE;
+        int opt = 0;
         long count = 1;
 	struct tm rectime;
 
@@ -1183,18 +3433,390 @@ int main(int argc, char **argv)
 		salloc_dev_list(argc - 1 + count_csvalues(argc, argv));
 	}
 
-        /* There are no options for this program, so just run normally. */
-        //usage(argv[0]);
+	/*
+	 * Process args: [ --interval <seconds> ] [ --buffer <samples> ]
+	 * [ --overflow <policy> ] [ --log <file> ]
+	 * [ --record <file> [ --compress ] [ --rollup ] ]
+	 * [ --history <file> [ --history-size <MB> ] ] [ --shm /<name> ]
+	 * [ --serve <socket> ] [ --serve-tcp <port> ]
+	 * [ --push <address>:<port> [ --push-format <fmt> ] ] [ --extended ]
+	 * [ --memory ] [ --net ] [ --irq <N> ] [ --softirqs ]
+	 * [ <interval> [ <count> ] ]
+	 * or: --replay <file> [ --from <time> ] [ --to <time> ] [ --jobs <threads> ]
+	 * [ --extended ]
+	 */
+	while (++opt < argc)
+        {
+		if (!strcmp(argv[opt], "--replay"))
+                {
+			if ((++opt >= argc) || replay_filename)
+                        {
+				usage(argv[0]);
+			}
+			replay_filename = argv[opt];
+			continue;
+		}
+		if (!strcmp(argv[opt], "--from") || !strcmp(argv[opt], "--to"))
+                {
+			unsigned long long t;
+
+			if ((++opt >= argc) || !(t = parse_replay_time(argv[opt])))
+                        {
+				usage(argv[0]);
+			}
+			if (argv[opt - 1][2] == 'f')
+                        {
+				replay_from = t;
+			}
+			else
+                        {
+				/* Up to the end of the second */
+				replay_to = t + NSEC_PER_SEC - 1;
+			}
+			continue;
+		}
+		if (!strcmp(argv[opt], "--query"))
+                {
+			if ((++opt >= argc) || query_filename)
+                        {
+				usage(argv[0]);
+			}
+			query_filename = argv[opt];
+			continue;
+		}
+		if (!strcmp(argv[opt], "--device"))
+                {
+			if ((++opt >= argc) || query_dev)
+                        {
+				usage(argv[0]);
+			}
+			query_dev = argv[opt];
+			continue;
+		}
+		if (!strcmp(argv[opt], "--top"))
+                {
+			if ((++opt >= argc) || !argv[opt][0] ||
+			    (strspn(argv[opt], DIGITS) != strlen(argv[opt])) ||
+			    ((query_top_nr = atoi(argv[opt])) < 1))
+                        {
+				usage(argv[0]);
+			}
+			continue;
+		}
+		if (!strcmp(argv[opt], "--by"))
+                {
+			if (++opt >= argc)
+                        {
+				usage(argv[0]);
+			}
+			query_metric = argv[opt];
+			continue;
+		}
+		if (!strcmp(argv[opt], "--jobs"))
+                {
+			if ((++opt >= argc) || !argv[opt][0] ||
+			    (strspn(argv[opt], DIGITS) != strlen(argv[opt])) ||
+			    ((replay_jobs = atoi(argv[opt])) < 1))
+                        {
+				usage(argv[0]);
+			}
+			continue;
+		}
+		if (!strcmp(argv[opt], "--extended"))
+                {
+			flags |= I_D_EXTENDED;
+			continue;
+		}
+		if (!strcmp(argv[opt], "--memory"))
+                {
+			flags |= I_D_MEMORY;
+			continue;
+		}
+		if (!strcmp(argv[opt], "--net"))
+                {
+			flags |= I_D_NET;
+			continue;
+		}
+		if (!strcmp(argv[opt], "--irq"))
+                {
+			if ((++opt >= argc) || !argv[opt][0] ||
+			    (strspn(argv[opt], DIGITS) != strlen(argv[opt])) ||
+			    ((irq_top_nr = atoi(argv[opt])) < 1))
+                        {
+				usage(argv[0]);
+			}
+			actflags |= M_D_IRQ_CPU;
+			continue;
+		}
+		if (!strcmp(argv[opt], "--softirqs"))
+                {
+			actflags |= M_D_SOFTIRQS;
+			continue;
+		}
+		if (!strcmp(argv[opt], "--log"))
+                {
+			if ((++opt >= argc) || log_fp)
+                        {
+				usage(argv[0]);
+			}
+			open_log(argv[opt]);
+			continue;
+		}
+		if (!strcmp(argv[opt], "--record"))
+                {
+			if ((++opt >= argc) || rec_filename)
+                        {
+				usage(argv[0]);
+			}
+			rec_filename = argv[opt];
+			continue;
+		}
+		if (!strcmp(argv[opt], "--history"))
+                {
+			if ((++opt >= argc) || hist_filename)
+                        {
+				usage(argv[0]);
+			}
+			hist_filename = argv[opt];
+			continue;
+		}
+		if (!strcmp(argv[opt], "--history-size"))
+                {
+			if ((++opt >= argc) || !argv[opt][0] ||
+			    (strspn(argv[opt], DIGITS) != strlen(argv[opt])) ||
+			    ((hist_size = atoll(argv[opt]) * 1024 * 1024) < 1))
+                        {
+				usage(argv[0]);
+			}
+			continue;
+		}
+		if (!strcmp(argv[opt], "--compress"))
+                {
+			rec_compress = TRUE;
+			continue;
+		}
+		if (!strcmp(argv[opt], "--shm"))
+                {
+			if ((++opt >= argc) || shm_name || (argv[opt][0] != '/'))
+                        {
+				usage(argv[0]);
+			}
+			shm_name = argv[opt];
+			continue;
+		}
+		if (!strcmp(argv[opt], "--serve"))
+                {
+			if ((++opt >= argc) || prom_path || !argv[opt][0])
+                        {
+				usage(argv[0]);
+			}
+			prom_path = argv[opt];
+			continue;
+		}
+		if (!strcmp(argv[opt], "--serve-tcp"))
+                {
+			if ((++opt >= argc) || prom_port || !argv[opt][0] ||
+			    (strspn(argv[opt], DIGITS) != strlen(argv[opt])) ||
+			    ((prom_port = atoi(argv[opt])) < 1) || (prom_port > 65535))
+                        {
+				usage(argv[0]);
+			}
+			continue;
+		}
+		if (!strcmp(argv[opt], "--push"))
+                {
+			if ((++opt >= argc) || push_dest || !strchr(argv[opt], ':'))
+                        {
+				usage(argv[0]);
+			}
+			push_dest = argv[opt];
+			continue;
+		}
+		if (!strcmp(argv[opt], "--push-format"))
+                {
+			if ((++opt >= argc) || (push_format >= 0))
+                        {
+				usage(argv[0]);
+			}
+			if (!strcmp(argv[opt], "influx"))
+                        {
+				push_format = PUSH_INFLUX;
+			}
+			else if (!strcmp(argv[opt], "statsd"))
+                        {
+				push_format = PUSH_STATSD;
+			}
+			else
+                        {
+				usage(argv[0]);
+			}
+			continue;
+		}
+		if (!strcmp(argv[opt], "--rollup"))
+                {
+			rec_rollup = TRUE;
+			continue;
+		}
+		if (!strcmp(argv[opt], "--buffer"))
+                {
+			if ((++opt >= argc) || !argv[opt][0] ||
+			    (strspn(argv[opt], DIGITS) != strlen(argv[opt])) ||
+			    ((ring_size = atoi(argv[opt])) < 1))
+                        {
+				usage(argv[0]);
+			}
+			continue;
+		}
+		if (!strcmp(argv[opt], "--overflow"))
+                {
+			if (++opt >= argc)
+                        {
+				usage(argv[0]);
+			}
+			if (!strcmp(argv[opt], "drop-oldest"))
+                        {
+				ring_policy = RING_DROP_OLDEST;
+			}
+			else if (!strcmp(argv[opt], "block"))
+                        {
+				ring_policy = RING_BLOCK;
+			}
+			else
+                        {
+				usage(argv[0]);
+			}
+			if (!ring_size)
+                        {
+				/* --overflow implies the use of a ring of samples */
+				ring_size = RING_DEF_SIZE;
+			}
+			continue;
+		}
+		if (!strcmp(argv[opt], "--interval"))
+                {
+			double secs;
+			char *end;
+
+			if (++opt >= argc)
+                        {
+				usage(argv[0]);
+			}
+			secs = strtod(argv[opt], &end);
+			if (*end || (secs < 0.000001) || interval_ns)
+                        {
+				usage(argv[0]);
+			}
+			interval_ns = (unsigned long long) (secs * NSEC_PER_SEC + 0.5);
+			/* Use the high-resolution interval to compute rates */
+			flags |= I_D_HIRES;
+			/* Stats are displayed until interrupted */
+			count = -1;
+			continue;
+		}
+		if (strspn(argv[opt], DIGITS) != strlen(argv[opt]) || !argv[opt][0])
+                {
+			usage(argv[0]);
+		}
+		if (!interval && !interval_ns)
+                {
+			/* Get interval */
+			if ((interval = atol(argv[opt])) < 1)
+                        {
+				usage(argv[0]);
+			}
+			interval_ns = interval * NSEC_PER_SEC;
+			/* Stats are displayed until interrupted */
+			count = -1;
+		}
+		else if (count < 0)
+                {
+			/* Get count value */
+			if ((count = atol(argv[opt])) < 1)
+                        {
+				usage(argv[0]);
+			}
+		}
+		else
+                {
+			usage(argv[0]);
+		}
+	}
 
         /* Provide all CPU and DISK stats. */
 	if (!report_set)
         {
-		flags |= I_D_CPU + I_D_DISK;
+		flags |= I_D_CPU + I_D_PER_CPU + I_D_DISK;
 	}
 
 	/* Select disk output unit (kB/s or blocks/s). */
 	set_disk_output_unit();
 
+	if (query_filename)
+        {
+		/* Exactly one query, on a recorded file only */
+		if (replay_filename || interval_ns || log_fp || rec_filename ||
+		    hist_filename || shm_name || prom_path || prom_port ||
+		    push_dest || (push_format >= 0) || ring_size || replay_jobs ||
+		    (!query_dev == !query_top_nr) || (replay_from > replay_to))
+                {
+			usage(argv[0]);
+		}
+		if (query_dev)
+                {
+			query_device(query_filename, query_dev, replay_from, replay_to);
+		}
+		else
+                {
+			query_top(query_filename, query_top_nr, query_metric,
+				  replay_from, replay_to);
+		}
+		sfree_dev_list();
+
+		return 0;
+	}
+	if (query_dev || query_top_nr)
+        {
+		/* These options only apply to a query */
+		usage(argv[0]);
+	}
+
+	if (replay_filename)
+        {
+		/* Recorded stats are displayed with the options of live ones */
+		if (interval_ns || log_fp || rec_filename || hist_filename ||
+		    shm_name || prom_path || prom_port || push_dest ||
+		    (push_format >= 0) || ring_size || DISPLAY_MEMORY(flags) ||
+		    DISPLAY_NET(flags) || actflags ||
+		    (replay_from > replay_to))
+                {
+			usage(argv[0]);
+		}
+		/* Rates are computed from the times at which samples were taken */
+		flags |= I_D_TIMESTAMP + I_D_HIRES;
+
+		replay_stats(replay_filename);
+		sfree_dev_list();
+
+		return 0;
+	}
+	if ((replay_from > 0) || (replay_to < ~0ULL) || replay_jobs)
+        {
+		/* These options only apply to a replay */
+		usage(argv[0]);
+	}
+	if (rec_rollup && !rec_filename)
+        {
+		/* Rollups are saved next to the recorded file */
+		usage(argv[0]);
+	}
+	if ((push_format >= 0) && !push_dest)
+        {
+		usage(argv[0]);
+	}
+
+	/* Stop cleanly on SIGINT and SIGTERM */
+	init_stop_handler();
+
         /* Initialize structures from the machine architecture. */
 	io_sys_init();
 
@@ -1204,14 +3826,91 @@ int main(int argc, char **argv)
 		presave_device_list();
 	}
 
+	/* Index the device names saved so far */
+	init_dev_index();
+
+	if (rec_filename)
+        {
+		/* Record raw stats of CPU "all", every CPU and every device */
+		rec_open(&st_rec, rec_filename, cpu_nr + 1, rec_compress);
+		rec_out = &st_rec;
+	}
+
+	if (rec_rollup)
+        {
+		/* Summarize stats over minutes and hours as they are recorded */
+		ru_open(&st_rollup, rec_filename, cpu_nr + 1);
+		ru_out = &st_rollup;
+	}
+
+	if (shm_name)
+        {
+		/* Publish the latest stats of CPU "all", every CPU and every device */
+		shm_create(&st_shm, shm_name, cpu_nr + 1, iodev_nr);
+		shm_out = &st_shm;
+	}
+
+	if (prom_path || prom_port)
+        {
+		/* Serve the latest stats to Prometheus scrapers */
+		prom_open(&st_prom, prom_path, prom_port);
+		prom_out = &st_prom;
+	}
+
+	if (push_dest)
+        {
+		/* Push the latest stats to a collector after every interval */
+		push_open(&st_push, push_dest, (push_format >= 0) ? push_format : PUSH_INFLUX);
+		push_out = &st_push;
+	}
+
+	if (hist_filename)
+        {
+		/* Keep the most recent raw stats in a file of fixed size */
+		rec_open_history(&st_hist, hist_filename, cpu_nr + 1, hist_size);
+		hist_out = &st_hist;
+	}
+
         /* Make a timestamp for the moment this program runs. */
 	get_localtime(&rectime, 0);
 
 	/* This is the main loop from which we may obtain our I/O stats. */
 	rw_io_stat_loop(count, &rectime);
 
-	/* Ask user whether or not to write an XML log. */
-	write_log();
+	/* Close the XML log. */
+	close_log();
+
+	if (rec_out)
+        {
+		/* Append the index of the samples recorded */
+		rec_close(rec_out);
+	}
+
+	if (ru_out)
+        {
+		/* Save the buckets being filled */
+		ru_close(ru_out);
+	}
+
+	if (shm_out)
+        {
+		shm_close(shm_out);
+	}
+
+	if (prom_out)
+        {
+		prom_close(prom_out);
+	}
+
+	if (push_out)
+        {
+		push_close(push_out);
+	}
+
+	if (hist_out)
+        {
+		rec_close(hist_out);
+	}
 
 	/* Free the structures. */
 	io_sys_free();